@@ -0,0 +1,107 @@
+#include "batch_font.h"
+#include <cmath>
+
+namespace
+{
+
+// Look up a glyph without having to name the (cinder version dependent)
+// type of TextureFont's glyph map.
+template <typename Map>
+const typename Map::mapped_type* find_glyph(const Map& map,
+                                            const typename Map::key_type& g)
+{
+    typename Map::const_iterator i = map.find(g);
+    return i == map.end() ? 0 : &i->second;
+}
+
+} // namespace
+
+
+TextLayout& BatchTextureFont::layout(const std::string& text)
+{
+    std::map<std::string, LayoutList::iterator>::iterator i =
+        m_layoutIndex.find(text);
+
+    if (i != m_layoutIndex.end())
+    {
+        // Move to the front.
+        m_layouts.splice(m_layouts.begin(), m_layouts, i->second);
+        return i->second->second;
+    }
+
+    if (m_layouts.size() >= kMaxCachedLayouts)
+    {
+        m_layoutIndex.erase(m_layouts.back().first);
+        m_layouts.pop_back();
+    }
+
+    m_layouts.push_front(std::make_pair(text, TextLayout()));
+    m_layoutIndex[text] = m_layouts.begin();
+
+    TextLayout& result = m_layouts.front().second;
+    buildLayout(text, &result);
+    return result;
+}
+
+void BatchTextureFont::addString(QuadBatch& batch, const std::string& text,
+                                 const Vec2f& baseline)
+{
+    boost::lock_guard<boost::mutex> lock(m_layoutMutex);
+    const TextLayout& l = layout(text);
+
+    for (size_t i = 0; i < l.glyphs.size(); ++i)
+    {
+        const GlyphQuad& g = l.glyphs[i];
+
+        // Snap to whole pixels, as TextureFont does.
+        Rectf dest = g.rect + baseline;
+        dest -= Vec2f(dest.x1 - std::floor(dest.x1),
+                      dest.y1 - std::floor(dest.y1));
+
+        batch.addTexturedQuad(g.texture, g.target,
+                              dest.x1, dest.y1, dest.x2, dest.y2,
+                              g.uv.x1, g.uv.y1, g.uv.x2, g.uv.y2);
+    }
+}
+
+void BatchTextureFont::buildLayout(const std::string& text,
+                                   TextLayout* layout) const
+{
+    // Same placement as TextureFont::drawGlyphs (at a scale of 1), but
+    // relative to a baseline at the origin.
+    std::vector<std::pair<uint16_t, Vec2f> > placements =
+        getGlyphPlacements(text);
+
+    const float ascent = mFont.getAscent();
+
+    layout->glyphs.clear();
+    layout->glyphs.reserve(placements.size());
+    layout->hasExtents = false;
+    layout->extentsX = layout->extentsY = 0.0f;
+    layout->extentsW = layout->extentsH = 0.0f;
+
+    for (size_t i = 0; i < placements.size(); ++i)
+    {
+        const GlyphInfo* info = find_glyph(mGlyphMap, placements[i].first);
+        if (!info)
+        {
+            continue;
+        }
+
+        const gl::Texture& tex = mTextures[info->mTextureIndex];
+
+        GlyphQuad g;
+        g.texture = tex.getId();
+        g.target = tex.getTarget();
+        g.uv = tex.getAreaTexCoords(info->mTexCoords);
+
+        g.rect = Rectf(info->mTexCoords);
+        g.rect -= g.rect.getUpperLeft();
+        g.rect += placements[i].second;
+        g.rect += Vec2f(std::floor(info->mOriginOffset.x + 0.5f),
+                        std::floor(info->mOriginOffset.y));
+        g.rect += Vec2f(0.0f, -ascent);
+
+        layout->glyphs.push_back(g);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef orlok_batch_font_h
+#define orlok_batch_font_h
+
+/*
+A TextureFont whose glyphs are drawn through the QuadBatch (and so are
+transformed on the CPU and batched with everything else), rather than being
+drawn immediately using the modelview matrix.
+
+The glyph layout of recently drawn strings is cached, so drawing the same
+text again (eg, every frame) only has to emit the quads.
+
+The cache is shared by everything using the font, so with a render thread
+(see RenderThread) it's locked: addString takes the lock itself, and other
+users of layout must hold layoutMutex while they use the result.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/TextureFont.h"
+#include "quad_batch.h"
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace ci;
+
+
+// A glyph's quad, positioned relative to the start of the baseline (before
+// pixel snapping).
+struct GlyphQuad
+{
+    GLuint texture;
+    GLenum target;
+    Rectf  rect;
+    Rectf  uv;
+};
+
+struct TextLayout
+{
+    std::vector<GlyphQuad> glyphs;
+
+    // Extents as measured by cairo (see cinder_get_font_extents). Filled in
+    // by the caller the first time they're needed.
+    bool  hasExtents;
+    float extentsX, extentsY, extentsW, extentsH;
+};
+
+
+class BatchTextureFont;
+typedef std::shared_ptr<BatchTextureFont> BatchTextureFontRef;
+
+class BatchTextureFont : public gl::TextureFont
+{
+public:
+    // Number of layouts kept (least recently used are dropped first).
+    static const size_t kMaxCachedLayouts = 128;
+
+    static BatchTextureFontRef create(const Font& font)
+    {
+        return BatchTextureFontRef(new BatchTextureFont(font));
+    }
+
+    // Return the layout of text, from the cache if possible.
+    TextLayout& layout(const std::string& text);
+    boost::mutex& layoutMutex() { return m_layoutMutex; }
+
+    // Add a quad to batch for each glyph in text, with the text's baseline
+    // starting at baseline. Uses the batch's current transform and color.
+    void addString(QuadBatch& batch, const std::string& text,
+                   const Vec2f& baseline);
+
+protected:
+    explicit BatchTextureFont(const Font& font)
+        : gl::TextureFont(font, gl::TextureFont::defaultChars(),
+                          gl::TextureFont::Format())
+    {
+    }
+
+private:
+    void buildLayout(const std::string& text, TextLayout* layout) const;
+
+    // Most recently used first.
+    typedef std::list<std::pair<std::string, TextLayout> > LayoutList;
+
+    LayoutList                                   m_layouts;
+    std::map<std::string, LayoutList::iterator> m_layoutIndex;
+    boost::mutex                                 m_layoutMutex;
+};
+
+#endif
@@ -0,0 +1,439 @@
+#include "blitter.h"
+#include "surface_ops.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+// How each source pixel is adjusted before blending. Pixels of surfaces
+// without alpha have an unused last byte, which is taken as 255.
+struct BlendParams
+{
+    uint32_t alpha;       // global alpha, 0 to 255
+    bool     srcOpaque;
+    bool     dstOpaque;
+};
+
+// Kernels blend runs of n 4 byte source pixels onto n destination pixels.
+typedef void (*BlendKernel)(uint8_t* dst, const uint8_t* src, int n,
+                            const BlendParams& params);
+
+// Below this many pixels, a batch isn't worth splitting across threads.
+const int kMinParallelPixels = 64 * 1024;
+
+//----------------------------------------------------------------------------
+// Plain C++ versions. These define the results the SIMD versions must
+// match, and handle whatever is left over after their last full block.
+
+// x / 255, rounded to nearest (exact for x <= 255 * 255).
+inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Each blend is applied per channel (alpha included), to a source value s
+// and destination value d, with the pixels' alphas sa and da. Results are
+// clamped to 255.
+
+struct SourceOver
+{
+    static uint32_t apply(uint32_t s, uint32_t d, uint32_t sa, uint32_t)
+    {
+        return std::min<uint32_t>(255, s + div255(d * (255 - sa)));
+    }
+};
+
+struct Additive
+{
+    static uint32_t apply(uint32_t s, uint32_t d, uint32_t, uint32_t)
+    {
+        return std::min<uint32_t>(255, s + d);
+    }
+};
+
+struct Multiply
+{
+    static uint32_t apply(uint32_t s, uint32_t d, uint32_t sa, uint32_t da)
+    {
+        return std::min<uint32_t>(255, div255(s * d) +
+                                       div255(s * (255 - da)) +
+                                       div255(d * (255 - sa)));
+    }
+};
+
+struct Screen
+{
+    static uint32_t apply(uint32_t s, uint32_t d, uint32_t, uint32_t)
+    {
+        return std::min<uint32_t>(255, s + d - div255(s * d));
+    }
+};
+
+template <class Blend>
+void blend_scalar(uint8_t* d, const uint8_t* s, int n,
+                  const BlendParams& params)
+{
+    for (int i = 0; i < n; ++i, d += 4, s += 4)
+    {
+        uint32_t sp[4] = { s[0], s[1], s[2], params.srcOpaque ? 255u : s[3] };
+        uint32_t dp[4] = { d[0], d[1], d[2], params.dstOpaque ? 255u : d[3] };
+
+        if (params.alpha != 255)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                sp[c] = div255(sp[c] * params.alpha);
+            }
+        }
+
+        for (int c = 0; c < 4; ++c)
+        {
+            d[c] = static_cast<uint8_t>(Blend::apply(sp[c], dp[c],
+                                                     sp[3], dp[3]));
+        }
+    }
+}
+
+#ifdef __SSE2__
+//----------------------------------------------------------------------------
+// SSE2 versions, 4 pixels (16 bytes) at a time, as two pixels widened to
+// 16 bits per channel in each register.
+
+inline __m128i div255_epu16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Each pixel's alpha in all four of its channels.
+inline __m128i broadcast_alpha(__m128i px)
+{
+    return _mm_shufflehi_epi16(
+        _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+inline __m128i inverse(__m128i a)
+{
+    return _mm_sub_epi16(_mm_set1_epi16(255), a);
+}
+
+// Results may be over 255 (but not 16 bits); the final pack clamps them.
+
+struct SourceOverSse2
+{
+    static __m128i apply(__m128i s, __m128i d, __m128i sa, __m128i)
+    {
+        return _mm_adds_epu16(s, div255_epu16(_mm_mullo_epi16(d, inverse(sa))));
+    }
+};
+
+struct AdditiveSse2
+{
+    static __m128i apply(__m128i s, __m128i d, __m128i, __m128i)
+    {
+        return _mm_adds_epu16(s, d);
+    }
+};
+
+struct MultiplySse2
+{
+    static __m128i apply(__m128i s, __m128i d, __m128i sa, __m128i da)
+    {
+        __m128i x = div255_epu16(_mm_mullo_epi16(s, d));
+        x = _mm_adds_epu16(x, div255_epu16(_mm_mullo_epi16(s, inverse(da))));
+        return _mm_adds_epu16(x, div255_epu16(_mm_mullo_epi16(d, inverse(sa))));
+    }
+};
+
+struct ScreenSse2
+{
+    static __m128i apply(__m128i s, __m128i d, __m128i, __m128i)
+    {
+        return _mm_sub_epi16(_mm_add_epi16(s, d),
+                             div255_epu16(_mm_mullo_epi16(s, d)));
+    }
+};
+
+template <class Blend>
+inline __m128i blend_2_pixels(__m128i s, __m128i d, __m128i alpha,
+                              bool scale)
+{
+    if (scale)
+    {
+        s = div255_epu16(_mm_mullo_epi16(s, alpha));
+    }
+    return Blend::apply(s, d, broadcast_alpha(s), broadcast_alpha(d));
+}
+
+template <class Blend, class Scalar>
+void blend_sse2(uint8_t* d, const uint8_t* s, int n,
+                const BlendParams& params)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xff000000));
+    const __m128i srcOr = params.srcOpaque ? opaque : zero;
+    const __m128i dstOr = params.dstOpaque ? opaque : zero;
+    const __m128i alpha = _mm_set1_epi16(static_cast<short>(params.alpha));
+    const bool scale = params.alpha != 255;
+
+    int blocks = n / 4;
+    for (int i = 0; i < blocks; ++i, d += 16, s += 16)
+    {
+        __m128i sv = _mm_or_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)), srcOr);
+        __m128i dv = _mm_or_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(d)), dstOr);
+
+        __m128i lo = blend_2_pixels<Blend>(_mm_unpacklo_epi8(sv, zero),
+                                           _mm_unpacklo_epi8(dv, zero),
+                                           alpha, scale);
+        __m128i hi = blend_2_pixels<Blend>(_mm_unpackhi_epi8(sv, zero),
+                                           _mm_unpackhi_epi8(dv, zero),
+                                           alpha, scale);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d),
+                         _mm_packus_epi16(lo, hi));
+    }
+
+    blend_scalar<Scalar>(d, s, n % 4, params);
+}
+#endif // __SSE2__
+
+//----------------------------------------------------------------------------
+// Dispatch
+
+struct Kernels
+{
+    BlendKernel blend[kNumBlitBlends];
+
+    Kernels()
+    {
+        blend[kBlitSourceOver] = blend_scalar<SourceOver>;
+        blend[kBlitAdditive] = blend_scalar<Additive>;
+        blend[kBlitMultiply] = blend_scalar<Multiply>;
+        blend[kBlitScreen] = blend_scalar<Screen>;
+#ifdef __SSE2__
+        if (cpu_has_sse2())
+        {
+            blend[kBlitSourceOver] = blend_sse2<SourceOverSse2, SourceOver>;
+            blend[kBlitAdditive] = blend_sse2<AdditiveSse2, Additive>;
+            blend[kBlitMultiply] = blend_sse2<MultiplySse2, Multiply>;
+            blend[kBlitScreen] = blend_sse2<ScreenSse2, Screen>;
+        }
+#endif
+    }
+};
+
+const Kernels& kernels()
+{
+    static const Kernels k;
+    return k;
+}
+
+//----------------------------------------------------------------------------
+// Blitting
+
+// True if the kernels can handle surface's pixels: 4 bytes, with alpha (or
+// nothing) in the last one.
+bool is_blittable(const Surface8u& surface)
+{
+    const SurfaceChannelOrder& order = surface.getChannelOrder();
+    return surface.getPixelInc() == 4 &&
+           std::max(order.getRedOffset(),
+                    std::max(order.getGreenOffset(),
+                             order.getBlueOffset())) < 3 &&
+           (!surface.hasAlpha() || order.getAlphaOffset() == 3);
+}
+
+bool same_colors(const Surface8u& a, const Surface8u& b)
+{
+    const SurfaceChannelOrder& x = a.getChannelOrder();
+    const SurfaceChannelOrder& y = b.getChannelOrder();
+    return x.getRedOffset() == y.getRedOffset() &&
+           x.getGreenOffset() == y.getGreenOffset() &&
+           x.getBlueOffset() == y.getBlueOffset();
+}
+
+bool is_empty(const Area& area)
+{
+    return area.getWidth() <= 0 || area.getHeight() <= 0;
+}
+
+// A blit after clipping: dest is the area of the destination it changes,
+// and the source pixel for (x, y) in dest is (x, y) + srcOffset.
+struct ClippedBlit
+{
+    const Surface8u* src;
+    Area             dest;
+    Vec2i            srcOffset;
+    bool             srcOpaque;
+};
+
+struct BlitJob
+{
+    std::vector<ClippedBlit> blits;
+    Surface8u*               dst;
+    BlendKernel              kernel;
+    BlendParams              params;
+    int                      top;  // first destination row any blit changes
+};
+
+// Apply every blit, in order, to destination rows [begin, end) (counted
+// from job.top).
+void blit_rows(const BlitJob& job, int begin, int end)
+{
+    BlendParams params = job.params;
+
+    for (size_t i = 0; i < job.blits.size(); ++i)
+    {
+        const ClippedBlit& b = job.blits[i];
+        const int y1 = std::max(b.dest.getY1(), job.top + begin);
+        const int y2 = std::min(b.dest.getY2(), job.top + end);
+        params.srcOpaque = b.srcOpaque;
+
+        for (int y = y1; y < y2; ++y)
+        {
+            job.kernel(job.dst->getData(Vec2i(b.dest.getX1(), y)),
+                       b.src->getData(Vec2i(b.dest.getX1(), y) + b.srcOffset),
+                       b.dest.getWidth(), params);
+        }
+    }
+}
+
+// True if any of blits changes part of area.
+bool overlaps_any(const std::vector<ClippedBlit>& blits, const Area& area)
+{
+    for (size_t i = 0; i < blits.size(); ++i)
+    {
+        if (!is_empty(blits[i].dest.getClipBy(area)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Apply job's blits, whose destination rows are [job.top, bottom), split
+// across pool if they cover enough pixels, then clear them.
+void run_blits(BlitJob& job, int bottom, int pixels, WorkerPool* pool)
+{
+    if (job.blits.empty())
+    {
+        return;
+    }
+
+    if (pool && pixels >= kMinParallelPixels)
+    {
+        pool->parallelFor(bottom - job.top, 16,
+                          boost::bind(&blit_rows, boost::cref(job), _1, _2));
+    }
+    else
+    {
+        blit_rows(job, 0, bottom - job.top);
+    }
+    job.blits.clear();
+}
+
+} // namespace
+
+
+bool blit_surfaces(const std::vector<Blit>& blits, Surface8u& dst,
+                   const Area& clip, BlitBlend blend, float alpha,
+                   WorkerPool* pool, std::vector<Area>* changed)
+{
+    if (!is_blittable(dst) || blend < 0 || blend >= kNumBlitBlends)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < blits.size(); ++i)
+    {
+        if (!is_blittable(*blits[i].src) || !same_colors(*blits[i].src, dst))
+        {
+            return false;
+        }
+    }
+
+    const uint32_t a = static_cast<uint32_t>(
+        std::max(0.0f, std::min(1.0f, alpha)) * 255.0f + 0.5f);
+    const Area limit = clip.getClipBy(dst.getBounds());
+    if (a == 0 || is_empty(limit))
+    {
+        return true;
+    }
+
+    BlitJob job;
+    job.dst = &dst;
+    job.kernel = kernels().blend[blend];
+    job.params.alpha = a;
+    job.params.srcOpaque = false;
+    job.params.dstOpaque = !dst.hasAlpha();
+
+    // Sources that are the destination itself are copied first, so that
+    // blits (and bands of rows) don't read pixels already blended. A copy
+    // that overlaps what earlier blits change has to wait for them, so the
+    // blits so far are run before it's made.
+    std::vector<Surface8u> copies;
+    copies.reserve(blits.size());
+
+    int top = limit.getY2();
+    int bottom = limit.getY1();
+    int pixels = 0;
+
+    for (size_t i = 0; i < blits.size(); ++i)
+    {
+        const Blit& blit = blits[i];
+
+        Area src = blit.srcArea.getClipBy(blit.src->getBounds());
+        Area dest = (src + (blit.destPt - blit.srcArea.getUL()))
+                        .getClipBy(limit);
+        if (is_empty(dest))
+        {
+            continue;
+        }
+
+        ClippedBlit b;
+        b.src = blit.src;
+        b.dest = dest;
+        b.srcOffset = blit.srcArea.getUL() - blit.destPt;
+        b.srcOpaque = !blit.src->hasAlpha();
+
+        if (blit.src->getData() == dst.getData())
+        {
+            Area from = dest + b.srcOffset;
+            if (overlaps_any(job.blits, from))
+            {
+                job.top = top;
+                run_blits(job, bottom, pixels, pool);
+                top = limit.getY2();
+                bottom = limit.getY1();
+                pixels = 0;
+            }
+
+            copies.push_back(Surface8u(from.getWidth(), from.getHeight(),
+                                       dst.hasAlpha(), dst.getChannelOrder()));
+            copies.back().copyFrom(dst, from, -from.getUL());
+            b.src = &copies.back();
+            b.srcOffset = -dest.getUL();
+        }
+
+        job.blits.push_back(b);
+        top = std::min(top, dest.getY1());
+        bottom = std::max(bottom, dest.getY2());
+        pixels += dest.getWidth() * dest.getHeight();
+        if (changed)
+        {
+            changed->push_back(dest);
+        }
+    }
+
+    job.top = top;
+    run_blits(job, bottom, pixels, pool);
+    return true;
+}
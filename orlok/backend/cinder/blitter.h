@@ -0,0 +1,62 @@
+#ifndef orlok_blitter_h
+#define orlok_blitter_h
+
+/*
+Compositing rects of one surface onto another with a blend mode and a
+global alpha, for baking decals, backgrounds and the like without going
+through cairo.
+
+Pixels are taken to be premultiplied, as cairo's are. Both surfaces must
+be 8 bit with 4 bytes per pixel, the same channel order, and alpha (if
+they have any) in the last byte. A source without alpha is treated as
+opaque.
+
+Inner loops use SSE2 (4 pixels at a time) when the CPU has it; results are
+identical to the plain C++ versions. Batches covering many pixels are
+split into bands of destination rows, one per WorkerPool thread, with
+every blit applied in order within each band.
+
+A batch always gives the same result as doing its blits one at a time, in
+order. Blits whose source is the destination read a copy of the source
+area. The copy is made once the earlier blits that change that area are
+done, so only such batches are split into several passes.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/Surface.h"
+#include "worker_pool.h"
+#include <vector>
+
+using namespace ci;
+
+
+// Values match the Dylan side's <bitmap-blend> mapping. With s the source
+// pixel (times the global alpha) and d the destination pixel:
+enum BlitBlend
+{
+    kBlitSourceOver = 0,  // s + d * (1 - sa)
+    kBlitAdditive,        // min(1, s + d)
+    kBlitMultiply,        // s * d + s * (1 - da) + d * (1 - sa)
+    kBlitScreen,          // s + d - s * d
+
+    kNumBlitBlends
+};
+
+struct Blit
+{
+    const Surface8u* src;
+    Area             srcArea;
+    Vec2i            destPt;  // where srcArea's top left goes in dst
+};
+
+// Blend each of blits onto dst in turn, clipped to clip, dst's bounds and
+// its source's bounds. alpha (0 to 1) scales every source pixel. If pool
+// is not null, large batches are split across it. Adds the area each blit
+// changed to changed (if not null), and returns false (doing nothing) if
+// the surfaces' formats aren't supported.
+bool blit_surfaces(const std::vector<Blit>& blits, Surface8u& dst,
+                   const Area& clip, BlitBlend blend, float alpha,
+                   WorkerPool* pool, std::vector<Area>* changed);
+
+#endif
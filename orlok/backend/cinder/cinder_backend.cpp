@@ -5,16 +5,47 @@
 #include "cinder/audio/Output.h"
 #include "cinder/audio/Io.h"
 #include "cinder/Font.h"
-#include "cinder/ip/Fill.h"
-#include "cinder/ip/Flip.h"
-#include "cinder/ip/Premultiply.h"
-#include "cinder/ip/Resize.h"
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Texture.h"
 #include "cinder/gl/TextureFont.h"
 #include "cinder/gl/GlslProg.h"
 #include "cinder/gl/Fbo.h"
+#include "cinder/ImageIo.h"
+#include "cinder/Timer.h"
+#include "gl_state.h"
+#include "quad_batch.h"
+#include "batch_font.h"
+#include "texture_atlas.h"
+#include "tracked_surface.h"
+#include "tiled_surface.h"
+#include "streaming_texture.h"
+#include "line_builder.h"
+#include "sprite_instancer.h"
+#include "mesh.h"
+#include "surface_ops.h"
+#include "resampler.h"
+#include "blitter.h"
+#include "worker_pool.h"
+#include "resource_loader.h"
+#include "texture_cache.h"
+#include "residency.h"
+#include "render_target_pool.h"
+#include "shader_program.h"
+#include "profiler.h"
+#include "offscreen_context.h"
+#include "frame_clock.h"
+#include "command_buffer.h"
+#include "render_thread.h"
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/ref.hpp>
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 using namespace ci;
 using namespace ci::app;
@@ -25,9 +56,84 @@ using namespace ci::app;
 struct FontT
 {
     Font*               font;
-    gl::TextureFontRef  textureFont;
+    BatchTextureFontRef textureFont;
 };
 
+// GL counts for a finished frame (see cinder_gl_get_frame_stats).
+struct RenderStats
+{
+    int          drawCalls;
+    int          quads;
+    int          changes[GlStateCache::kNumKinds];
+    int          filtered[GlStateCache::kNumKinds];
+    gl::Texture* frame;   // what was drawn, to be shown in the window
+};
+
+namespace
+{
+
+// Commands recorded for the render thread. Most replay the cinder_gl_*
+// function of the same name.
+enum RenderCommand
+{
+    kCmdBeginFrame,
+    kCmdEndFrame,
+    kCmdSetViewport,
+    kCmdSetMatricesWindow,
+    kCmdSetColor,
+    kCmdSetBlend,
+    kCmdFlush,
+    kCmdUploadTexture,
+    kCmdStreamTexture,
+    kCmdFreeTexture,
+    kCmdFreeStreamingTexture,
+    kCmdFreeTextureAtlas,
+    kCmdBindTexture,
+    kCmdUpdateTransform,
+    kCmdClear,
+    kCmdDrawRect,
+    kCmdDrawText,
+    kCmdDrawLine,
+    kCmdDrawLines,
+    kCmdDrawPolyline,
+    kCmdDrawSprites,
+    kCmdUpdateMesh,
+    kCmdDrawMesh,
+    kCmdFreeMesh,
+    kCmdFreeShaderProgram,
+    kCmdSetUniform,
+    kCmdUseShaderProgram,
+    kCmdFreeFramebuffer,
+    kCmdPurgeRenderTargets,
+    kCmdBindFramebuffer,
+    kCmdFreeFont
+};
+
+// Wraps a function with a result, for RenderThread::call.
+template <typename Result>
+struct RenderCall
+{
+    boost::function<Result ()> fn;
+    Result                     result;
+
+    void operator()() { result = fn(); }
+};
+
+// Run fn on the render thread (after everything recorded so far), and
+// return its result.
+template <typename Result>
+Result call_on_render_thread(RenderThread& thread,
+                             const boost::function<Result ()>& fn)
+{
+    RenderCall<Result> call;
+    call.fn = fn;
+    call.result = Result();
+    thread.call(boost::ref(call));
+    return call.result;
+}
+
+} // namespace
+
 
 // This is the cinder app that provides the Orlok backend functionality.
 class CinderBackendApp : public AppBasic
@@ -52,12 +158,93 @@ public:
     void update();
     void draw();
 
+    // GL setup and cleanup, done on the render thread if there is one.
+    void setupGl();
+    void cleanupGl();
+
+    // The GL side of a frame, around the app's drawing. Done on the render
+    // thread if there is one.
+    void beginGlFrame();
+    void endGlFrame();
+    void collectRenderStats(RenderStats* stats);
+
+    // Frames drawn with a render thread.
+    void drawOnRenderThread();
+    void beginFrameTarget(int width, int height);
+    void presentFrame(gl::Texture* frame);
+
 public:
     cairo::GradientLinear m_linearGradient;
     cairo::GradientRadial m_radialGradient;
     cairo::Gradient* m_activeGradient;
 
     cairo::Context m_fontContext; // context required to get font metrics
+
+    // All frequently changed GL state goes through here, so that redundant
+    // changes can be filtered out (and counted).
+    GlStateCache m_glState;
+
+    // Rects are batched, rather than drawn immediately. The batch also holds
+    // the current transform, texture, shader, blend mode and color.
+    QuadBatch m_quadBatch;
+
+    // The custom shader program in use (null for the built-in one), and
+    // its uvTransform uniform's handle (-1 if it has none), which meshes
+    // set (see cinder_gl_draw_mesh).
+    ShaderProgram* m_shaderProgram;
+    int            m_uvTransformHandle;
+
+    // Expands batches of lines into m_quadBatch.
+    LineBuilder m_lineBuilder;
+
+    // Draws packed arrays of sprites (see cinder_gl_draw_sprites).
+    SpriteInstancer m_spriteInstancer;
+
+    // Transient render targets (see cinder_gl_acquire_render_target).
+    RenderTargetPool m_renderTargets;
+
+    // Frame timings and counters (see cinder_profile_get_frame).
+    Profiler m_profiler;
+
+    // Fixed timestep update ticks and frame pacing.
+    FrameClock m_frameClock;
+
+    // Threads for splitting up CPU work on surfaces, like resampling and
+    // blitting, and for decoding resources loaded in the background.
+    WorkerPool m_workers;
+
+    // Background loads (see cinder_load_surface_async), whose GL work is
+    // finished at the start of each GL frame, for up to m_loadBudget
+    // seconds.
+    ResourceLoader m_loader;
+    double         m_loadBudget;
+
+    // Keeps textures made from surfaces and images within a GPU memory
+    // budget (see cinder_set_texture_budget).
+    ResidencyManager m_residency;
+
+    // Size last passed to cinder_gl_set_matrices_window (0 if unknown), so
+    // the projection is only reloaded when it actually changes.
+    int m_projectionWidth;
+    int m_projectionHeight;
+
+    // Set when run by cinder_run_headless, in which case there is no window
+    // and cinder's app loop isn't running (so quitting, etc. is up to us).
+    bool  m_headless;
+    bool  m_quitRequested;
+    float m_headlessFps;
+
+    // Running if GL calls are recorded and replayed on a render thread (see
+    // cinder_run), rather than made directly.
+    RenderThread m_renderThread;
+    // The render thread draws frames into these in turn, and each is shown
+    // in the window once it's finished.
+    gl::Fbo*     m_frameTargets[2];
+    int          m_frameTarget;
+    // Filled in by the render thread at the end of each frame, and copied
+    // into m_lastRenderStats (for the main thread) while it's idle.
+    RenderStats  m_renderStats;
+    RenderStats  m_lastRenderStats;
 };
 
 // C interface (wrapped via Dylan C-FFI)
@@ -70,7 +257,37 @@ static int cinder_h = 600;
 static int cinder_resizable = 1;
 static int cinder_fullscreen = 0;
 static int cinder_frames_per_second = 60;
+static int cinder_render_thread = 0;
 static CinderBackendApp* cinder_app = 0;
+// Null if images aren't cached (see cinder_set_texture_cache_dir).
+static TextureCache* texture_cache = 0;
+
+// These functions are defined in Dylan as c-callable-wrappers.
+
+extern void cinder_startup();
+extern void cinder_shutdown();
+extern void cinder_update();
+extern void cinder_draw();
+extern void cinder_resize(int new_width, int new_height, int full_screen);
+extern void cinder_key_down(int key_id);
+extern void cinder_key_up(int key_id);
+extern void cinder_mouse_down(int btn_id,
+                              int x,
+                              int y,
+                              int is_left_btn_down,
+                              int is_right_btn_down,
+                              int is_middle_btn_down);
+extern void cinder_mouse_up(int btn_id,
+                            int x,
+                            int y,
+                            int is_left_btn_down,
+                            int is_right_btn_down,
+                            int is_middle_btn_down);
+extern void cinder_mouse_move(int x,
+                              int y,
+                              int is_left_btn_down,
+                              int is_right_btn_down,
+                              int is_middle_btn_down);
 
 // Note: The following functions are callable from Dylan, as c-functions.
 
@@ -78,13 +295,14 @@ void cinder_run(int width, int height,
                 int appWidth, int appHeight,
                 int forceAppAspectRatio,
                 int fullscreen, int frames_per_second,
-                int antialiasing)
+                int antialiasing, int renderThread)
 {
     cinder_w = width;
     cinder_h = height;
     cinder_resizable = 1; // ???
     cinder_fullscreen = fullscreen;
     cinder_frames_per_second = frames_per_second;
+    cinder_render_thread = renderThread;
 
     // TODO: get real argc and argv (what are they used for?)
 
@@ -101,24 +319,218 @@ void cinder_run(int width, int height,
     cinder::app::AppBasic::cleanupLaunch();
 }
 
+static void print_headless_stats(std::vector<double>& frameTimes,
+                                 double startupTime, double totalTime,
+                                 bool software)
+{
+    // Mostly loading, so comparing runs with a cold and a warm texture
+    // cache shows what the cache saves.
+    std::printf("headless: startup %.3f s", startupTime);
+    if (texture_cache)
+    {
+        std::printf(", texture cache %d hits, %d misses",
+                    texture_cache->hits(), texture_cache->misses());
+    }
+    std::printf("\n");
+
+    const int n = static_cast<int>(frameTimes.size());
+    if (n == 0)
+    {
+        std::printf("headless: no frames run\n");
+        return;
+    }
+
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i)
+    {
+        sum += frameTimes[i];
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    std::printf("headless (%s renderer): %d frames in %.3f s, %.1f fps\n",
+                software ? "software" : "hardware", n, totalTime,
+                n / totalTime);
+    std::printf("  frame ms: mean %.3f  min %.3f  median %.3f  95%% %.3f"
+                "  max %.3f\n",
+                sum / n * 1000.0, frameTimes[0] * 1000.0,
+                frameTimes[n / 2] * 1000.0,
+                frameTimes[std::min(n - 1, n * 95 / 100)] * 1000.0,
+                frameTimes[n - 1] * 1000.0);
+
+    // GPU times are only kept for the last few seconds.
+    const Profiler& profiler = cinder_app->m_profiler;
+    double gpuSum = 0.0;
+    double cpuSum = 0.0;
+    int gpuFrames = 0;
+    for (int age = 0; age < profiler.numFrames(); ++age)
+    {
+        const Profiler::Frame& f = profiler.frame(age);
+        cpuSum += f.cpuTime;
+        if (f.gpuTime >= 0.0)
+        {
+            gpuSum += f.gpuTime;
+            ++gpuFrames;
+        }
+    }
+    if (profiler.numFrames() > 0)
+    {
+        std::printf("  last %d frames: cpu ms mean %.3f",
+                    profiler.numFrames(),
+                    cpuSum / profiler.numFrames() * 1000.0);
+        if (gpuFrames > 0)
+        {
+            std::printf(", gpu ms mean %.3f (%d frames)",
+                        gpuSum / gpuFrames * 1000.0, gpuFrames);
+        }
+        std::printf("\n");
+    }
+
+    const MemoryLedger& ledger = memory_ledger();
+    std::printf("  peak KB: surfaces %lld  textures %lld  render textures %lld"
+                "  (%d evictions, %d rebuilds)\n",
+                static_cast<long long>(ledger.peak(kMemorySurfaces) / 1024),
+                static_cast<long long>(ledger.peak(kMemoryTextures) / 1024),
+                static_cast<long long>(ledger.peak(kMemoryRenderTextures) / 1024),
+                cinder_app->m_residency.numEvictions(),
+                cinder_app->m_residency.numRebuilds());
+}
+
+int cinder_run_headless(int width, int height,
+                        int numFrames, int frames_per_second,
+                        int numCaptures, const int* captureFrames,
+                        const char* capturePrefix)
+{
+    cinder_w = width;
+    cinder_h = height;
+    cinder_fullscreen = 0;
+    cinder_frames_per_second = frames_per_second;
+
+    cinder::app::AppBasic::prepareLaunch();
+    cinder_app = new CinderBackendApp;
+    cinder_app->m_headless = true;
+
+    OffscreenContext context;
+    const char* errorMsg = 0;
+    if (!context.create(width, height, &errorMsg))
+    {
+        std::fprintf(stderr, "headless: %s\n", errorMsg);
+        delete cinder_app;
+        cinder_app = 0;
+        cinder::app::AppBasic::cleanupLaunch();
+        return 0;
+    }
+
+    // The same sequence of calls cinder makes for a window: setup, an
+    // initial resize, then update and draw for each frame. Updates always
+    // use the fixed dt (see cinder-update), so runs are repeatable.
+    Timer startup(true);
+    cinder_app->setup();
+    cinder_resize(width, height, 0);
+    double startupTime = startup.getSeconds();
+
+    std::vector<double> frameTimes;
+    frameTimes.reserve(numFrames);
+    Timer clock;
+    clock.start();
+
+    for (int frame = 0; frame < numFrames && !cinder_app->m_quitRequested;
+         ++frame)
+    {
+        double start = clock.getSeconds();
+
+        cinder_app->update();
+        cinder_app->draw();
+        // Nothing waits for a swap, so wait for GL here to include the
+        // frame's GPU work in its time.
+        glFinish();
+
+        double end = clock.getSeconds();
+        frameTimes.push_back(end - start);
+        cinder_app->m_headlessFps =
+            static_cast<float>(frameTimes.size() / std::max(end, 1.0e-6));
+
+        if (std::find(captureFrames, captureFrames + numCaptures, frame) !=
+            captureFrames + numCaptures)
+        {
+            std::ostringstream path;
+            path << capturePrefix << frame << ".png";
+            try
+            {
+                writeImage(path.str(), context.readPixels());
+            }
+            catch (...)
+            {
+                std::fprintf(stderr, "headless: error writing %s\n",
+                             path.str().c_str());
+            }
+        }
+    }
+
+    double totalTime = clock.getSeconds();
+
+    cinder_app->shutdown();
+    print_headless_stats(frameTimes, startupTime, totalTime,
+                         context.isSoftware());
+
+    context.destroy();
+    delete cinder_app;
+    cinder_app = 0;
+    cinder::app::AppBasic::cleanupLaunch();
+    return 1;
+}
+
 void cinder_quit()
 {
+    if (cinder_app->m_headless)
+    {
+        cinder_app->m_quitRequested = true;
+        return;
+    }
     cinder_app->quit();
 }
 
 void cinder_set_full_screen(int fullscreen)
 {
+    if (cinder_app->m_headless)
+    {
+        return;
+    }
     cinder_fullscreen = fullscreen;
     cinder_app->setFullScreen(fullscreen);
 }
 
 float cinder_get_average_fps()
 {
+    if (cinder_app->m_headless)
+    {
+        return cinder_app->m_headlessFps;
+    }
     return cinder_app->getAverageFps();
 }
 
+float cinder_get_interpolation()
+{
+    return cinder_app->m_frameClock.interpolation();
+}
+
+void cinder_get_frame_pacing_stats(float* meanMs, float* stdDevMs,
+                                   float* maxMs, int* droppedTicks)
+{
+    double mean, stdDev, maxInterval;
+    cinder_app->m_frameClock.intervalStats(&mean, &stdDev, &maxInterval);
+    *meanMs = static_cast<float>(mean * 1000.0);
+    *stdDevMs = static_cast<float>(stdDev * 1000.0);
+    *maxMs = static_cast<float>(maxInterval * 1000.0);
+    *droppedTicks = cinder_app->m_frameClock.droppedTicks();
+}
+
 void cinder_set_cursor_visible(int visible)
 {
+    if (cinder_app->m_headless)
+    {
+        return;
+    }
+
     if (visible)
     {
         cinder_app->showCursor();
@@ -129,6 +541,83 @@ void cinder_set_cursor_visible(int visible)
     }
 }
 
+void cinder_profile_set_enabled(int enabled)
+{
+    cinder_app->m_profiler.setEnabled(enabled != 0);
+}
+
+int cinder_profile_is_enabled()
+{
+    return cinder_app->m_profiler.enabled();
+}
+
+void cinder_profile_begin_scope(const char* name)
+{
+    Profiler& profiler = cinder_app->m_profiler;
+    profiler.beginScope(profiler.scopeId(name));
+}
+
+void cinder_profile_end_scope()
+{
+    cinder_app->m_profiler.endScope();
+}
+
+int cinder_profile_num_frames()
+{
+    return cinder_app->m_profiler.numFrames();
+}
+
+int cinder_profile_get_frame(int age, float* times, int* counters)
+{
+    const Profiler& profiler = cinder_app->m_profiler;
+
+    if (age < 0 || age >= profiler.numFrames())
+    {
+        return -1;
+    }
+
+    const Profiler::Frame& f = profiler.frame(age);
+    times[0] = static_cast<float>((f.end - f.start) * 1000.0);
+    times[1] = static_cast<float>(f.cpuTime * 1000.0);
+    times[2] = f.gpuTime < 0.0 ? -1.0f
+                               : static_cast<float>(f.gpuTime * 1000.0);
+    for (int i = 0; i < Profiler::kNumCounters; ++i)
+    {
+        counters[i] = f.counters[i];
+    }
+
+    return f.number;
+}
+
+int cinder_profile_num_scopes(int age)
+{
+    const Profiler& profiler = cinder_app->m_profiler;
+
+    if (age < 0 || age >= profiler.numFrames())
+    {
+        return 0;
+    }
+    return static_cast<int>(profiler.frame(age).scopes.size());
+}
+
+void cinder_profile_get_scope(int age, int index, const char** name,
+                              float* start, float* duration, int* depth)
+{
+    const Profiler& profiler = cinder_app->m_profiler;
+    const Profiler::Frame& f = profiler.frame(age);
+    const Profiler::Scope& s = f.scopes[index];
+
+    *name = profiler.scopeName(s.id).c_str();
+    *start = static_cast<float>((s.start - f.start) * 1000.0);
+    *duration = static_cast<float>((s.end - s.start) * 1000.0);
+    *depth = s.depth;
+}
+
+int cinder_profile_write_trace(const char* path)
+{
+    return cinder_app->m_profiler.writeTrace(path);
+}
+
 
 float cinder_audio_get_master_volume()
 {
@@ -224,9 +713,18 @@ float cinder_audio_get_music_volume(void* musicPtr)
 
 // Surface (aka Bitmap) stuff
 
+// Workers for resampling and blitting surfaces. Surfaces can be used before
+// the app starts and after it stops, and then the work is all done on the
+// calling thread.
+static WorkerPool& surface_workers()
+{
+    static WorkerPool none(0);
+    return cinder_app ? cinder_app->m_workers : none;
+}
+
 void* cinder_surface_create(int width, int height)
 {
-    cairo::SurfaceImage* surf = new cairo::SurfaceImage(width, height, true);
+    TrackedSurface* surf = new TrackedSurface(width, height, true);
     // TODO: error checking?
 
     return surf;
@@ -234,13 +732,73 @@ void* cinder_surface_create(int width, int height)
 
 void cinder_surface_free(void* surfacePtr)
 {
-    delete static_cast<cairo::SurfaceImage*>(surfacePtr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfacePtr);
+    if (cinder_app)
+    {
+        cinder_app->m_residency.sourceFreed(surf);
+    }
+    delete surf;
+}
+
+void cinder_surface_get_size(void* surfacePtr, int* width, int* height)
+{
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfacePtr);
+    *width = surf->getWidth();
+    *height = surf->getHeight();
+}
+
+// Decode an image into a new surface, in cairo's layout and premultiplied.
+static TrackedSurface* decode_image(DataSourceRef source)
+{
+    Surface decoded = loadImage(source);
+
+    // Decoded straight into the cairo surface's layout, rather than through
+    // cairo::SurfaceImage's conversion.
+    TrackedSurface* surf = new TrackedSurface(decoded.getWidth(),
+                                              decoded.getHeight(),
+                                              decoded.hasAlpha());
+    Surface& pixels = surf->getSurface();
+    pixels.copyFrom(decoded, decoded.getBounds());
+    if (decoded.hasAlpha() && !decoded.isPremultiplied())
+    {
+        premultiply_surface(pixels);
+    }
+    surf->allPixelsChanged();
+    return surf;
+}
+
+// Load an image resource into a new surface, from the texture cache if it
+// has been cooked, and otherwise by decoding it (and then cooking it).
+static TrackedSurface* load_tracked_surface(const std::string& resourceName)
+{
+    DataSourceRef source = loadResource(resourceName);
+    if (!texture_cache)
+    {
+        return decode_image(source);
+    }
+
+    std::string path = source->getFilePath().string();
+    if (CookedImageRef cooked =
+            texture_cache->find(path, TextureCache::kNoMips))
+    {
+        const Surface& pixels = cooked->level(0);
+        TrackedSurface* surf = new TrackedSurface(pixels.getWidth(),
+                                                  pixels.getHeight(),
+                                                  pixels.hasAlpha());
+        surf->getSurface().copyFrom(pixels, pixels.getBounds());
+        surf->allPixelsChanged();
+        return surf;
+    }
+
+    TrackedSurface* surf = decode_image(source);
+    texture_cache->store(path, TextureCache::kNoMips, surf->getSurface(),
+                         std::vector<Surface>());
+    return surf;
 }
 
 void* cinder_load_surface(char* resourceName, int* width, int* height)
 {
-    cairo::SurfaceImage* surf =
-        new cairo::SurfaceImage(loadImage(loadResource(resourceName)));
+    TrackedSurface* surf = load_tracked_surface(resourceName);
     // TODO: error checking?
 
     *width = surf->getWidth();
@@ -251,269 +809,1534 @@ void* cinder_load_surface(char* resourceName, int* width, int* height)
 void cinder_surface_copy_pixels(void* srcPtr, int srcX, int srcY, int w, int h,
                                 void* destPtr, int destX, int destY)
 {
-    cairo::SurfaceImage* src = static_cast<cairo::SurfaceImage*>(srcPtr);
-    cairo::SurfaceImage* dest = static_cast<cairo::SurfaceImage*>(destPtr);
+    TrackedSurface* src = static_cast<TrackedSurface*>(srcPtr);
+    TrackedSurface* dest = static_cast<TrackedSurface*>(destPtr);
 
     Area area(srcX, srcY, srcX + w, srcY + h);
     Vec2i offset(destX - srcX, destY - srcY);
 
     dest->getSurface().copyFrom(src->getSurface(), area, offset);
-    dest->markDirty();
+    dest->pixelsChanged(area + offset);
+}
+
+int cinder_surface_blit(void* destPtr, int numBlits, void** srcPtrs,
+                        int* rects, int blend, float alpha,
+                        int clipX, int clipY, int clipW, int clipH)
+{
+    TrackedSurface* dest = static_cast<TrackedSurface*>(destPtr);
+
+    std::vector<Blit> blits(std::max(numBlits, 0));
+    for (int i = 0; i < numBlits; ++i)
+    {
+        TrackedSurface* src = static_cast<TrackedSurface*>(srcPtrs[i]);
+        // Make sure anything cairo has drawn is in memory.
+        src->flush();
+
+        const int* r = rects + i * 6;
+        blits[i].src = &src->getSurface();
+        blits[i].srcArea = Area(r[0], r[1], r[0] + r[2], r[1] + r[3]);
+        blits[i].destPt = Vec2i(r[4], r[5]);
+    }
+    dest->flush();
+
+    std::vector<Area> changed;
+    if (!blit_surfaces(blits, dest->getSurface(),
+                       Area(clipX, clipY, clipX + clipW, clipY + clipH),
+                       static_cast<BlitBlend>(blend), alpha,
+                       &surface_workers(), &changed))
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < changed.size(); ++i)
+    {
+        dest->pixelsChanged(changed[i]);
+    }
+    return 1;
 }
 
 void cinder_surface_fill(void* ptr, float r, float g, float b, float a,
                          int x, int y, int w, int h)
 {
-  cairo::SurfaceImage* si = static_cast<cairo::SurfaceImage*>(ptr);
-  ColorA color(r, g, b, a);
+  TrackedSurface* si = static_cast<TrackedSurface*>(ptr);
+  ColorA8u color(ColorA(r, g, b, a));
   Area area(x, y, x + w, y + h);
 
-  cinder::ip::fill(&si->getSurface(), color, area);
+  fill_surface(si->getSurface(), color, area);
+  si->pixelsChanged(area);
 }
 
 void cinder_surface_premultiply(void* ptr)
 {
-  cairo::SurfaceImage* si = static_cast<cairo::SurfaceImage*>(ptr);
-  cinder::ip::premultiply(&si->getSurface());
+  TrackedSurface* si = static_cast<TrackedSurface*>(ptr);
+  premultiply_surface(si->getSurface());
+  si->allPixelsChanged();
 }
 
 void cinder_surface_unpremultiply(void* ptr)
 {
-  cairo::SurfaceImage* si = static_cast<cairo::SurfaceImage*>(ptr);
-  cinder::ip::unpremultiply(&si->getSurface());
+  TrackedSurface* si = static_cast<TrackedSurface*>(ptr);
+  unpremultiply_surface(si->getSurface());
+  si->allPixelsChanged();
 }
 
 void cinder_surface_flip_vertical(void* ptr)
 {
-  cairo::SurfaceImage* si = static_cast<cairo::SurfaceImage*>(ptr);
-  cinder::ip::flipVertical(&si->getSurface());
+  TrackedSurface* si = static_cast<TrackedSurface*>(ptr);
+  flip_surface_vertical(si->getSurface());
+  si->allPixelsChanged();
 }
 
-void* cinder_surface_resize(void* ptr, int width, int height, int filter)
+int cinder_surface_is_damaged(void* ptr)
 {
-    cairo::SurfaceImage* si = static_cast<cairo::SurfaceImage*>(ptr);
+    return static_cast<TrackedSurface*>(ptr)->damage().empty() ? 0 : 1;
+}
 
-    Area area(0, 0, si->getWidth(), si->getHeight());
-    Vec2i size(width, height);
+void cinder_surface_get_damage_bounds(void* ptr,
+                                      int* x, int* y, int* w, int* h)
+{
+    Area bounds = static_cast<TrackedSurface*>(ptr)->damage().bounds();
+    *x = bounds.getX1();
+    *y = bounds.getY1();
+    *w = bounds.getWidth();
+    *h = bounds.getHeight();
+}
 
-    Surface surf;
+void cinder_surface_clear_damage(void* ptr)
+{
+    static_cast<TrackedSurface*>(ptr)->damage().clear();
+}
 
-    switch(filter)
+// Format codes for cinder_surface_lock.
+static int pixel_format(const Surface& surface)
+{
+    const SurfaceChannelOrder& order = surface.getChannelOrder();
+    if (surface.getPixelInc() != 4 ||
+        (surface.hasAlpha() && order.getAlphaOffset() != 3))
     {
-    case 0:
-      surf = cinder::ip::resizeCopy(si->getSurface(), area, size, FilterBox());
-      break;
-    case 1:
-      surf = cinder::ip::resizeCopy(si->getSurface(), area, size, FilterTriangle());
-      break;
-    case 2:
-      surf = cinder::ip::resizeCopy(si->getSurface(), area, size, FilterGaussian());
-      break;
-    default:
-      // TODO: error message about bad filter type
-      return 0;
+        return -1;
     }
 
-    cairo::SurfaceImage* result = new cairo::SurfaceImage(surf);
-
-    return result;
+    int base;
+    if (order.getBlueOffset() == 0 && order.getGreenOffset() == 1 &&
+        order.getRedOffset() == 2)
+    {
+        base = 0;
+    }
+    else if (order.getRedOffset() == 0 && order.getGreenOffset() == 1 &&
+             order.getBlueOffset() == 2)
+    {
+        base = 1;
+    }
+    else
+    {
+        return -1;
+    }
+    return surface.hasAlpha() ? base : base + 2;
 }
 
-// OpenGL stuff
-
-void cinder_gl_set_viewport(int x, int y, int width, int height)
+void* cinder_surface_lock(void* ptr, int* stride, int* format,
+                          BOOL* premultiplied)
 {
-    Area viewport(x, y, width, height);
-    gl::setViewport(viewport);
+    Surface& surface = static_cast<TrackedSurface*>(ptr)->lock();
+    *stride = surface.getRowBytes();
+    *format = pixel_format(surface);
+    // cairo's surfaces with alpha are always premultiplied.
+    *premultiplied = surface.hasAlpha() ? 1 : 0;
+    return surface.getData();
 }
 
-void cinder_gl_set_matrices_window(int width, int height)
+void cinder_surface_unlock(void* ptr, int x, int y, int w, int h)
 {
-    gl::setMatricesWindow(width, height);
+    static_cast<TrackedSurface*>(ptr)->unlock(Area(x, y, x + w, y + h));
 }
 
-void cinder_gl_set_color(float r, float g, float b, float a)
+BOOL cinder_surface_read_pixels(void* ptr, int x, int y, int w, int h,
+                                float* rgba)
 {
-    glColor4f(r, g, b, a);
+    TrackedSurface* si = static_cast<TrackedSurface*>(ptr);
+    if (w < 0 || h < 0)
+    {
+        return 0;
+    }
+
+    Surface& surface = si->lock();
+    bool ok = read_surface_colors(surface, Area(x, y, x + w, y + h),
+                                  surface.hasAlpha(), rgba);
+    si->unlock(Area(0, 0, 0, 0));
+    return ok ? 1 : 0;
 }
 
-void cinder_gl_set_blend(int mode)
+BOOL cinder_surface_write_pixels(void* ptr, int x, int y, int w, int h,
+                                 float* rgba)
 {
-    switch (mode)
+    TrackedSurface* si = static_cast<TrackedSurface*>(ptr);
+    if (w < 0 || h < 0)
     {
-        case 0:
-            gl::enableAlphaBlending();
-            break;
-        case 1:
-            gl::enableAdditiveBlending();
-            break;
+        return 0;
     }
+
+    Area area(x, y, x + w, y + h);
+    Surface& surface = si->lock();
+    bool ok = write_surface_colors(surface, area, surface.hasAlpha(), rgba);
+    si->unlock(ok ? area : Area(0, 0, 0, 0));
+    return ok ? 1 : 0;
 }
 
-void* cinder_gl_create_texture(int width, int height)
+void* cinder_surface_resize(void* ptr, int width, int height, int filter)
 {
-    try
+    TrackedSurface* si = static_cast<TrackedSurface*>(ptr);
+
+    if (width <= 0 || height <= 0 ||
+        filter < 0 || filter >= kNumResampleFilters)
     {
-        gl::Texture* tex = new gl::Texture(width, height);
-        return tex;
+        // TODO: error message about bad size or filter type
+        return 0;
     }
-    catch (const gl::TextureDataExc& ex)
+
+    // Make sure anything cairo has drawn is in memory.
+    si->flush();
+
+    TrackedSurface* result = new TrackedSurface(width, height,
+                                                si->getSurface().hasAlpha());
+    result->getSurface().setPremultiplied(si->getSurface().isPremultiplied());
+
+    if (!resample(si->getSurface(), si->getSurface().getBounds(),
+                  result->getSurface(), result->getSurface().getBounds(),
+                  static_cast<ResampleFilter>(filter),
+                  surface_workers()))
     {
-        // TODO: return more info?
+        delete result;
         return 0;
     }
+
+    return result;
 }
 
-void cinder_gl_free_texture(void* texPtr)
+// OpenGL stuff
+
+// While there is a render thread, GL calls (other than its own, as it
+// replays them) are either recorded to be made there later, in order, or
+// if they need an answer right away, forwarded to it and waited for.
+
+// True if GL calls have to be recorded for (or forwarded to) the render
+// thread.
+static bool use_render_thread()
 {
-    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
-    delete tex;
+    RenderThread& thread = cinder_app->m_renderThread;
+    return thread.running() && !thread.onRenderThread();
 }
 
-void cinder_gl_update_texture(void* texPtr, void* surfPtr,
-                              int x1, int y1, int x2, int y2)
+// If GL calls are to be recorded, writes cmd and returns the buffer to
+// write its arguments to. Returns null if GL calls are made directly.
+static CommandBuffer* record(RenderCommand cmd)
 {
-    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
-    cairo::SurfaceImage* surf = static_cast<cairo::SurfaceImage*>(surfPtr);
-    Area area(x1, y1, x2, y2);
+    if (!use_render_thread())
+    {
+        return 0;
+    }
 
-    tex->update(surf->getSurface(), area);
+    CommandBuffer& cmds = cinder_app->m_renderThread.commands();
+    cmds.writeOp(cmd);
+    return &cmds;
 }
 
-void* cinder_gl_create_texture_from_surface(void* surfPtr, int x, int y, int w, int h)
+static void write_floats(CommandBuffer& cmds, const float* values, int count)
 {
-    cairo::SurfaceImage* surf = static_cast<cairo::SurfaceImage*>(surfPtr);
+    cmds.writeData(values, std::max(count, 0) * sizeof(float));
+}
 
-    try
-    {
-        if (w != surf->getSurface().getWidth() || h != surf->getSurface().getHeight())
-        {
-            // TODO: Not particularly efficient, but cinder doesn't provide a
-            //       Texture constructor taking a Surface and an Area, so we have
-            //       to construct first, and then update the texture data.
-            gl::Texture* tex = new gl::Texture(w, h);
-            cinder_gl_update_texture(tex, surf, x, y, x + w, y + h);
-            return tex;
-        }
+static float* read_floats(CommandBuffer& cmds)
+{
+    size_t size;
+    return static_cast<float*>(const_cast<void*>(cmds.readData(&size)));
+}
+
+// Record a copy of area of surface (which must lie within it), and the GL
+// format to upload it with.
+static void write_pixels(CommandBuffer& cmds, Surface& surface,
+                         const Area& area)
+{
+    GLint dataFormat;
+    GLenum type;
+    gl::Texture::SurfaceChannelOrderToDataFormatAndType(
+        surface.getChannelOrder(), &dataFormat, &type);
+
+    cmds.write(area.getX1());
+    cmds.write(area.getY1());
+    cmds.write(area.getX2());
+    cmds.write(area.getY2());
+    cmds.write(dataFormat);
+    cmds.write(type);
+
+    const size_t rowBytes = area.getWidth() * surface.getPixelInc();
+    uint8_t* dest = static_cast<uint8_t*>(
+        cmds.reserveData(rowBytes * area.getHeight()));
+
+    for (int y = area.getY1(); y < area.getY2(); ++y)
+    {
+        std::memcpy(dest, surface.getData(Vec2i(area.getX1(), y)), rowBytes);
+        dest += rowBytes;
+    }
+}
+
+// Read back what write_pixels wrote.
+static const void* read_pixels(CommandBuffer& cmds, Area* area,
+                               GLint* dataFormat, GLenum* type)
+{
+    int x1 = cmds.read<int>();
+    int y1 = cmds.read<int>();
+    int x2 = cmds.read<int>();
+    int y2 = cmds.read<int>();
+    *area = Area(x1, y1, x2, y2);
+    *dataFormat = cmds.read<GLint>();
+    *type = cmds.read<GLenum>();
+
+    size_t size;
+    return cmds.readData(&size);
+}
+
+void cinder_gl_set_viewport(int x, int y, int width, int height)
+{
+    if (CommandBuffer* cmds = record(kCmdSetViewport))
+    {
+        cmds->write(x);
+        cmds->write(y);
+        cmds->write(width);
+        cmds->write(height);
+        return;
+    }
+
+    cinder_app->m_quadBatch.flush();
+    Area viewport(x, y, width, height);
+    gl::setViewport(viewport);
+}
+
+void cinder_gl_set_matrices_window(int width, int height)
+{
+    if (CommandBuffer* cmds = record(kCmdSetMatricesWindow))
+    {
+        cmds->write(width);
+        cmds->write(height);
+        return;
+    }
+
+    if (width == cinder_app->m_projectionWidth &&
+        height == cinder_app->m_projectionHeight)
+    {
+        return;
+    }
+
+    cinder_app->m_quadBatch.flush();
+
+    // Also loads an identity modelview matrix, which is all we ever use
+    // (batched vertices are transformed on the CPU).
+    gl::setMatricesWindow(width, height);
+    cinder_app->m_projectionWidth = width;
+    cinder_app->m_projectionHeight = height;
+}
+
+void cinder_gl_set_color(float r, float g, float b, float a)
+{
+    if (CommandBuffer* cmds = record(kCmdSetColor))
+    {
+        cmds->write(r);
+        cmds->write(g);
+        cmds->write(b);
+        cmds->write(a);
+        return;
+    }
+
+    cinder_app->m_quadBatch.setColor(r, g, b, a);
+}
+
+void cinder_gl_set_blend(int mode)
+{
+    if (CommandBuffer* cmds = record(kCmdSetBlend))
+    {
+        cmds->write(mode);
+        return;
+    }
+
+    // 0 => alpha blending, 1 => additive blending
+    cinder_app->m_quadBatch.setBlend(mode);
+}
+
+void cinder_gl_flush()
+{
+    if (record(kCmdFlush))
+    {
+        return;
+    }
+
+    cinder_app->m_quadBatch.flush();
+}
+
+void cinder_gl_get_frame_stats(int* drawCalls, int* quads)
+{
+    // With a render thread, this is the last frame it has finished.
+    *drawCalls = cinder_app->m_lastRenderStats.drawCalls;
+    *quads = cinder_app->m_lastRenderStats.quads;
+}
+
+void cinder_gl_get_state_stats(int kind, int* changes, int* filtered)
+{
+    if (kind < 0 || kind >= GlStateCache::kNumKinds)
+    {
+        *changes = 0;
+        *filtered = 0;
+        return;
+    }
+
+    *changes = cinder_app->m_lastRenderStats.changes[kind];
+    *filtered = cinder_app->m_lastRenderStats.filtered[kind];
+}
+
+// Record an upload of area's pixels (at 4 bytes each) to a texture. Uploads
+// can be made on the render thread, so these are counted through the
+// profiler's locked path.
+static void count_upload(const Area& area)
+{
+    int pixels = std::max(0, area.getWidth()) * std::max(0, area.getHeight());
+    cinder_app->m_profiler.addCounterFromAnyThread(
+        Profiler::kCounterBytesUploaded, pixels * 4);
+}
+
+// Record an upload of numVertices mesh vertices.
+static void count_mesh_upload(int numVertices)
+{
+    cinder_app->m_profiler.addCounterFromAnyThread(
+        Profiler::kCounterBytesUploaded, numVertices * sizeof(BatchVertex));
+}
+
+// Bytes of GPU memory for a texture, with its mip chain if mipmapped.
+static int64_t texture_bytes(int width, int height, bool mipmapped)
+{
+    int64_t bytes = static_cast<int64_t>(width) * height * 4;
+    while (mipmapped && (width > 1 || height > 1))
+    {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        bytes += static_cast<int64_t>(width) * height * 4;
+    }
+    return bytes;
+}
+
+void* cinder_gl_create_texture(int width, int height)
+{
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_create_texture, width, height));
+    }
+
+    // Creating a texture changes the texture binding.
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+
+    try
+    {
+        gl::Texture* tex = new gl::Texture(width, height);
+        // Nothing to rebuild it from, so it's never evicted.
+        cinder_app->m_residency.add(tex, texture_bytes(width, height, false),
+                                    ResidencyManager::Rebuild(), 0, Area());
+        return tex;
+    }
+    catch (const gl::TextureDataExc& ex)
+    {
+        // TODO: return more info?
+        return 0;
+    }
+}
+
+void cinder_gl_free_texture(void* texPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdFreeTexture))
+    {
+        cmds->write(texPtr);
+        return;
+    }
+
+    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
+
+    // Pending quads might still refer to this texture.
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+    cinder_app->m_residency.remove(tex);
+    delete tex;
+}
+
+void cinder_gl_update_texture(void* texPtr, void* surfPtr,
+                              int x1, int y1, int x2, int y2)
+{
+    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+    Area area(x1, y1, x2, y2);
+
+    if (use_render_thread())
+    {
+        Area clipped = area.getClipBy(surf->getSurface().getBounds());
+        if (clipped.getWidth() > 0 && clipped.getHeight() > 0)
+        {
+            CommandBuffer* cmds = record(kCmdUploadTexture);
+            cmds->write(tex);
+            write_pixels(*cmds, surf->getSurface(), clipped);
+            count_upload(clipped);
+        }
+        return;
+    }
+
+    // Pending quads must be drawn with the old contents.
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+
+    if (!cinder_app->m_residency.use(tex))
+    {
+        // Evicted and couldn't be rebuilt; there's nothing to update.
+        return;
+    }
+    tex->update(surf->getSurface(), area);
+    count_upload(area.getClipBy(surf->getSurface().getBounds()));
+
+    bool whole = tex->getWidth() == surf->getWidth() &&
+                 tex->getHeight() == surf->getHeight() &&
+                 area.getClipBy(surf->getSurface().getBounds()) ==
+                     surf->getSurface().getBounds();
+    cinder_app->m_residency.contentsChanged(tex, surf, whole);
+}
+
+int cinder_gl_upload_surface_damage(void* texPtr, void* surfPtr)
+{
+    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+
+    if (surf->damage().empty())
+    {
+        return 0;
+    }
+
+    if (use_render_thread())
+    {
+        // The render thread might be evicting tex right now.
+        int width, height;
+        if (!cinder_app->m_residency.getSize(tex, &width, &height))
+        {
+            width = tex->getWidth();
+            height = tex->getHeight();
+        }
+        if (width != surf->getWidth() || height != surf->getHeight())
+        {
+            return -1;
+        }
+
+        // As uploadDamage, but recording each rect's pixels.
+        surf->flush();
+        int pixels = 0;
+        const std::vector<Area>& rects = surf->damage().rects();
+        for (size_t i = 0; i < rects.size(); ++i)
+        {
+            CommandBuffer* cmds = record(kCmdUploadTexture);
+            cmds->write(tex);
+            write_pixels(*cmds, surf->getSurface(), rects[i]);
+            count_upload(rects[i]);
+            pixels += rects[i].getWidth() * rects[i].getHeight();
+        }
+        surf->damage().clear();
+        return pixels;
+    }
+
+    // Pending quads must be drawn with the old contents.
+    cinder_app->m_quadBatch.flush();
+
+    if (!cinder_app->m_residency.use(tex))
+    {
+        // Evicted and couldn't be rebuilt; keep the damage.
+        return -1;
+    }
+    int pixels = surf->uploadDamage(cinder_app->m_glState, *tex);
+    if (pixels > 0)
+    {
+        cinder_app->m_profiler.addCounterFromAnyThread(
+            Profiler::kCounterBytesUploaded, pixels * 4);
+    }
+    if (pixels >= 0)
+    {
+        // Has all of the surface's changes.
+        cinder_app->m_residency.contentsChanged(tex, surf, true);
+    }
+    return pixels;
+}
+
+// Make tex a copy of area of pixels (as cinder_gl_create_texture_from_surface
+// does).
+static bool copy_pixels_to_texture(const Surface& pixels, const Area& area,
+                                   gl::Texture& tex)
+{
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+
+    try
+    {
+        if (area.getWidth() != pixels.getWidth() ||
+            area.getHeight() != pixels.getHeight())
+        {
+            // TODO: Not particularly efficient, but cinder doesn't provide a
+            //       Texture constructor taking a Surface and an Area, so we have
+            //       to construct first, and then update the texture data.
+            tex = gl::Texture(area.getWidth(), area.getHeight());
+            tex.update(pixels, area);
+            count_upload(area.getClipBy(pixels.getBounds()));
+        }
         else
         {
-            gl::Texture* tex = new gl::Texture(surf->getSurface());
-            return tex;
+            tex = gl::Texture(pixels);
+            count_upload(pixels.getBounds());
         }
+        return true;
     }
     catch (const gl::TextureDataExc& ex)
+    {
+        return false;
+    }
+}
+
+// Rebuild an evicted copy of a surface, from the copy of its pixels kept
+// when it was evicted.
+static bool rebuild_texture(gl::Texture& tex, const Surface* pixels)
+{
+    if (!copy_pixels_to_texture(*pixels, pixels->getBounds(), tex))
+    {
+        std::fprintf(stderr, "unable to rebuild an evicted %dx%d texture\n",
+                     pixels->getWidth(), pixels->getHeight());
+        return false;
+    }
+    return true;
+}
+
+void* cinder_gl_create_texture_from_surface(void* surfPtr, int x, int y, int w, int h)
+{
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_create_texture_from_surface, surfPtr,
+                        x, y, w, h));
+    }
+
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+
+    const Area area(x, y, x + w, y + h);
+    gl::Texture* tex = new gl::Texture;
+    if (!copy_pixels_to_texture(surf->getSurface(), area, *tex))
     {
         // TODO: return more info?
+        delete tex;
         return 0;
     }
+
+    // Evicting copies the surface's pixels, which the main thread may be
+    // changing while the render thread evicts, so then textures are kept.
+    if (cinder_app->m_renderThread.running())
+    {
+        cinder_app->m_residency.add(tex, texture_bytes(w, h, false),
+                                    ResidencyManager::Rebuild(), 0, Area());
+    }
+    else
+    {
+        cinder_app->m_residency.add(tex, texture_bytes(w, h, false),
+                                    &rebuild_texture, surf, area);
+    }
+    return tex;
 }
 
-void cinder_gl_bind_texture(void* texPtr)
+// Create a texture from base and its mip chain (which must be complete,
+// down to 1x1). Called on the render thread if there is one.
+static void* create_mipmapped_texture(const Surface& base,
+                                      const std::vector<Surface>& levels)
 {
-    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
-    tex->enableAndBind();
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+
+    gl::Texture::Format format;
+    format.setMinFilter(GL_LINEAR_MIPMAP_LINEAR);
+    format.setMagFilter(GL_LINEAR);
+
+    gl::Texture* tex;
+    try
+    {
+        tex = new gl::Texture(base, format);
+    }
+    catch (const gl::TextureDataExc& ex)
+    {
+        return 0;
+    }
+    count_upload(base.getBounds());
+
+    cinder_app->m_glState.bindTexture(tex->getTarget(), tex->getId());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        const Surface& level = levels[i];
+
+        GLint dataFormat;
+        GLenum type;
+        gl::Texture::SurfaceChannelOrderToDataFormatAndType(
+            level.getChannelOrder(), &dataFormat, &type);
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH,
+                      level.getRowBytes() / level.getPixelInc());
+        glTexImage2D(tex->getTarget(), static_cast<GLint>(i + 1),
+                     level.hasAlpha() ? GL_RGBA : GL_RGB,
+                     level.getWidth(), level.getHeight(), 0,
+                     dataFormat, type, level.getData());
+        count_upload(level.getBounds());
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return tex;
 }
 
-void cinder_gl_unbind_texture(void* texPtr)
+// Rebuild an evicted mipmapped copy of a surface (as
+// cinder_gl_create_mipmapped_texture_from_surface made it), from the copy of
+// its pixels kept when it was evicted.
+static bool rebuild_mipmapped_texture(int filter, gl::Texture& tex,
+                                      const Surface* pixels)
 {
-    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
-    tex->unbind();
+    std::vector<Surface> levels;
+    std::auto_ptr<gl::Texture> fresh;
+    if (build_mip_chain(*pixels, static_cast<ResampleFilter>(filter),
+                        cinder_app->m_workers, levels))
+    {
+        fresh.reset(static_cast<gl::Texture*>(
+            create_mipmapped_texture(*pixels, levels)));
+    }
+
+    if (!fresh.get())
+    {
+        std::fprintf(stderr, "unable to rebuild an evicted %dx%d texture\n",
+                     pixels->getWidth(), pixels->getHeight());
+        return false;
+    }
+    tex = *fresh;
+    return true;
 }
 
-void cinder_gl_push_modelview_matrix()
+void* cinder_gl_create_mipmapped_texture_from_surface(void* surfPtr,
+                                                      int filter)
 {
-    gl::pushModelView();
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+
+    if (filter < 0 || filter >= kNumResampleFilters)
+    {
+        return 0;
+    }
+
+    // The levels are made here, rather than on the render thread, so that
+    // the render thread only has to upload them.
+    surf->flush();
+    const Surface& base = surf->getSurface();
+    std::vector<Surface> levels;
+    if (!build_mip_chain(base, static_cast<ResampleFilter>(filter),
+                         cinder_app->m_workers, levels))
+    {
+        return 0;
+    }
+
+    gl::Texture* tex;
+    if (use_render_thread())
+    {
+        tex = static_cast<gl::Texture*>(call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&create_mipmapped_texture, boost::cref(base),
+                        boost::cref(levels))));
+    }
+    else
+    {
+        tex = static_cast<gl::Texture*>(create_mipmapped_texture(base, levels));
+    }
+
+    if (tex)
+    {
+        // As for cinder_gl_create_texture_from_surface.
+        const int64_t bytes =
+            texture_bytes(base.getWidth(), base.getHeight(), true);
+        if (cinder_app->m_renderThread.running())
+        {
+            cinder_app->m_residency.add(tex, bytes,
+                                        ResidencyManager::Rebuild(), 0,
+                                        Area());
+        }
+        else
+        {
+            cinder_app->m_residency.add(
+                tex, bytes,
+                boost::bind(&rebuild_mipmapped_texture, filter, _1, _2),
+                surf, base.getBounds());
+        }
+    }
+    return tex;
 }
 
-void cinder_gl_pop_modelview_matrix()
+// Called on the render thread if there is one.
+static void* create_texture(const Surface& base)
 {
-    gl::popModelView();
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+
+    try
+    {
+        gl::Texture* tex = new gl::Texture(base);
+        count_upload(base.getBounds());
+        return tex;
+    }
+    catch (const gl::TextureDataExc& ex)
+    {
+        return 0;
+    }
 }
 
-void cinder_gl_update_transform(float sx, float shy, float shx, float sy, float tx, float ty)
+// An image file's pixels, ready to upload: either straight from the cooked
+// file's mapping, or decoded (and the mip chain made), then cooked for next
+// time.
+struct LoadedImage
 {
-    static Matrix44f m;
+    CookedImageRef                cooked;
+    std::auto_ptr<TrackedSurface> decoded;
+    Surface                       base;
+    std::vector<Surface>          levels;
+};
 
-    m.set(sx,   shx,  0.0f, tx,
-          shy,  sy,   0.0f, ty,
-          0.0f, 0.0f, 1.0f, 0.0f,
-          0.0f, 0.0f, 0.0f, 1.0f, true);
+// filter is a ResampleFilter for the mip chain, or TextureCache::kNoMips.
+static bool load_image(const std::string& resourceName, int filter,
+                       LoadedImage& image)
+{
+    try
+    {
+        DataSourceRef source = loadResource(resourceName);
+        std::string path = source->getFilePath().string();
 
-    // toss out last value
-    gl::popModelView();
+        if (texture_cache)
+        {
+            image.cooked = texture_cache->find(path, filter);
+        }
 
-    // apply new
-    gl::pushModelView();
-    gl::multModelView(m);
+        if (image.cooked)
+        {
+            image.base = image.cooked->level(0);
+            for (int i = 1; i < image.cooked->numLevels(); ++i)
+            {
+                image.levels.push_back(image.cooked->level(i));
+            }
+        }
+        else
+        {
+            image.decoded.reset(decode_image(source));
+            image.base = image.decoded->getSurface();
+            if (filter != TextureCache::kNoMips &&
+                !build_mip_chain(image.base,
+                                 static_cast<ResampleFilter>(filter),
+                                 cinder_app->m_workers, image.levels))
+            {
+                return false;
+            }
+            if (texture_cache)
+            {
+                texture_cache->store(path, filter, image.base, image.levels);
+            }
+        }
+        return true;
+    }
+    catch (...)
+    {
+        // No such resource, or it couldn't be decoded.
+        return false;
+    }
+}
 
+// Called on the render thread if there is one.
+static void* create_texture_from_image(const LoadedImage& image, int filter)
+{
+    if (filter == TextureCache::kNoMips)
+    {
+        return create_texture(image.base);
+    }
+    return create_mipmapped_texture(image.base, image.levels);
+}
+
+// Load tex from the image file again, on the GL thread. Used to rebuild
+// evicted textures (cheaply, if there's a texture cache).
+static bool reload_texture(const std::string& resourceName, int filter,
+                           gl::Texture& tex)
+{
+    LoadedImage image;
+    std::auto_ptr<gl::Texture> fresh;
+    if (load_image(resourceName, filter, image))
+    {
+        fresh.reset(static_cast<gl::Texture*>(
+            create_texture_from_image(image, filter)));
+    }
+
+    if (!fresh.get())
+    {
+        std::fprintf(stderr, "unable to reload evicted texture %s\n",
+                     resourceName.c_str());
+        return false;
+    }
+    tex = *fresh;
+    return true;
+}
+
+void* cinder_gl_load_texture(char* resourceName, int filter,
+                             int* width, int* height)
+{
+    if (filter < TextureCache::kNoMips || filter >= kNumResampleFilters)
+    {
+        return 0;
+    }
+
+    LoadedImage image;
+    if (!load_image(resourceName, filter, image))
+    {
+        return 0;
+    }
+
+    *width = image.base.getWidth();
+    *height = image.base.getHeight();
+
+    gl::Texture* tex;
+    if (use_render_thread())
+    {
+        tex = static_cast<gl::Texture*>(call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&create_texture_from_image, boost::cref(image),
+                        filter)));
+    }
+    else
+    {
+        tex = static_cast<gl::Texture*>(create_texture_from_image(image, filter));
+    }
+
+    if (tex)
+    {
+        // The file is only read, so (unlike a surface) it's safe to reload
+        // on the render thread.
+        cinder_app->m_residency.add(
+            tex,
+            texture_bytes(*width, *height, filter != TextureCache::kNoMips),
+            boost::bind(&reload_texture, std::string(resourceName), filter,
+                        _1),
+            0, Area());
+    }
+    return tex;
+}
+
+void cinder_set_texture_cache_dir(char* dir)
+{
+    delete texture_cache;
+    texture_cache = 0;
+
+    if (dir && dir[0])
+    {
+        texture_cache = new TextureCache(dir);
+    }
+}
+
+void cinder_get_texture_cache_stats(int* hits, int* misses)
+{
+    *hits = texture_cache ? texture_cache->hits() : 0;
+    *misses = texture_cache ? texture_cache->misses() : 0;
+}
+
+void* cinder_gl_create_streaming_texture(int width, int height,
+                                         int numBuffers)
+{
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_create_streaming_texture, width, height,
+                        numBuffers));
+    }
+
+    cinder_app->m_quadBatch.flush();
+
+    try
+    {
+        return new StreamingTexture(cinder_app->m_glState, width, height,
+                                    numBuffers);
+    }
+    catch (const gl::TextureDataExc& ex)
+    {
+        return 0;
+    }
+}
+
+void cinder_gl_free_streaming_texture(void* streamPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdFreeStreamingTexture))
+    {
+        cmds->write(streamPtr);
+        return;
+    }
+
+    // Pending quads might still refer to the texture.
+    cinder_app->m_quadBatch.flush();
+    delete static_cast<StreamingTexture*>(streamPtr);
+}
+
+void* cinder_gl_streaming_texture_get_texture(void* streamPtr)
+{
+    return &static_cast<StreamingTexture*>(streamPtr)->texture();
+}
+
+// Record an update of stream from area of surface, clipped as
+// StreamingTexture::update would clip it.
+static void record_stream(StreamingTexture* stream, Surface& surface,
+                          const Area& area, const Vec2i& dest)
+{
+    const gl::Texture& tex = stream->texture();
+    Area clipped = area.getClipBy(surface.getBounds());
+    const int w = std::min(clipped.getWidth(), tex.getWidth() - dest.x);
+    const int h = std::min(clipped.getHeight(), tex.getHeight() - dest.y);
+
+    if (w <= 0 || h <= 0 || dest.x < 0 || dest.y < 0 ||
+        surface.getPixelInc() != 4)
+    {
+        return;
+    }
+
+    CommandBuffer* cmds = record(kCmdStreamTexture);
+    cmds->write(stream);
+    cmds->write(dest.x);
+    cmds->write(dest.y);
+    write_pixels(*cmds, surface,
+                 Area(clipped.getUL(), clipped.getUL() + Vec2i(w, h)));
+}
+
+void cinder_gl_stream_surface(void* streamPtr, void* surfPtr,
+                              int x1, int y1, int x2, int y2)
+{
+    StreamingTexture* stream = static_cast<StreamingTexture*>(streamPtr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+    Area area(x1, y1, x2, y2);
+
+    surf->flush();
+
+    if (use_render_thread())
+    {
+        record_stream(stream, surf->getSurface(), area, Vec2i(0, 0));
+    }
+    else
+    {
+        // Pending quads must be drawn with the old contents.
+        cinder_app->m_quadBatch.flush();
+        stream->update(surf->getSurface(), area, Vec2i(0, 0));
+    }
+    count_upload(area.getClipBy(surf->getSurface().getBounds()));
+}
+
+int cinder_gl_stream_surface_damage(void* streamPtr, void* surfPtr)
+{
+    StreamingTexture* stream = static_cast<StreamingTexture*>(streamPtr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+    gl::Texture& tex = stream->texture();
+
+    if (tex.getWidth() != surf->getWidth() ||
+        tex.getHeight() != surf->getHeight())
+    {
+        return -1;
+    }
+
+    if (surf->damage().empty())
+    {
+        return 0;
+    }
+
+    // A single upload of the damage's bounds, since each upload uses up a
+    // buffer of the ring.
+    Area bounds = surf->damage().bounds();
+    surf->flush();
+
+    if (use_render_thread())
+    {
+        record_stream(stream, surf->getSurface(), bounds, bounds.getUL());
+    }
+    else
+    {
+        cinder_app->m_quadBatch.flush();
+        stream->update(surf->getSurface(), bounds, bounds.getUL());
+    }
+    surf->damage().clear();
+    count_upload(bounds);
+
+    return bounds.getWidth() * bounds.getHeight();
+}
+
+void* cinder_gl_create_texture_atlas(int pageSize, int padding)
+{
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_create_texture_atlas, pageSize, padding));
+    }
+
+    return new TextureAtlas(cinder_app->m_glState, pageSize, padding);
+}
+
+void cinder_gl_free_texture_atlas(void* atlasPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdFreeTextureAtlas))
+    {
+        cmds->write(atlasPtr);
+        return;
+    }
+
+    // Pending quads might still refer to the atlas's pages.
+    cinder_app->m_quadBatch.flush();
+    delete static_cast<TextureAtlas*>(atlasPtr);
+}
+
+int cinder_gl_atlas_add(void* atlasPtr, void* surfPtr,
+                        int x, int y, int w, int h)
+{
+    if (use_render_thread())
+    {
+        return call_on_render_thread<int>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_atlas_add, atlasPtr, surfPtr,
+                        x, y, w, h));
+    }
+
+    TextureAtlas* atlas = static_cast<TextureAtlas*>(atlasPtr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+
+    // The new entry might reuse space that pending quads still draw from.
+    cinder_app->m_quadBatch.flush();
+
+    int entry = atlas->add(surf->getSurface(), Area(x, y, x + w, y + h));
+    if (entry >= 0)
+    {
+        count_upload(Area(x, y, x + w, y + h));
+    }
+    return entry;
+}
+
+int cinder_gl_atlas_update(void* atlasPtr, int entry, void* surfPtr,
+                           int x, int y, int w, int h)
+{
+    if (use_render_thread())
+    {
+        return call_on_render_thread<int>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_atlas_update, atlasPtr, entry, surfPtr,
+                        x, y, w, h));
+    }
+
+    TextureAtlas* atlas = static_cast<TextureAtlas*>(atlasPtr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+
+    // Pending quads must be drawn with the old contents.
+    cinder_app->m_quadBatch.flush();
+
+    Area area(x, y, x + w, y + h);
+    bool updated = atlas->update(entry, surf->getSurface(), area);
+    if (updated)
+    {
+        count_upload(area);
+    }
+    return updated;
+}
+
+void cinder_gl_atlas_remove(void* atlasPtr, int entry)
+{
+    static_cast<TextureAtlas*>(atlasPtr)->remove(entry);
+}
+
+void cinder_gl_atlas_defragment(void* atlasPtr)
+{
+    if (use_render_thread())
+    {
+        cinder_app->m_renderThread.call(
+            boost::bind(&cinder_gl_atlas_defragment, atlasPtr));
+        return;
+    }
+
+    cinder_app->m_quadBatch.flush();
+    static_cast<TextureAtlas*>(atlasPtr)->defragment();
+}
+
+void cinder_gl_atlas_get_entry(void* atlasPtr, int entry, void** texPtr,
+                               float* u1, float* v1, float* u2, float* v2)
+{
+    TextureAtlas* atlas = static_cast<TextureAtlas*>(atlasPtr);
+    gl::Texture* page = 0;
+
+    if (!atlas->entryInfo(entry, &page, u1, v1, u2, v2))
+    {
+        *u1 = *v1 = *u2 = *v2 = 0.0f;
+    }
+    *texPtr = page;
+}
+
+void cinder_gl_atlas_get_usage(void* atlasPtr, int* pages, float* usage)
+{
+    TextureAtlas* atlas = static_cast<TextureAtlas*>(atlasPtr);
+    *pages = atlas->numPages();
+    *usage = atlas->usage();
+}
+
+void cinder_gl_bind_texture(void* texPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdBindTexture))
+    {
+        cmds->write(texPtr);
+        return;
+    }
+
+    gl::Texture* tex = static_cast<gl::Texture*>(texPtr);
+    if (!cinder_app->m_residency.use(tex))
+    {
+        // Evicted and couldn't be rebuilt; draw untextured instead.
+        tex = 0;
+    }
+    cinder_app->m_quadBatch.setTexture(tex);
+}
+
+void cinder_gl_unbind_texture(void* texPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdBindTexture))
+    {
+        cmds->write(static_cast<void*>(0));
+        return;
+    }
+
+    cinder_app->m_quadBatch.setTexture(0);
+}
+
+void cinder_gl_update_transform(float sx, float shy, float shx, float sy, float tx, float ty)
+{
+    if (CommandBuffer* cmds = record(kCmdUpdateTransform))
+    {
+        cmds->write(sx);
+        cmds->write(shy);
+        cmds->write(shx);
+        cmds->write(sy);
+        cmds->write(tx);
+        cmds->write(ty);
+        return;
+    }
+
+    // Everything is transformed on the CPU as it's added to the batch, so
+    // there's no GL state to update here.
+    cinder_app->m_quadBatch.setTransform(Affine2(sx, shy, shx, sy, tx, ty));
 }
 
 
 void cinder_gl_clear(float r, float g, float b, float a, int depth)
 {
+    if (CommandBuffer* cmds = record(kCmdClear))
+    {
+        cmds->write(r);
+        cmds->write(g);
+        cmds->write(b);
+        cmds->write(a);
+        cmds->write(depth);
+        return;
+    }
+
+    cinder_app->m_quadBatch.flush();
     gl::clear(ColorA(r, g, b, a), depth);
 }
 
 void cinder_gl_draw_rect(float x1, float y1, float x2, float y2,
                          float u1, float v1, float u2, float v2)
 {
-#if 0
-    gl::drawSolidRect(Rectf(x1, y1, x2, y2));
-#else
-    // NOTE: Copied from gl::drawSolidRect, except that this will actually
-    // flip the texture coordinates if required.
-    glEnableClientState( GL_VERTEX_ARRAY );
-    GLfloat verts[8];
-    glVertexPointer( 2, GL_FLOAT, 0, verts );
-    glEnableClientState( GL_TEXTURE_COORD_ARRAY );
-    GLfloat texCoords[8];
-    glTexCoordPointer( 2, GL_FLOAT, 0, texCoords );
-    verts[0*2+0] = x2; texCoords[0*2+0] = u2;
-    verts[0*2+1] = y1; texCoords[0*2+1] = v1;
-    verts[1*2+0] = x1; texCoords[1*2+0] = u1;
-    verts[1*2+1] = y1; texCoords[1*2+1] = v1;
-    verts[2*2+0] = x2; texCoords[2*2+0] = u2;
-    verts[2*2+1] = y2; texCoords[2*2+1] = v2;
-    verts[3*2+0] = x1; texCoords[3*2+0] = u1;
-    verts[3*2+1] = y2; texCoords[3*2+1] = v2;
-
-    glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
-
-    glDisableClientState( GL_VERTEX_ARRAY );
-    glDisableClientState( GL_TEXTURE_COORD_ARRAY );	
-#endif
+    if (CommandBuffer* cmds = record(kCmdDrawRect))
+    {
+        cmds->write(x1);
+        cmds->write(y1);
+        cmds->write(x2);
+        cmds->write(y2);
+        cmds->write(u1);
+        cmds->write(v1);
+        cmds->write(u2);
+        cmds->write(v2);
+        return;
+    }
+
+    // Note: Texture coordinates are passed through unchanged, so they can be
+    // flipped if required.
+    cinder_app->m_quadBatch.addQuad(x1, y1, x2, y2, u1, v1, u2, v2);
+}
+
+void cinder_gl_draw_text(char* text, float r, float g, float b, float a,
+                         float x, float y, void* fontPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdDrawText))
+    {
+        cmds->writeData(text, std::strlen(text) + 1);
+        cmds->write(r);
+        cmds->write(g);
+        cmds->write(b);
+        cmds->write(a);
+        cmds->write(x);
+        cmds->write(y);
+        cmds->write(fontPtr);
+        return;
+    }
+
+    BatchTextureFontRef texFont = static_cast<FontT*>(fontPtr)->textureFont;
+    QuadBatch& batch = cinder_app->m_quadBatch;
+
+    // Glyphs are white, so coloring them is just a matter of vertex color.
+    GLubyte savedColor[4];
+    std::copy(batch.color(), batch.color() + 4, savedColor);
+
+    batch.setColor(r, g, b, a);
+    texFont->addString(batch, text, Vec2f(x, y));
+    batch.setColor(savedColor);
+}
+
+void cinder_gl_draw_line(float x1, float y1, float x2, float y2, float width)
+{
+    if (CommandBuffer* cmds = record(kCmdDrawLine))
+    {
+        cmds->write(x1);
+        cmds->write(y1);
+        cmds->write(x2);
+        cmds->write(y2);
+        cmds->write(width);
+        return;
+    }
+
+    cinder_app->m_quadBatch.addLine(x1, y1, x2, y2, width);
+}
+
+void cinder_gl_draw_lines(int numLines, float* points,
+                          int numWidths, float* widths,
+                          int numColors, float* colors,
+                          int cap)
+{
+    if (CommandBuffer* cmds = record(kCmdDrawLines))
+    {
+        cmds->write(numLines);
+        write_floats(*cmds, points, numLines * 4);
+        cmds->write(numWidths);
+        write_floats(*cmds, widths, numWidths);
+        cmds->write(numColors);
+        write_floats(*cmds, colors, numColors * 4);
+        cmds->write(cap);
+        return;
+    }
+
+    cinder_app->m_lineBuilder.addLines(numLines, points,
+                                       numWidths, widths,
+                                       numColors, colors,
+                                       static_cast<LineBuilder::Cap>(cap));
+}
+
+void cinder_gl_draw_polyline(int numPoints, float* points,
+                             int numWidths, float* widths,
+                             int numColors, float* colors,
+                             int cap, int join, int closed)
+{
+    if (CommandBuffer* cmds = record(kCmdDrawPolyline))
+    {
+        cmds->write(numPoints);
+        write_floats(*cmds, points, numPoints * 2);
+        cmds->write(numWidths);
+        write_floats(*cmds, widths, numWidths);
+        cmds->write(numColors);
+        write_floats(*cmds, colors, numColors * 4);
+        cmds->write(cap);
+        cmds->write(join);
+        cmds->write(closed);
+        return;
+    }
+
+    cinder_app->m_lineBuilder.addPolyline(numPoints, points,
+                                          numWidths, widths,
+                                          numColors, colors,
+                                          static_cast<LineBuilder::Cap>(cap),
+                                          static_cast<LineBuilder::Join>(join),
+                                          closed != 0);
+}
+
+void cinder_gl_draw_sprites(float x1, float y1, float x2, float y2,
+                            float uOffset, float vOffset,
+                            float uScale, float vScale,
+                            int numSprites, float* sprites)
+{
+    if (CommandBuffer* cmds = record(kCmdDrawSprites))
+    {
+        cmds->write(x1);
+        cmds->write(y1);
+        cmds->write(x2);
+        cmds->write(y2);
+        cmds->write(uOffset);
+        cmds->write(vOffset);
+        cmds->write(uScale);
+        cmds->write(vScale);
+        cmds->write(numSprites);
+        write_floats(*cmds, sprites,
+                     numSprites * SpriteInstancer::kSpriteFloats);
+        return;
+    }
+
+    cinder_app->m_spriteInstancer.draw(x1, y1, x2, y2,
+                                       uOffset, vOffset, uScale, vScale,
+                                       numSprites, sprites);
+}
+
+static void* new_mesh(int numVertices, float* vertices,
+                      int numIndices, int* indices)
+{
+    return new Mesh(numVertices, vertices, numIndices, indices);
 }
 
-void cinder_gl_draw_text(char* text, float r, float g, float b, float a,
-                         float x, float y, void* fontPtr)
-{
-    gl::TextureFontRef texFont = static_cast<FontT*>(fontPtr)->textureFont;
+void* cinder_gl_create_mesh(int numVertices, float* vertices,
+                            int numIndices, int* indices)
+{
+    for (int i = 0; i < numIndices; ++i)
+    {
+        if (indices[i] < 0 || indices[i] >= numVertices)
+        {
+            return 0;
+        }
+    }
+
+    count_mesh_upload(numVertices);
+
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&new_mesh, numVertices, vertices,
+                        numIndices, indices));
+    }
+
+    return new_mesh(numVertices, vertices, numIndices, indices);
+}
+
+void cinder_gl_free_mesh(void* meshPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdFreeMesh))
+    {
+        cmds->write(meshPtr);
+        return;
+    }
+
+    // Unlike textures, pending quads never refer to a mesh.
+    delete static_cast<Mesh*>(meshPtr);
+}
+
+int cinder_gl_update_mesh(void* meshPtr, int firstVertex,
+                          int numVertices, float* vertices)
+{
+    Mesh* mesh = static_cast<Mesh*>(meshPtr);
+
+    // A mesh's size never changes, so this can be checked before recording.
+    if (firstVertex < 0 || numVertices < 0 ||
+        firstVertex + numVertices > mesh->numVertices())
+    {
+        return -1;
+    }
+
+    count_mesh_upload(numVertices);
+
+    if (CommandBuffer* cmds = record(kCmdUpdateMesh))
+    {
+        cmds->write(mesh);
+        cmds->write(firstVertex);
+        cmds->write(numVertices);
+        write_floats(*cmds, vertices, numVertices * Mesh::kVertexFloats);
+        return 0;
+    }
+
+    mesh->updateVertices(firstVertex, numVertices, vertices);
+    return 0;
+}
+
+// Set a uniform, but only if its value is actually changing. Uniforms are set
+// on whatever program is currently bound, so make sure the program is bound
+// (and that no pending quads will see the new value) first.
+static void update_uniform(void* progPtr, int handle,
+                           const float* values, int count)
+{
+    // The program's cache of values belongs to the render thread.
+    if (CommandBuffer* cmds = record(kCmdSetUniform))
+    {
+        cmds->write(progPtr);
+        cmds->write(handle);
+        cmds->write(count);
+        write_floats(*cmds, values, count);
+        return;
+    }
+
+    ShaderProgram* prog = static_cast<ShaderProgram*>(progPtr);
+
+    if (prog->uniformComponents(handle) == 0)
+    {
+        return; // no such uniform
+    }
+
+    bool changed = prog->wouldChange(handle, values, count);
+    cinder_app->m_glState.countUniform(changed);
 
-    // TODO: Color ignored!
-    texFont->drawString(text, Vec2f(x, y));
-    //gl::drawString(text, Vec2f(x, y), ColorA(r, g, b, a), *static_cast<FontT*>(fontPtr)->font);
+    if (changed)
+    {
+        cinder_app->m_quadBatch.flushIfUsing(prog->glHandle());
+        cinder_app->m_quadBatch.bindProgram(prog->glHandle());
+        prog->upload(handle, values, count);
+    }
 }
 
-void cinder_gl_draw_line(float x1, float y1, float x2, float y2, float width)
+void cinder_gl_draw_mesh(void* meshPtr, float uOffset, float vOffset,
+                         float uScale, float vScale)
 {
-    static float lineWidth = -1.0f;
+    if (CommandBuffer* cmds = record(kCmdDrawMesh))
+    {
+        cmds->write(meshPtr);
+        cmds->write(uOffset);
+        cmds->write(vOffset);
+        cmds->write(uScale);
+        cmds->write(vScale);
+        return;
+    }
 
-    if (width != lineWidth)
+    // Custom shaders usually pass gl_MultiTexCoord0 straight through, so
+    // they get the mapping as a uniform too (the one instanced sprites use).
+    if (cinder_app->m_uvTransformHandle >= 0)
     {
-        glLineWidth(width);
+        const float uvTransform[4] = { uOffset, vOffset, uScale, vScale };
+        update_uniform(cinder_app->m_shaderProgram,
+                       cinder_app->m_uvTransformHandle, uvTransform, 4);
     }
 
-    gl::drawLine(Vec2f(x1, y1), Vec2f(x2, y2));
+    static_cast<Mesh*>(meshPtr)->draw(cinder_app->m_quadBatch,
+                                      uOffset, vOffset, uScale, vScale);
 }
 
 void* cinder_gl_load_shader_program(char* vertShader, char* fragShader,
                                     const char** outErrorMsg)
 {
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_load_shader_program, vertShader, fragShader,
+                        outErrorMsg));
+    }
+
     try
     {
         gl::GlslProg* prog = new gl::GlslProg(loadResource(vertShader),
                                               loadResource(fragShader));
-        return prog;
+        return new ShaderProgram(prog);
     }
     catch (gl::GlslProgCompileExc& exc)
     {
@@ -530,10 +2353,18 @@ void* cinder_gl_load_shader_program(char* vertShader, char* fragShader,
 void* cinder_gl_create_shader_program(char* vertShaderSource, char* fragShaderSource,
                                       const char** outErrorMsg)
 {
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_create_shader_program, vertShaderSource,
+                        fragShaderSource, outErrorMsg));
+    }
+
     try
     {
         gl::GlslProg* prog = new gl::GlslProg(vertShaderSource, fragShaderSource);
-        return prog;
+        return new ShaderProgram(prog);
     }
     catch (gl::GlslProgCompileExc& exc)
     {
@@ -544,57 +2375,143 @@ void* cinder_gl_create_shader_program(char* vertShaderSource, char* fragShaderSo
 
 void cinder_gl_free_shader_program(void* progPtr)
 {
-    gl::GlslProg* prog = static_cast<gl::GlslProg*>(progPtr);
+    if (CommandBuffer* cmds = record(kCmdFreeShaderProgram))
+    {
+        cmds->write(progPtr);
+        return;
+    }
+
+    ShaderProgram* prog = static_cast<ShaderProgram*>(progPtr);
+
+    // Pending quads might still use this program.
+    cinder_app->m_quadBatch.flushIfUsing(prog->glHandle());
+    cinder_app->m_quadBatch.invalidateState();
+    if (prog == cinder_app->m_shaderProgram)
+    {
+        cinder_app->m_shaderProgram = 0;
+        cinder_app->m_uvTransformHandle = -1;
+    }
     delete prog;
 }
 
+static int uniform_handle(void* progPtr, const char* name)
+{
+    return static_cast<ShaderProgram*>(progPtr)->uniformHandle(name);
+}
+
 void cinder_gl_set_uniform_1i(void* progPtr, const char* name, int value)
 {
-    gl::GlslProg* prog = static_cast<gl::GlslProg*>(progPtr);
-    prog->uniform(name, value);
+    cinder_gl_set_uniform_handle_1i(progPtr, uniform_handle(progPtr, name),
+                                    value);
 }
 
 void cinder_gl_set_uniform_1f(void* progPtr, const char* name, float value)
 {
-    gl::GlslProg* prog = static_cast<gl::GlslProg*>(progPtr);
-    prog->uniform(name, value);
+    cinder_gl_set_uniform_handle_1f(progPtr, uniform_handle(progPtr, name),
+                                    value);
 }
 
 void cinder_gl_set_uniform_2f(void* progPtr, const char* name, float v1, float v2)
 {
-    gl::GlslProg* prog = static_cast<gl::GlslProg*>(progPtr);
-    prog->uniform(name, Vec2f(v1, v2));
+    cinder_gl_set_uniform_handle_2f(progPtr, uniform_handle(progPtr, name),
+                                    v1, v2);
 }
 
 void cinder_gl_set_uniform_4f(void* progPtr, const char* name,
                               float v1, float v2, float v3, float v4)
 {
-    gl::GlslProg* prog = static_cast<gl::GlslProg*>(progPtr);
-    prog->uniform(name, Vec4f(v1, v2, v3, v4));
+    cinder_gl_set_uniform_handle_4f(progPtr, uniform_handle(progPtr, name),
+                                    v1, v2, v3, v4);
+}
+
+int cinder_gl_get_uniform_handle(void* progPtr, const char* name)
+{
+    return uniform_handle(progPtr, name);
+}
+
+void cinder_gl_set_uniform_handle_1i(void* progPtr, int handle, int value)
+{
+    float v = static_cast<float>(value);
+    update_uniform(progPtr, handle, &v, 1);
+}
+
+void cinder_gl_set_uniform_handle_1f(void* progPtr, int handle, float value)
+{
+    update_uniform(progPtr, handle, &value, 1);
+}
+
+void cinder_gl_set_uniform_handle_2f(void* progPtr, int handle,
+                                     float v1, float v2)
+{
+    float v[2] = { v1, v2 };
+    update_uniform(progPtr, handle, v, 2);
+}
+
+void cinder_gl_set_uniform_handle_4f(void* progPtr, int handle,
+                                     float v1, float v2, float v3, float v4)
+{
+    float v[4] = { v1, v2, v3, v4 };
+    update_uniform(progPtr, handle, v, 4);
+}
+
+void cinder_gl_set_uniforms(void* progPtr, int numUniforms,
+                            const int* handles, const int* counts,
+                            const float* values)
+{
+    for (int i = 0; i < numUniforms; ++i)
+    {
+        update_uniform(progPtr, handles[i], values, counts[i]);
+        values += counts[i];
+    }
 }
 
 void cinder_gl_use_shader_program(void* progPtr)
 {
-    if (progPtr)
+    if (CommandBuffer* cmds = record(kCmdUseShaderProgram))
     {
-        gl::GlslProg* prog = static_cast<gl::GlslProg*>(progPtr);
-        prog->bind();
+        cmds->write(progPtr);
+        return;
     }
-    else
+
+    // Note: A null progPtr means no shader (ie, fixed function).
+    ShaderProgram* prog = static_cast<ShaderProgram*>(progPtr);
+    cinder_app->m_quadBatch.setProgram(prog ? prog->glslProg() : 0);
+    if (prog != cinder_app->m_shaderProgram)
     {
-        gl::GlslProg::unbind();
+        cinder_app->m_shaderProgram = prog;
+        cinder_app->m_uvTransformHandle =
+            prog ? prog->uniformHandle("uvTransform") : -1;
     }
 }
 
+// Bytes of GPU memory for a framebuffer made by cinder_gl_create_framebuffer:
+// an RGBA color buffer and a (32 bit, in practice) depth buffer.
+static int64_t framebuffer_bytes(const gl::Fbo& fbo)
+{
+    return static_cast<int64_t>(fbo.getWidth()) * fbo.getHeight() * 8;
+}
+
 void* cinder_gl_create_framebuffer(int width, int height, void** texturePtr,
                                    const char** outErrorMsg)
 {
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_create_framebuffer, width, height, texturePtr,
+                        outErrorMsg));
+    }
+
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+
     try
     {
         // TODO: support reading depth later, I suppose
         gl::Fbo* fbo = new gl::Fbo(width, height, true, true, false);
         fbo->getTexture().setFlipped(true);
         *texturePtr = &fbo->getTexture();
+        memory_ledger().add(kMemoryRenderTextures, framebuffer_bytes(*fbo));
         return fbo;
     }
     catch (gl::FboExceptionInvalidSpecification& ex)
@@ -611,39 +2528,139 @@ void* cinder_gl_create_framebuffer(int width, int height, void** texturePtr,
 
 void cinder_gl_free_framebuffer(void* ptr)
 {
-    delete static_cast<gl::Fbo*>(ptr);
+    if (CommandBuffer* cmds = record(kCmdFreeFramebuffer))
+    {
+        cmds->write(ptr);
+        return;
+    }
+
+    // Pending quads might still refer to the framebuffer's texture.
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_quadBatch.invalidateState();
+
+    gl::Fbo* fbo = static_cast<gl::Fbo*>(ptr);
+    memory_ledger().add(kMemoryRenderTextures, -framebuffer_bytes(*fbo));
+    delete fbo;
+}
+
+void* cinder_gl_acquire_render_target(int width, int height, int format,
+                                      int depth, void** texturePtr,
+                                      const char** outErrorMsg)
+{
+    if (format < 0 || format >= RenderTargetPool::kNumFormats)
+    {
+        *outErrorMsg = "invalid render target format";
+        return 0;
+    }
+
+    if (use_render_thread())
+    {
+        // Reusing a target is just bookkeeping, but creating one needs GL.
+        gl::Fbo* fbo = cinder_app->m_renderTargets.acquireExisting(
+            width, height, static_cast<RenderTargetPool::Format>(format),
+            depth != 0);
+        if (fbo)
+        {
+            *texturePtr = &fbo->getTexture();
+            return fbo;
+        }
+
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_gl_acquire_render_target, width, height,
+                        format, depth, texturePtr, outErrorMsg));
+    }
+
+    // Creating a target changes the framebuffer binding.
+    cinder_app->m_quadBatch.flush();
+
+    gl::Fbo* fbo = cinder_app->m_renderTargets.acquire(
+        width, height, static_cast<RenderTargetPool::Format>(format),
+        depth != 0, outErrorMsg);
+
+    if (fbo)
+    {
+        *texturePtr = &fbo->getTexture();
+    }
+    return fbo;
+}
+
+void cinder_gl_release_render_target(void* ptr)
+{
+    // Pending quads might draw from the target, and it might be handed out
+    // (and drawn to) again before they are flushed.
+    if (!record(kCmdFlush))
+    {
+        cinder_app->m_quadBatch.flush();
+    }
+    cinder_app->m_renderTargets.release(static_cast<gl::Fbo*>(ptr));
+}
+
+void cinder_gl_purge_render_targets()
+{
+    if (record(kCmdPurgeRenderTargets))
+    {
+        return;
+    }
+
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_renderTargets.purge();
+}
+
+void cinder_gl_get_render_target_stats(int* numTargets, int* kbAllocated,
+                                       int* kbInUse)
+{
+    *numTargets = cinder_app->m_renderTargets.numTargets();
+    *kbAllocated =
+        static_cast<int>(cinder_app->m_renderTargets.bytesAllocated() / 1024);
+    *kbInUse =
+        static_cast<int>(cinder_app->m_renderTargets.bytesInUse() / 1024);
 }
 
 void cinder_gl_bind_framebuffer(void* ptr)
 {
+    if (CommandBuffer* cmds = record(kCmdBindFramebuffer))
+    {
+        cmds->write(ptr);
+        return;
+    }
+
     gl::Fbo* fbo = static_cast<gl::Fbo*>(ptr);
-    fbo->bindFramebuffer();
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_glState.bindFramebuffer(fbo->getId());
 }
 
 void cinder_gl_unbind_framebuffer()
 {
-    gl::Fbo::unbindFramebuffer();
+    if (CommandBuffer* cmds = record(kCmdBindFramebuffer))
+    {
+        cmds->write(static_cast<void*>(0));
+        return;
+    }
+
+    cinder_app->m_quadBatch.flush();
+    cinder_app->m_glState.bindFramebuffer(0);
 }
 
 // vector graphics stuff
 
 void* cinder_vg_make_context(void* surfPtr)
 {
-    cairo::SurfaceImage* surf = static_cast<cairo::SurfaceImage*>(surfPtr);
-    cairo::Context* ctx = new cairo::Context(*surf);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surfPtr);
+    TrackedContext* ctx = new TrackedContext(*surf);
     return ctx;
 }
 
 void cinder_vg_free_context(void* ctxPtr)
 {
-    cairo::Context* ctx = static_cast<cairo::Context*>(ctxPtr);
+    TrackedContext* ctx = static_cast<TrackedContext*>(ctxPtr);
     delete ctx;
 }
 
 void cinder_vg_set_matrix(void* ptr, float xx, float yx, float xy,
                           float yy, float x0, float y0)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
 
     cairo::Matrix m(static_cast<double>(xx), static_cast<double>(yx),
                     static_cast<double>(xy), static_cast<double>(yy),
@@ -654,7 +2671,7 @@ void cinder_vg_set_matrix(void* ptr, float xx, float yx, float xy,
 
 void cinder_vg_set_solid_paint(void* ptr, float r, float g, float b, float a)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
 
     ctx.setSourceRgba(static_cast<double>(r),
                       static_cast<double>(g),
@@ -700,21 +2717,21 @@ void cinder_vg_gradient_add_color_stop(float offset,
 
 void cinder_vg_apply_gradient(void* ptr)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.setSource(*cinder_app->m_activeGradient);
 }
 
 void cinder_vg_set_surface_paint(void* ptr, void* surface)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
-    cairo::SurfaceImage* surf = static_cast<cairo::SurfaceImage*>(surface);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
+    TrackedSurface* surf = static_cast<TrackedSurface*>(surface);
     ctx.setSourceSurface(*surf, 0, 0);
 }
 
 void cinder_vg_set_stroke_parameters(void* ptr, 
                                      int lineCap, int lineJoin, float lineWidth)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
 
     // convert from orlok's enum values to cairo's (in fact, they are
     // currently the same)
@@ -756,45 +2773,45 @@ void cinder_vg_set_stroke_parameters(void* ptr,
 
 void cinder_vg_clear_with_brush(void* ptr)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
-    ctx.paint();
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
+    ctx.paintClip();
 }
 
 void cinder_vg_draw_rect(void* ptr, float left, float top,
                          float width, float height)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.rectangle(left, top, width, height);
 }
 
 void cinder_vg_draw_circle(void* ptr, float centerX, float centerY, float radius)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.circle(centerX, centerY, radius);
 }
 
 void cinder_vg_clear_path(void* ptr)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.newPath();
 }
 
 void cinder_vg_path_move_to(void* ptr, float x, float y)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.newPath();
     ctx.moveTo(static_cast<double>(x), static_cast<double>(y));
 }
 
 void cinder_vg_path_line_to(void* ptr, float x, float y)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.lineTo(static_cast<double>(x), static_cast<double>(y));
 }
 
 void cinder_vg_path_quad_to(void* ptr, float x1, float y1, float x2, float y2)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.quadTo(static_cast<double>(x1), static_cast<double>(y1),
                static_cast<double>(x2), static_cast<double>(y2));
 }
@@ -802,7 +2819,7 @@ void cinder_vg_path_quad_to(void* ptr, float x1, float y1, float x2, float y2)
 void cinder_vg_path_curve_to(void* ptr, float x1, float y1,
                              float x2, float y2, float x3, float y3)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.curveTo(static_cast<double>(x1), static_cast<double>(y1),
                 static_cast<double>(x2), static_cast<double>(y2),
                 static_cast<double>(x3), static_cast<double>(y3));
@@ -810,7 +2827,7 @@ void cinder_vg_path_curve_to(void* ptr, float x1, float y1,
 
 void cinder_vg_path_close(void* ptr)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
     ctx.closePath();
 }
 
@@ -867,134 +2884,748 @@ void cinder_set_path(int numCommands, int* commands, float* coords,
 }
 */
 
-void cinder_vg_stroke_path(void* ptr)
+void cinder_vg_stroke_path(void* ptr)
+{
+    // stroke, and don't clear path
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
+    ctx.strokePath();
+}
+
+void cinder_vg_fill_path(void* ptr)
+{
+    // fill, and don't clear path
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
+    ctx.fillPath();
+}
+
+void cinder_vg_draw_text(void* ptr, void* fontPtr, char* text,
+                         float x, float y, int isFill)
+{
+    TrackedContext& ctx = *static_cast<TrackedContext*>(ptr);
+    Font& font = *static_cast<FontT*>(fontPtr)->font;
+
+    ctx.setFont(font);
+    ctx.newPath();
+
+    if(isFill)
+    {
+        ctx.fillText(text, x, y);
+    }
+    else
+    {
+        // if stroking, just generate the path and we will stroke it later
+        ctx.save();
+        ctx.translate(x, y);
+        ctx.textPath(text);
+        ctx.restore();
+    }
+}
+
+
+// Tiled surface stuff
+
+void* cinder_create_tiled_surface(int width, int height, int tileSize)
+{
+    if (width <= 0 || height <= 0 ||
+        width > TiledSurface::kMaxSize || height > TiledSurface::kMaxSize ||
+        tileSize < TiledSurface::kMinTileSize ||
+        tileSize > TiledSurface::kMaxTileSize)
+    {
+        return 0;
+    }
+
+    return new TiledSurface(width, height, tileSize);
+}
+
+void cinder_tiled_surface_free(void* tiledPtr)
+{
+    TiledSurface* tiled = static_cast<TiledSurface*>(tiledPtr);
+
+    // The textures go through the render thread, if there is one. The
+    // surfaces needn't, since recorded uploads copy their pixels.
+    std::vector<TiledSurface::TileRef> tiles;
+    tiled->allocatedTiles(tiles);
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        if (tiles[i].texture)
+        {
+            cinder_gl_free_texture(tiles[i].texture);
+        }
+    }
+    delete tiled;
+}
+
+int cinder_tiled_surface_num_allocated_tiles(void* tiledPtr)
+{
+    return static_cast<TiledSurface*>(tiledPtr)->numAllocatedTiles();
+}
+
+void* cinder_vg_make_tiled_context(void* tiledPtr)
+{
+    TiledSurface* tiled = static_cast<TiledSurface*>(tiledPtr);
+
+    // The other cinder_vg_* functions take it as a TrackedContext.
+    TrackedContext* ctx = new TiledContext(*tiled);
+    return ctx;
+}
+
+int cinder_gl_draw_tiled_surface(void* tiledPtr,
+                                 float sx, float shy, float shx, float sy,
+                                 float tx, float ty,
+                                 float viewX1, float viewY1,
+                                 float viewX2, float viewY2)
+{
+    TiledSurface* tiled = static_cast<TiledSurface*>(tiledPtr);
+    if (viewX1 >= viewX2 || viewY1 >= viewY2)
+    {
+        return 0;
+    }
+
+    // Map the view back through the transform to find the part of the
+    // surface that can be seen.
+    Affine2 inverse;
+    if (!Affine2(sx, shy, shx, sy, tx, ty).invert(&inverse))
+    {
+        return 0;
+    }
+
+    float xs[4], ys[4];
+    inverse.transform(viewX1, viewY1, &xs[0], &ys[0]);
+    inverse.transform(viewX2, viewY1, &xs[1], &ys[1]);
+    inverse.transform(viewX1, viewY2, &xs[2], &ys[2]);
+    inverse.transform(viewX2, viewY2, &xs[3], &ys[3]);
+
+    // Clamped before converting, since the view may be far off the surface.
+    float width = static_cast<float>(tiled->getWidth());
+    float height = static_cast<float>(tiled->getHeight());
+    float x1 = std::max(0.0f, std::min(width, *std::min_element(xs, xs + 4)));
+    float y1 = std::max(0.0f, std::min(height, *std::min_element(ys, ys + 4)));
+    float x2 = std::max(0.0f, std::min(width, *std::max_element(xs, xs + 4)));
+    float y2 = std::max(0.0f, std::min(height, *std::max_element(ys, ys + 4)));
+    if (x1 >= x2 || y1 >= y2)
+    {
+        return 0;
+    }
+
+    Area tiles;
+    if (!tiled->tileRange(Area(static_cast<int>(std::floor(x1)),
+                               static_cast<int>(std::floor(y1)),
+                               static_cast<int>(std::ceil(x2)),
+                               static_cast<int>(std::ceil(y2))),
+                          &tiles))
+    {
+        return 0;
+    }
+
+    int drawn = 0;
+    for (int ty = tiles.getY1(); ty < tiles.getY2(); ++ty)
+    {
+        for (int tx = tiles.getX1(); tx < tiles.getX2(); ++tx)
+        {
+            // Tiles never drawn on are transparent.
+            TrackedSurface* surf = tiled->tile(tx, ty);
+            if (!surf)
+            {
+                continue;
+            }
+
+            gl::Texture*& tex = tiled->tileTexture(tx, ty);
+            if (!tex)
+            {
+                surf->flush();
+                tex = static_cast<gl::Texture*>(
+                    cinder_gl_create_texture_from_surface(
+                        surf, 0, 0, surf->getWidth(), surf->getHeight()));
+                if (!tex)
+                {
+                    continue;
+                }
+                surf->damage().clear();
+            }
+            else
+            {
+                cinder_gl_upload_surface_damage(tex, surf);
+            }
+
+            Area bounds = tiled->tileBounds(tx, ty);
+            cinder_gl_bind_texture(tex);
+            cinder_gl_draw_rect(bounds.getX1(), bounds.getY1(),
+                                bounds.getX2(), bounds.getY2(),
+                                0.0f, 0.0f, 1.0f, 1.0f);
+            ++drawn;
+        }
+    }
+
+    cinder_gl_unbind_texture(0);
+    return drawn;
+}
+
+
+// Font stuff
+
+void* cinder_load_font(char* resourceName, float size)
+{
+    if (use_render_thread())
+    {
+        return call_on_render_thread<void*>(
+            cinder_app->m_renderThread,
+            boost::bind(&cinder_load_font, resourceName, size));
+    }
+
+    try
+    {
+        FontT* f = new FontT;
+        f->font = new Font(loadResource(resourceName), size);
+        f->textureFont = BatchTextureFont::create(*f->font);
+        return f;
+    }
+    catch(...)
+    {
+        return 0;
+    }
+}
+
+void cinder_free_font(void* fontPtr)
+{
+    if (CommandBuffer* cmds = record(kCmdFreeFont))
+    {
+        cmds->write(fontPtr);
+        return;
+    }
+
+    // Pending glyphs might use the font's textures.
+    cinder_app->m_quadBatch.flush();
+
+    FontT* f = static_cast<FontT*>(fontPtr);
+    delete f->font;
+    delete f;
+}
+
+
+void cinder_get_font_info(void* fontPtr, const char** name, float* size,
+                          float* ascent, float* descent, float* leading)
+{
+    Font& font = *static_cast<FontT*>(fontPtr)->font;
+
+    *name = font.getName().c_str();
+    *size = font.getSize();
+    *ascent = font.getAscent();
+    *descent = font.getDescent();
+    *leading = font.getLeading();
+}
+
+void cinder_get_font_extents(void* fontPtr, char* text,
+                             float* x, float* y, float* w, float* h)
+{
+    FontT* f = static_cast<FontT*>(fontPtr);
+
+    // Extents are cached along with the text's glyph layout (which the
+    // render thread might be using too).
+    boost::lock_guard<boost::mutex> lock(f->textureFont->layoutMutex());
+    TextLayout& layout = f->textureFont->layout(text);
+
+    if (!layout.hasExtents)
+    {
+        cairo::Context& ctx = cinder_app->m_fontContext;
+        ctx.setFont(*f->font);
+
+        cairo::TextExtents extents = ctx.textExtents(text);
+
+        layout.extentsX = extents.xBearing();
+        layout.extentsY = extents.yBearing();
+        layout.extentsW = extents.width();
+        layout.extentsH = extents.height();
+        layout.hasExtents = true;
+    }
+
+    *x = layout.extentsX;
+    *y = layout.extentsY;
+    *w = layout.extentsW;
+    *h = layout.extentsH;
+}
+
+// Background loading. Decoding runs on worker threads; the GL steps run in
+// beginGlFrame (on the render thread if there is one).
+
+static void* decode_surface(const std::string& resourceName,
+                            std::string* error)
+{
+    return load_tracked_surface(resourceName);
+}
+
+static void* decode_font(const std::string& resourceName, float size,
+                         std::string* error)
+{
+    return new Font(loadResource(resourceName), size);
+}
+
+static void* finish_font(void* decoded, std::string* error)
+{
+    FontT* f = new FontT;
+    f->font = static_cast<Font*>(decoded);
+    try
+    {
+        f->textureFont = BatchTextureFont::create(*f->font);
+    }
+    catch (...)
+    {
+        delete f->font;
+        delete f;
+        throw;
+    }
+    return f;
+}
+
+static void free_decoded_font(void* decoded)
+{
+    delete static_cast<Font*>(decoded);
+}
+
+static void* decode_sound(const std::string& resourceName,
+                          std::string* error)
+{
+    audio::SourceRef src = audio::load(loadResource(resourceName));
+    if (!src)
+    {
+        *error = "unsupported audio format";
+        return 0;
+    }
+    return new audio::SourceRef(src);
+}
+
+typedef std::pair<std::string, std::string> ShaderSources;
+
+static std::string load_text(const std::string& resourceName)
 {
-    // stroke, and don't clear path
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
-    ctx.strokePreserve();
+    Buffer& buffer = loadResource(resourceName)->getBuffer();
+    return std::string(static_cast<const char*>(buffer.getData()),
+                       buffer.getDataSize());
 }
 
-void cinder_vg_fill_path(void* ptr)
+static void* decode_shader_sources(const std::string& vertShader,
+                                   const std::string& fragShader,
+                                   std::string* error)
 {
-    // fill, and don't clear path
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
-    ctx.fillPreserve();
+    return new ShaderSources(load_text(vertShader), load_text(fragShader));
 }
 
-void cinder_vg_draw_text(void* ptr, void* fontPtr, char* text,
-                         float x, float y, int isFill)
+static void* finish_shader_program(void* decoded, std::string* error)
 {
-    cairo::Context& ctx = *static_cast<cairo::Context*>(ptr);
-    Font& font = *static_cast<FontT*>(fontPtr)->font;
-
-    ctx.setFont(font);
-    ctx.newPath();
+    std::auto_ptr<ShaderSources> sources(static_cast<ShaderSources*>(decoded));
 
-    ctx.save();
-    ctx.translate(x, y);
-
-    if(isFill)
+    try
     {
-        // use faster showText method
-        ctx.showText(text);
+        return new ShaderProgram(new gl::GlslProg(sources->first.c_str(),
+                                                  sources->second.c_str()));
     }
-    else
+    catch (gl::GlslProgCompileExc& exc)
     {
-        // if stroking, just generate the path and we will stroke it later
-        ctx.textPath(text);
+        *error = exc.what();
+        return 0;
     }
+}
 
-    ctx.restore();
+static void free_shader_sources(void* decoded)
+{
+    delete static_cast<ShaderSources*>(decoded);
 }
 
+static void* new_load_request(const LoadRequestPtr& request)
+{
+    return new LoadRequestPtr(request);
+}
 
-// Font stuff
+void* cinder_load_surface_async(char* resourceName)
+{
+    return new_load_request(cinder_app->m_loader.load(
+        boost::bind(&decode_surface, std::string(resourceName), _1),
+        ResourceLoader::FinishGl(), ResourceLoader::Free(),
+        &cinder_surface_free));
+}
 
-void* cinder_load_font(char* resourceName, float size)
+void* cinder_load_font_async(char* resourceName, float size)
 {
-    try
-    {
-        FontT* f = new FontT;
-        f->font = new Font(loadResource(resourceName), size);
-        f->textureFont = gl::TextureFont::create(*f->font);
-        return f;
-    }
-    catch(...)
-    {
-        return 0;
-    }
+    return new_load_request(cinder_app->m_loader.load(
+        boost::bind(&decode_font, std::string(resourceName), size, _1),
+        &finish_font, &free_decoded_font, &cinder_free_font));
 }
 
-void cinder_free_font(void* fontPtr)
+void* cinder_audio_load_sound_async(const char* resourceName)
 {
-    FontT* f = static_cast<FontT*>(fontPtr);
-    delete f->font;
-    delete f;
+    return new_load_request(cinder_app->m_loader.load(
+        boost::bind(&decode_sound, std::string(resourceName), _1),
+        ResourceLoader::FinishGl(), ResourceLoader::Free(),
+        &cinder_audio_free_sound));
 }
 
+void* cinder_gl_load_shader_program_async(char* vertShader, char* fragShader)
+{
+    return new_load_request(cinder_app->m_loader.load(
+        boost::bind(&decode_shader_sources, std::string(vertShader),
+                    std::string(fragShader), _1),
+        &finish_shader_program, &free_shader_sources,
+        &cinder_gl_free_shader_program));
+}
 
-void cinder_get_font_info(void* fontPtr, const char** name, float* size,
-                          float* ascent, float* descent, float* leading)
+int cinder_load_request_status(void* requestPtr)
 {
-    Font& font = *static_cast<FontT*>(fontPtr)->font;
+    return (*static_cast<LoadRequestPtr*>(requestPtr))->status();
+}
 
-    *name = font.getName().c_str();
-    *size = font.getSize();
-    *ascent = font.getAscent();
-    *descent = font.getDescent();
-    *leading = font.getLeading();
+const char* cinder_load_request_error(void* requestPtr)
+{
+    return (*static_cast<LoadRequestPtr*>(requestPtr))->error().c_str();
 }
 
-void cinder_get_font_extents(void* fontPtr, char* text,
-                             float* x, float* y, float* w, float* h)
+void* cinder_load_request_take_result(void* requestPtr)
 {
-    cairo::Context& ctx = cinder_app->m_fontContext;
-    Font& font = *static_cast<FontT*>(fontPtr)->font;
+    return (*static_cast<LoadRequestPtr*>(requestPtr))->takeResult();
+}
 
-    ctx.setFont(font);
-    
-    cairo::TextExtents extents = ctx.textExtents(text);
+void cinder_free_load_request(void* requestPtr)
+{
+    LoadRequestPtr* request = static_cast<LoadRequestPtr*>(requestPtr);
+    cinder_app->m_loader.abandon(*request);
+    delete request;
+}
 
-    *x = extents.xBearing();
-    *y = extents.yBearing();
-    *w = extents.width();
-    *h = extents.height();
+void cinder_set_load_budget(float milliseconds)
+{
+    cinder_app->m_loadBudget = std::max(0.0f, milliseconds) / 1000.0;
 }
 
-// These functions are defined in Dylan as c-callable-wrappers.
+int cinder_num_pending_loads()
+{
+    return cinder_app->m_loader.numPending();
+}
+
+void cinder_set_texture_budget(int kilobytes)
+{
+    cinder_app->m_residency.setBudget(
+        static_cast<int64_t>(std::max(0, kilobytes)) * 1024);
+}
+
+void cinder_get_memory_usage(int kind, int* kilobytes, int* peakKilobytes)
+{
+    if (kind < 0 || kind >= kNumMemoryKinds)
+    {
+        *kilobytes = *peakKilobytes = 0;
+        return;
+    }
+
+    const MemoryLedger& ledger = memory_ledger();
+    *kilobytes = static_cast<int>(
+        ledger.current(static_cast<MemoryKind>(kind)) / 1024);
+    *peakKilobytes = static_cast<int>(
+        ledger.peak(static_cast<MemoryKind>(kind)) / 1024);
+}
+
+void cinder_get_residency_stats(int* evictions, int* rebuilds)
+{
+    *evictions = cinder_app->m_residency.numEvictions();
+    *rebuilds = cinder_app->m_residency.numRebuilds();
+}
 
-extern void cinder_startup();
-extern void cinder_shutdown();
-extern void cinder_update();
-extern void cinder_draw();
-extern void cinder_resize(int new_width, int new_height, int full_screen);
-extern void cinder_key_down(int key_id);
-extern void cinder_key_up(int key_id);
-extern void cinder_mouse_down(int btn_id,
-                              int x,
-                              int y,
-                              int is_left_btn_down,
-                              int is_right_btn_down,
-                              int is_middle_btn_down);
-extern void cinder_mouse_up(int btn_id,
-                            int x,
-                            int y,
-                            int is_left_btn_down,
-                            int is_right_btn_down,
-                            int is_middle_btn_down);
-extern void cinder_mouse_move(int x,
-                              int y,
-                              int is_left_btn_down,
-                              int is_right_btn_down,
-                              int is_middle_btn_down);
 } // extern "C"
 
 
+// Replay commands recorded for the render thread (see record), on the
+// render thread.
+static void replay_commands(CommandBuffer& cmds)
+{
+    while (!cmds.atEnd())
+    {
+        switch (cmds.readOp())
+        {
+        case kCmdBeginFrame:
+        {
+            int width = cmds.read<int>();
+            int height = cmds.read<int>();
+            cinder_app->beginFrameTarget(width, height);
+            cinder_app->beginGlFrame();
+            break;
+        }
+        case kCmdEndFrame:
+            cinder_app->endGlFrame();
+            break;
+        case kCmdSetViewport:
+        {
+            int x = cmds.read<int>();
+            int y = cmds.read<int>();
+            int width = cmds.read<int>();
+            int height = cmds.read<int>();
+            cinder_gl_set_viewport(x, y, width, height);
+            break;
+        }
+        case kCmdSetMatricesWindow:
+        {
+            int width = cmds.read<int>();
+            int height = cmds.read<int>();
+            cinder_gl_set_matrices_window(width, height);
+            break;
+        }
+        case kCmdSetColor:
+        {
+            float r = cmds.read<float>();
+            float g = cmds.read<float>();
+            float b = cmds.read<float>();
+            float a = cmds.read<float>();
+            cinder_gl_set_color(r, g, b, a);
+            break;
+        }
+        case kCmdSetBlend:
+            cinder_gl_set_blend(cmds.read<int>());
+            break;
+        case kCmdFlush:
+            cinder_gl_flush();
+            break;
+        case kCmdUploadTexture:
+        {
+            gl::Texture* tex = cmds.read<gl::Texture*>();
+            Area area;
+            GLint dataFormat;
+            GLenum type;
+            const void* pixels = read_pixels(cmds, &area, &dataFormat, &type);
+
+            // Pending quads must be drawn with the old contents.
+            cinder_app->m_quadBatch.flush();
+
+            // The pixels were copied when recorded, so the texture no longer
+            // matches anything it could be rebuilt from. (They've been read
+            // either way, so skipping the upload keeps the buffer in step.)
+            if (!cinder_app->m_residency.use(tex))
+            {
+                break;
+            }
+            cinder_app->m_residency.contentsChanged(tex, 0, false);
+
+            cinder_app->m_glState.bindTexture(tex->getTarget(), tex->getId());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(tex->getTarget(), 0, area.getX1(), area.getY1(),
+                            area.getWidth(), area.getHeight(),
+                            dataFormat, type, pixels);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            break;
+        }
+        case kCmdStreamTexture:
+        {
+            StreamingTexture* stream = cmds.read<StreamingTexture*>();
+            int destX = cmds.read<int>();
+            int destY = cmds.read<int>();
+            Area area;
+            GLint dataFormat;
+            GLenum type;
+            const void* pixels = read_pixels(cmds, &area, &dataFormat, &type);
+
+            cinder_app->m_quadBatch.flush();
+
+            std::memcpy(stream->beginWrite(), pixels,
+                        area.getWidth() * area.getHeight() * 4);
+            stream->endWrite(Area(destX, destY,
+                                  destX + area.getWidth(),
+                                  destY + area.getHeight()),
+                             dataFormat, type);
+            break;
+        }
+        case kCmdFreeTexture:
+            cinder_gl_free_texture(cmds.read<void*>());
+            break;
+        case kCmdFreeStreamingTexture:
+            cinder_gl_free_streaming_texture(cmds.read<void*>());
+            break;
+        case kCmdFreeTextureAtlas:
+            cinder_gl_free_texture_atlas(cmds.read<void*>());
+            break;
+        case kCmdBindTexture:
+            cinder_gl_bind_texture(cmds.read<void*>());
+            break;
+        case kCmdUpdateTransform:
+        {
+            float sx = cmds.read<float>();
+            float shy = cmds.read<float>();
+            float shx = cmds.read<float>();
+            float sy = cmds.read<float>();
+            float tx = cmds.read<float>();
+            float ty = cmds.read<float>();
+            cinder_gl_update_transform(sx, shy, shx, sy, tx, ty);
+            break;
+        }
+        case kCmdClear:
+        {
+            float r = cmds.read<float>();
+            float g = cmds.read<float>();
+            float b = cmds.read<float>();
+            float a = cmds.read<float>();
+            int depth = cmds.read<int>();
+            cinder_gl_clear(r, g, b, a, depth);
+            break;
+        }
+        case kCmdDrawRect:
+        {
+            float x1 = cmds.read<float>();
+            float y1 = cmds.read<float>();
+            float x2 = cmds.read<float>();
+            float y2 = cmds.read<float>();
+            float u1 = cmds.read<float>();
+            float v1 = cmds.read<float>();
+            float u2 = cmds.read<float>();
+            float v2 = cmds.read<float>();
+            cinder_gl_draw_rect(x1, y1, x2, y2, u1, v1, u2, v2);
+            break;
+        }
+        case kCmdDrawText:
+        {
+            size_t size;
+            char* text = static_cast<char*>(
+                const_cast<void*>(cmds.readData(&size)));
+            float r = cmds.read<float>();
+            float g = cmds.read<float>();
+            float b = cmds.read<float>();
+            float a = cmds.read<float>();
+            float x = cmds.read<float>();
+            float y = cmds.read<float>();
+            void* fontPtr = cmds.read<void*>();
+            cinder_gl_draw_text(text, r, g, b, a, x, y, fontPtr);
+            break;
+        }
+        case kCmdDrawLine:
+        {
+            float x1 = cmds.read<float>();
+            float y1 = cmds.read<float>();
+            float x2 = cmds.read<float>();
+            float y2 = cmds.read<float>();
+            float width = cmds.read<float>();
+            cinder_gl_draw_line(x1, y1, x2, y2, width);
+            break;
+        }
+        case kCmdDrawLines:
+        {
+            int numLines = cmds.read<int>();
+            float* points = read_floats(cmds);
+            int numWidths = cmds.read<int>();
+            float* widths = read_floats(cmds);
+            int numColors = cmds.read<int>();
+            float* colors = read_floats(cmds);
+            int cap = cmds.read<int>();
+            cinder_gl_draw_lines(numLines, points, numWidths, widths,
+                                 numColors, colors, cap);
+            break;
+        }
+        case kCmdDrawPolyline:
+        {
+            int numPoints = cmds.read<int>();
+            float* points = read_floats(cmds);
+            int numWidths = cmds.read<int>();
+            float* widths = read_floats(cmds);
+            int numColors = cmds.read<int>();
+            float* colors = read_floats(cmds);
+            int cap = cmds.read<int>();
+            int join = cmds.read<int>();
+            int closed = cmds.read<int>();
+            cinder_gl_draw_polyline(numPoints, points, numWidths, widths,
+                                    numColors, colors, cap, join, closed);
+            break;
+        }
+        case kCmdDrawSprites:
+        {
+            float x1 = cmds.read<float>();
+            float y1 = cmds.read<float>();
+            float x2 = cmds.read<float>();
+            float y2 = cmds.read<float>();
+            float uOffset = cmds.read<float>();
+            float vOffset = cmds.read<float>();
+            float uScale = cmds.read<float>();
+            float vScale = cmds.read<float>();
+            int numSprites = cmds.read<int>();
+            float* sprites = read_floats(cmds);
+            cinder_gl_draw_sprites(x1, y1, x2, y2, uOffset, vOffset,
+                                   uScale, vScale, numSprites, sprites);
+            break;
+        }
+        case kCmdUpdateMesh:
+        {
+            // Replayed directly, since the upload was counted when recorded.
+            Mesh* mesh = cmds.read<Mesh*>();
+            int firstVertex = cmds.read<int>();
+            int numVertices = cmds.read<int>();
+            float* vertices = read_floats(cmds);
+            mesh->updateVertices(firstVertex, numVertices, vertices);
+            break;
+        }
+        case kCmdDrawMesh:
+        {
+            void* meshPtr = cmds.read<void*>();
+            float uOffset = cmds.read<float>();
+            float vOffset = cmds.read<float>();
+            float uScale = cmds.read<float>();
+            float vScale = cmds.read<float>();
+            cinder_gl_draw_mesh(meshPtr, uOffset, vOffset, uScale, vScale);
+            break;
+        }
+        case kCmdFreeMesh:
+            cinder_gl_free_mesh(cmds.read<void*>());
+            break;
+        case kCmdFreeShaderProgram:
+            cinder_gl_free_shader_program(cmds.read<void*>());
+            break;
+        case kCmdSetUniform:
+        {
+            void* progPtr = cmds.read<void*>();
+            int handle = cmds.read<int>();
+            int count = cmds.read<int>();
+            const float* values = read_floats(cmds);
+            update_uniform(progPtr, handle, values, count);
+            break;
+        }
+        case kCmdUseShaderProgram:
+            cinder_gl_use_shader_program(cmds.read<void*>());
+            break;
+        case kCmdFreeFramebuffer:
+            cinder_gl_free_framebuffer(cmds.read<void*>());
+            break;
+        case kCmdPurgeRenderTargets:
+            cinder_gl_purge_render_targets();
+            break;
+        case kCmdBindFramebuffer:
+        {
+            void* ptr = cmds.read<void*>();
+            if (ptr)
+                cinder_gl_bind_framebuffer(ptr);
+            else
+                cinder_gl_unbind_framebuffer();
+            break;
+        }
+        case kCmdFreeFont:
+            cinder_free_font(cmds.read<void*>());
+            break;
+        }
+    }
+}
+
+
 CinderBackendApp::CinderBackendApp() :
     m_linearGradient(0, 0, 0, 0),
     m_radialGradient(0, 0, 0, 0, 0, 0),
-    m_activeGradient(&m_linearGradient)
-{
+    m_activeGradient(&m_linearGradient),
+    m_quadBatch(m_glState),
+    m_shaderProgram(0),
+    m_uvTransformHandle(-1),
+    m_lineBuilder(m_quadBatch),
+    m_spriteInstancer(m_quadBatch, m_glState),
+    m_renderTargets(m_glState),
+    m_loader(m_workers),
+    m_loadBudget(0.004),
+    m_residency(memory_ledger()),
+    m_projectionWidth(0),
+    m_projectionHeight(0),
+    m_headless(false),
+    m_quitRequested(false),
+    m_headlessFps(0.0f),
+    m_frameTarget(0)
+{
+    m_frameTargets[0] = m_frameTargets[1] = 0;
+    std::memset(&m_renderStats, 0, sizeof(m_renderStats));
+    std::memset(&m_lastRenderStats, 0, sizeof(m_lastRenderStats));
 }
 
 void CinderBackendApp::prepareSettings(Settings *settings)
@@ -1006,14 +3637,34 @@ void CinderBackendApp::prepareSettings(Settings *settings)
 
 void CinderBackendApp::setup()
 {
-    setFrameRate(static_cast<double>(cinder_frames_per_second));
+    m_frameClock.setRate(static_cast<double>(cinder_frames_per_second));
+    if (!m_headless)
+    {
+        // m_frameClock paces frames, so cinder just needs to call us as
+        // often as it can.
+        setFrameRate(1000.0f);
+    }
 
     // Create a dummy cairo context, just for getting certain font metrics.
     cairo::SurfaceImage surf(10, 10);
     m_fontContext = cairo::Context(surf);
 
-    gl::enableAlphaBlending();
-    gl::pushModelView();
+    if (cinder_render_thread && !m_headless &&
+        !m_renderThread.start(CGLGetCurrentContext(), replay_commands))
+    {
+        std::fprintf(stderr, "unable to start render thread, "
+                             "drawing directly instead\n");
+    }
+
+    if (m_renderThread.running())
+    {
+        m_renderThread.call(boost::bind(&CinderBackendApp::setupGl, this));
+    }
+    else
+    {
+        setupGl();
+    }
+    m_profiler.setup();
 
     cinder_startup();
 }
@@ -1021,28 +3672,66 @@ void CinderBackendApp::setup()
 void CinderBackendApp::shutdown()
 {
     cinder_shutdown();
+
+    if (m_renderThread.running())
+    {
+        // Also replays whatever cinder_shutdown freed.
+        m_renderThread.call(boost::bind(&CinderBackendApp::cleanupGl, this));
+        m_renderThread.stop();
+    }
+    else
+    {
+        cleanupGl();
+    }
+    m_profiler.cleanup();
+}
+
+void CinderBackendApp::setupGl()
+{
+    gl::enableAlphaBlending();
+    m_quadBatch.setup();
+    m_spriteInstancer.setup();
+}
+
+void CinderBackendApp::cleanupGl()
+{
+    m_quadBatch.cleanup();
+    m_spriteInstancer.cleanup();
+    m_renderTargets.cleanup();
+
+    for (int i = 0; i < 2; ++i)
+    {
+        delete m_frameTargets[i];
+        m_frameTargets[i] = 0;
+    }
 }
 
 void CinderBackendApp::keyDown(KeyEvent event)
 {
+    m_profiler.beginScope(Profiler::kScopeKeyDown);
     cinder_key_down(event.getCode());
+    m_profiler.endScope();
 }
 
 void CinderBackendApp::keyUp(KeyEvent event)
 {
+    m_profiler.beginScope(Profiler::kScopeKeyUp);
     cinder_key_up(event.getCode());
+    m_profiler.endScope();
 }
 
 void CinderBackendApp::mouseDown(MouseEvent event)
 {
     int btn = event.isLeft() ? 0 : (event.isRight() ? 1 : 2);
 
+    m_profiler.beginScope(Profiler::kScopeMouseDown);
     cinder_mouse_down(btn,
                       event.getX(),
                       event.getY(),
                       event.isLeftDown(),
                       event.isRightDown(),
                       event.isMiddleDown());
+    m_profiler.endScope();
 }
 
 void CinderBackendApp::mouseUp(MouseEvent event)
@@ -1054,21 +3743,25 @@ void CinderBackendApp::mouseUp(MouseEvent event)
     // for an up event on X, override the isXDown() function to return the
     // correct value.
 
+    m_profiler.beginScope(Profiler::kScopeMouseUp);
     cinder_mouse_up(btn,
                     event.getX(),
                     event.getY(),
                     event.isLeft() ? false : event.isLeftDown(),
                     event.isRight() ? false : event.isRightDown(),
                     event.isMiddle() ? false :event.isMiddleDown());
+    m_profiler.endScope();
 }
 
 void CinderBackendApp::mouseMove(MouseEvent event)
 {
+    m_profiler.beginScope(Profiler::kScopeMouseMove);
     cinder_mouse_move(event.getX(),
                       event.getY(),
                       event.isLeftDown(),
                       event.isRightDown(),
                       event.isMiddleDown());
+    m_profiler.endScope();
 }
 
 void CinderBackendApp::mouseDrag(MouseEvent event)
@@ -1078,16 +3771,176 @@ void CinderBackendApp::mouseDrag(MouseEvent event)
 
 void CinderBackendApp::resize(ResizeEvent event)
 {
+    m_profiler.beginScope(Profiler::kScopeResize);
     cinder_resize(event.getWidth(), event.getHeight(),
                   cinder_app->isFullScreen());
+    m_profiler.endScope();
 }
 
 void CinderBackendApp::update()
 {
-    cinder_update();
+    const int ticks = m_headless ? m_frameClock.beginFixedFrame()
+                                 : m_frameClock.beginFrame();
+
+    for (int i = 0; i < ticks; ++i)
+    {
+        m_profiler.beginScope(Profiler::kScopeUpdate);
+        cinder_update();
+        m_profiler.endScope();
+    }
 }
 
 void CinderBackendApp::draw()
 {
+    m_profiler.beginScope(Profiler::kScopeDraw);
+
+    if (m_renderThread.running())
+    {
+        // GPU time isn't measured: the queries would have to be made on
+        // the render thread.
+        drawOnRenderThread();
+    }
+    else
+    {
+        m_profiler.beginGpuFrame();
+        beginGlFrame();
+        cinder_draw();
+        endGlFrame();
+        collectRenderStats(&m_lastRenderStats);
+        m_profiler.endGpuFrame();
+    }
+
+    m_profiler.endScope();
+
+    // With a render thread, these are for the previous frame.
+    const RenderStats& stats = m_lastRenderStats;
+    m_profiler.setCounter(Profiler::kCounterDrawCalls, stats.drawCalls);
+    m_profiler.setCounter(Profiler::kCounterQuads, stats.quads);
+    m_profiler.setCounter(Profiler::kCounterTextureBinds,
+                          stats.changes[GlStateCache::kTexture]);
+    m_profiler.setCounter(Profiler::kCounterShaderSwitches,
+                          stats.changes[GlStateCache::kProgram]);
+    m_profiler.setCounter(Profiler::kCounterFramebufferBinds,
+                          stats.changes[GlStateCache::kFramebuffer]);
+    m_profiler.endFrame();
+
+    // Headless runs go as fast as possible.
+    if (!m_headless)
+    {
+        m_frameClock.pace();
+    }
+}
+
+void CinderBackendApp::beginGlFrame()
+{
+    // Evicting deletes textures, which the state cache has to forget.
+    m_residency.beginFrame(m_quadBatch.key().texture);
+
+    // Something other than us might have touched GL state between frames.
+    m_glState.invalidate();
+    m_projectionWidth = m_projectionHeight = 0;
+    m_glState.beginFrame();
+    m_quadBatch.beginFrame();
+
+    m_loader.finishGlWork(m_loadBudget);
+}
+
+void CinderBackendApp::endGlFrame()
+{
+    m_quadBatch.endFrame();
+    m_renderTargets.endFrame();
+    m_glState.endFrame();
+
+    if (m_renderThread.onRenderThread())
+    {
+        collectRenderStats(&m_renderStats);
+        m_renderStats.frame = m_frameTargets[m_frameTarget]
+                            ? &m_frameTargets[m_frameTarget]->getTexture()
+                            : 0;
+        m_frameTarget = 1 - m_frameTarget;
+
+        // The main thread's context draws the frame, so it has to have
+        // reached GL first.
+        glFlush();
+    }
+}
+
+void CinderBackendApp::collectRenderStats(RenderStats* stats)
+{
+    stats->drawCalls = m_quadBatch.lastFrameDrawCalls();
+    stats->quads = m_quadBatch.lastFrameQuads();
+    for (int i = 0; i < GlStateCache::kNumKinds; ++i)
+    {
+        GlStateCache::Kind k = static_cast<GlStateCache::Kind>(i);
+        stats->changes[i] = m_glState.lastFrameChanges(k);
+        stats->filtered[i] = m_glState.lastFrameFiltered(k);
+    }
+    stats->frame = 0;
+}
+
+void CinderBackendApp::drawOnRenderThread()
+{
+    CommandBuffer* cmds = record(kCmdBeginFrame);
+    cmds->write(getWindowWidth());
+    cmds->write(getWindowHeight());
+
     cinder_draw();
+
+    record(kCmdEndFrame);
+
+    // Once the previous frame is finished, its stats and target can be
+    // read, and this one handed over. Its drawing then overlaps our next
+    // update.
+    m_renderThread.waitIdle();
+    m_lastRenderStats = m_renderStats;
+    m_renderThread.submit();
+
+    presentFrame(m_lastRenderStats.frame);
+}
+
+// Draw into the current frame target (replacing it if the window has
+// changed size) instead of the window. On the render thread.
+void CinderBackendApp::beginFrameTarget(int width, int height)
+{
+    gl::Fbo*& target = m_frameTargets[m_frameTarget];
+
+    if (!target || target->getWidth() != width ||
+        target->getHeight() != height)
+    {
+        delete target;
+        target = 0;
+        try
+        {
+            target = new gl::Fbo(width, height, true);
+            // As for cinder_gl_create_framebuffer.
+            target->getTexture().setFlipped(true);
+        }
+        catch (...)
+        {
+            std::fprintf(stderr, "unable to create a %dx%d frame target\n",
+                         width, height);
+        }
+    }
+
+    m_glState.setDefaultFramebuffer(target ? target->getId() : 0);
+}
+
+// Show a frame the render thread has finished. This is the only drawing
+// the main thread does while there is a render thread.
+void CinderBackendApp::presentFrame(gl::Texture* frame)
+{
+    gl::setViewport(getWindowBounds());
+    gl::clear(Color::black());
+
+    if (frame)
+    {
+        gl::setMatricesWindow(getWindowSize());
+        gl::disableAlphaBlending();
+        gl::color(Color::white());
+        gl::draw(*frame, Rectf(getWindowBounds()));
+    }
+
+    // The render thread draws into this frame's target again after the
+    // next one, so our reads from it have to be sent to GL before then.
+    glFlush();
 }
@@ -16,18 +16,90 @@ typedef int BOOL;
 
 /* Application setup and miscellaneous functions */
 
+/*
+With renderThread, GL calls are recorded and replayed on a separate render
+thread, so drawing a frame overlaps updating the next. Calls that create
+resources (or otherwise need an answer from GL) then wait for the render
+thread to catch up, and frame and state stats are for the last frame it
+finished.
+*/
 void cinder_run(int width, int height,
                 int appWidth, int appHeight,
                 BOOL forceAppAspectRatio,
                 BOOL fullscreen,
                 int frames_per_second,
-                BOOL antialiasing);
+                BOOL antialiasing,
+                BOOL renderThread);
+/*
+Run without a window, drawing into an offscreen context, for numFrames
+frames (or until cinder_quit) as fast as possible. Frames whose numbers
+(counting from 0) are among captureFrames are saved as
+<capturePrefix><number>.png. Timing statistics are printed at exit.
+width and height are the offscreen target's size; as with a window, the
+app's logical size is applied on the Dylan side, from its config.
+The time taken by setup (mostly loading) is printed too, along with texture
+cache hits and misses. Returns false if no offscreen context could be
+created.
+*/
+BOOL cinder_run_headless(int width, int height,
+                         int numFrames, int frames_per_second,
+                         int numCaptures, const int* captureFrames,
+                         const char* capturePrefix);
 void cinder_quit();
+/*
+Keep decoded images ("cooked" textures) in dir, so that loading an image
+that hasn't changed since it was cooked skips decoding it. Used by
+cinder_load_surface, cinder_load_surface_async and cinder_gl_load_texture.
+A null or empty dir turns the cache off. Best called before cinder_run.
+Hits and misses count lookups since the cache was set.
+*/
+void cinder_set_texture_cache_dir(char* dir);
+void cinder_get_texture_cache_stats(int* hits, int* misses);
 /* TODO: remove? void cinder_set_app_size(int width, int height, BOOL forceAspectRatio); */
 void cinder_set_full_screen(BOOL fullscreen);
 float cinder_get_average_fps();
+/*
+Updates run in fixed ticks of 1 / frames_per_second, as many per frame as
+real time requires (up to a limit, beyond which ticks are dropped). This is
+the fraction of a tick of real time not yet simulated when drawing.
+*/
+float cinder_get_interpolation();
+/*
+Mean, standard deviation and maximum of recent frame intervals (in
+milliseconds), and the number of update ticks dropped so far.
+*/
+void cinder_get_frame_pacing_stats(float* meanMs, float* stdDevMs,
+                                   float* maxMs, int* droppedTicks);
 void cinder_set_cursor_visible(BOOL visible);
 
+/* Profiling */
+
+/*
+While disabled, scopes and GPU times are not recorded (frame times and
+counters still are). Enabled by default.
+*/
+void cinder_profile_set_enabled(BOOL enabled);
+BOOL cinder_profile_is_enabled();
+/* Scopes nest, and any left open are closed at the end of the frame. */
+void cinder_profile_begin_scope(const char* name);
+void cinder_profile_end_scope();
+/*
+Recent frames are kept in a ring, and are identified by age (0 is the last
+complete frame). cinder_profile_get_frame fills in times (3 floats: frame,
+CPU and GPU time in milliseconds, GPU time being -1 if unknown) and counters
+(6 ints: draw calls, quads, texture binds, shader switches, framebuffer
+binds and bytes uploaded), and returns the frame's number, or -1 if there
+is no frame of that age.
+*/
+int cinder_profile_num_frames();
+int cinder_profile_get_frame(int age, float* times, int* counters);
+/* Scope start times are in milliseconds from the start of the frame. */
+int cinder_profile_num_scopes(int age);
+void cinder_profile_get_scope(int age, int index, const char** name,
+                              float* start, float* duration, int* depth);
+/* Write the recorded frames as a Chrome trace. Returns false on failure. */
+BOOL cinder_profile_write_trace(const char* path);
+
 /* Audio */
 
 float cinder_audio_get_master_volume();
@@ -47,14 +119,67 @@ float cinder_audio_get_music_volume(void* musicPtr);
 void* cinder_surface_create(int width, int height);
 void* cinder_load_surface(char* resourceName, int* width, int* height);
 void cinder_surface_free(void* surfacePtr);
+void cinder_surface_get_size(void* surfacePtr, int* width, int* height);
 void cinder_surface_copy_pixels(void* srcPtr, int srcX, int srcY, int w, int h,
                                 void* destPtr, int destX, int destY);
+/*
+Blend numBlits rects of surfaces onto destPtr, in order. rects holds 6 ints
+per blit (srcX, srcY, w, h, destX, destY), and srcPtrs a surface for each
+(which may be destPtr itself). Pixels are premultiplied. blend is
+0 => source over, 1 => additive, 2 => multiply, 3 => screen. alpha (0 to 1)
+scales every source pixel. Only pixels within the clip rect are changed.
+Large batches are split across worker threads, a band of rows each, with
+the same result as doing the blits one at a time. Returns false (changing
+nothing) if a surface's pixel format isn't supported or blend is out of
+range.
+*/
+BOOL cinder_surface_blit(void* destPtr, int numBlits, void** srcPtrs,
+                         int* rects, int blend, float alpha,
+                         int clipX, int clipY, int clipW, int clipH);
 void cinder_surface_fill(void* ptr, float r, float g, float b, float a,
                          int x, int y, int w, int h);
 void cinder_surface_premultiply(void* ptr);
 void cinder_surface_unpremultiply(void* ptr);
 void cinder_surface_flip_vertical(void* ptr);
+/*
+Returns a new surface with ptr's pixels resampled to width x height, or null
+if the size or filter is bad. Filters are 0 => box, 1 => triangle,
+2 => gaussian, 3 => lanczos (3 lobes).
+*/
 void* cinder_surface_resize(void* ptr, int width, int height, int filter);
+/*
+Each surface tracks the area changed ("damaged") since it was created or its
+damage was last uploaded with cinder_gl_upload_surface_damage (or cleared).
+Every function that changes a surface's pixels, including vg drawing, adds
+to it. The bounds are all 0 if there is no damage.
+*/
+int cinder_surface_is_damaged(void* ptr);
+void cinder_surface_get_damage_bounds(void* ptr,
+                                      int* x, int* y, int* w, int* h);
+void cinder_surface_clear_damage(void* ptr);
+/*
+Direct access to a surface's pixels. cinder_surface_lock returns a pointer to
+the top left pixel, with rows stride bytes apart, 4 bytes per pixel in the
+given format: 0 => BGRA, 1 => RGBA, 2 => BGRX, 3 => RGBX (X is unused), in
+byte order. Colors are premultiplied by alpha if premultiplied is true
+(always so for surfaces with alpha). The pointer is valid until the surface
+is freed, but the pixels may only be touched until cinder_surface_unlock,
+which must be called before any other function is used on the surface. The
+rect passed to it (which may be empty) is added to the surface's damage.
+*/
+void* cinder_surface_lock(void* ptr, int* stride, int* format,
+                          BOOL* premultiplied);
+void cinder_surface_unlock(void* ptr, int x, int y, int w, int h);
+/*
+Copy a rect of pixels, row by row, to or from rgba, which holds 4 floats
+(0 to 1) per pixel in r, g, b, a order. Colors are straight (not
+premultiplied), so these convert. Return 0 (doing nothing) if the rect isn't
+entirely within the surface.
+*/
+BOOL cinder_surface_read_pixels(void* ptr, int x, int y, int w, int h,
+                                float* rgba);
+BOOL cinder_surface_write_pixels(void* ptr, int x, int y, int w, int h,
+                                 float* rgba);
 
 /* OpenGL Rendering */
 
@@ -63,16 +188,95 @@ void cinder_gl_set_matrices_window(int width, int height);
 void cinder_gl_set_color(float r, float g, float b, float a);
 void cinder_gl_set_blend(int mode);
 
+/*
+Rects, lines and text are batched and drawn in as few draw calls as
+possible, with transforms applied on the CPU. Batches are
+flushed automatically when necessary (and at the end of each frame), but
+cinder_gl_flush can be used to force any pending drawing to be submitted.
+*/
+void cinder_gl_flush();
+/* Number of draw calls and quads submitted during the last complete frame. */
+void cinder_gl_get_frame_stats(int* drawCalls, int* quads);
+/*
+Redundant texture, shader, blend, framebuffer and uniform changes are
+filtered out before reaching OpenGL. Returns the number of real and filtered
+changes of the given kind during the last complete frame. Kinds:
+0 => texture, 1 => shader program, 2 => blend mode, 3 => framebuffer,
+4 => shader uniform.
+*/
+void cinder_gl_get_state_stats(int kind, int* changes, int* filtered);
+
 void* cinder_gl_create_texture(int width, int height);
 void cinder_gl_free_texture(void* texPtr);
 void cinder_gl_update_texture(void* texPtr, void* surfPtr,
                               int x1, int y1, int x2, int y2);
 void* cinder_gl_create_texture_from_surface(void* surfPtr, int x, int y,
                                             int w, int h);
+/*
+Create a texture from a whole surface along with all of its mip levels,
+which are resampled on the CPU with the given filter (as for
+cinder_surface_resize), each from the one before. The texture is minified
+with trilinear filtering. Returns null if the surface isn't 4 bytes per pixel
+or the filter is unknown.
+*/
+void* cinder_gl_create_mipmapped_texture_from_surface(void* surfPtr,
+                                                      int filter);
+/*
+Create a texture straight from an image resource, with its mip levels (made
+as for cinder_gl_create_mipmapped_texture_from_surface) unless filter is -1.
+With a texture cache, a cooked image is uploaded directly from its memory
+mapped file. Returns null if the resource can't be loaded or the filter is
+unknown.
+*/
+void* cinder_gl_load_texture(char* resourceName, int filter,
+                             int* width, int* height);
+/*
+Copy only the damaged parts of a surface to the same place in a texture of
+the same size, then clear the surface's damage. Returns the number of pixels
+uploaded, or -1 (leaving the damage) if the sizes differ or the texture was
+evicted and couldn't be rebuilt.
+*/
+int cinder_gl_upload_surface_damage(void* texPtr, void* surfPtr);
+/*
+Streaming textures are for contents that change every frame. Uploads go
+through a ring of numBuffers (1 to 3) pixel buffer objects, so they don't
+stall waiting for GL (falling back to ordinary uploads if pixel buffer
+objects aren't supported). Draw them using the texture returned by
+cinder_gl_streaming_texture_get_texture, which belongs to the stream.
+cinder_gl_stream_surface_damage is like cinder_gl_upload_surface_damage,
+but uploads the bounds of the damage.
+*/
+void* cinder_gl_create_streaming_texture(int width, int height,
+                                         int numBuffers);
+void cinder_gl_free_streaming_texture(void* streamPtr);
+void* cinder_gl_streaming_texture_get_texture(void* streamPtr);
+void cinder_gl_stream_surface(void* streamPtr, void* surfPtr,
+                              int x1, int y1, int x2, int y2);
+int cinder_gl_stream_surface_damage(void* streamPtr, void* surfPtr);
+/*
+Texture atlases pack many surfaces into a few large textures (pages), so
+that drawing from different atlas entries needn't change the bound texture.
+Entries are identified by ints (-1 means failure). padding is the number of
+pixels around each entry filled by extruding its edges.
+cinder_gl_atlas_get_entry returns the page texture holding an entry (usable
+with cinder_gl_bind_texture) and the entry's texture coordinates within it,
+for use with cinder_gl_draw_rect. Pages and coordinates only change when
+the atlas is defragmented.
+*/
+void* cinder_gl_create_texture_atlas(int pageSize, int padding);
+void cinder_gl_free_texture_atlas(void* atlasPtr);
+int cinder_gl_atlas_add(void* atlasPtr, void* surfPtr,
+                        int x, int y, int w, int h);
+int cinder_gl_atlas_update(void* atlasPtr, int entry, void* surfPtr,
+                           int x, int y, int w, int h);
+void cinder_gl_atlas_remove(void* atlasPtr, int entry);
+void cinder_gl_atlas_defragment(void* atlasPtr);
+void cinder_gl_atlas_get_entry(void* atlasPtr, int entry, void** texPtr,
+                               float* u1, float* v1, float* u2, float* v2);
+void cinder_gl_atlas_get_usage(void* atlasPtr, int* pages, float* usage);
+
 void cinder_gl_bind_texture(void* texPtr);
 void cinder_gl_unbind_texture(void* texPtr);
-void cinder_gl_push_modelview_matrix();
-void cinder_gl_pop_modelview_matrix();
 void cinder_gl_update_transform(float sx, float shy, float shx,
                                 float sy, float tx, float ty);
 void cinder_gl_clear(float r, float g, float b, float a, BOOL depth);
@@ -81,6 +285,56 @@ void cinder_gl_draw_rect(float x1, float y1, float x2, float y2,
 void cinder_gl_draw_text(char* text, float r, float g, float b, float a,
                          float x, float y, void* fontPtr);
 void cinder_gl_draw_line(float x1, float y1, float x2, float y2, float width);
+/*
+Draw many lines at once, expanded into quads with the given caps and joins
+(0 => butt, 1 => round, 2 => square; 0 => miter, 1 => round, 2 => bevel).
+cinder_gl_draw_lines takes x1, y1, x2, y2 per line and
+cinder_gl_draw_polyline x, y per point. numWidths widths and numColors rgba
+colors are given either once (1), per line/point, or not at all (0: width 1
+and the current color).
+*/
+void cinder_gl_draw_lines(int numLines, float* points,
+                          int numWidths, float* widths,
+                          int numColors, float* colors,
+                          int cap);
+void cinder_gl_draw_polyline(int numPoints, float* points,
+                             int numWidths, float* widths,
+                             int numColors, float* colors,
+                             int cap, int join, int closed);
+/*
+Draw numSprites copies of the rect x1, y1, x2, y2 in one call, with the
+current texture, shader, blend mode and transform. sprites holds 14 floats
+per sprite: its own transform (sx, shy, shx, sy, tx, ty, applied before the
+current one), texture coordinates (u1, v1, u2, v2, mapped by u = uOffset +
+u * uScale and likewise for v) and color (r, g, b, a, modulated by the
+current color). Uses hardware instancing when available.
+*/
+void cinder_gl_draw_sprites(float x1, float y1, float x2, float y2,
+                            float uOffset, float vOffset,
+                            float uScale, float vScale,
+                            int numSprites, float* sprites);
+/*
+Meshes are triangles kept in GL buffers, for geometry that doesn't change
+(or changes rarely), so drawing one needs no per-frame uploads. vertices
+holds 8 floats per vertex (x, y, u, v, r, g, b, a) and indices 3 per
+triangle. cinder_gl_create_mesh returns null if an index is out of range,
+and cinder_gl_update_mesh returns -1 if the vertices aren't all within the
+mesh. Meshes are drawn with the current texture, shader, blend mode and
+transform, with texture coordinates mapped as for cinder_gl_draw_sprites.
+The default shader does the mapping itself. A custom shader has to apply
+it: the backend sets the shader's uniform vec4 uvTransform (if it has one)
+to (uOffset, vOffset, uScale, vScale) for each draw, so that
+    gl_TexCoord[0] = vec4(uvTransform.xy + gl_MultiTexCoord0.st *
+                          uvTransform.zw, 0.0, 1.0);
+maps them; gl_TextureMatrix[0] holds the same mapping.
+*/
+void* cinder_gl_create_mesh(int numVertices, float* vertices,
+                            int numIndices, int* indices);
+void cinder_gl_free_mesh(void* meshPtr);
+int cinder_gl_update_mesh(void* meshPtr, int firstVertex,
+                          int numVertices, float* vertices);
+void cinder_gl_draw_mesh(void* meshPtr, float uOffset, float vOffset,
+                         float uScale, float vScale);
 void* cinder_gl_load_shader_program(char* vertShader, char* fragShader,
                                     const char** outErrorMsg);
 void* cinder_gl_create_shader_program(char* vertShaderSource, char* fragShaderSource,
@@ -91,10 +345,45 @@ void cinder_gl_set_uniform_1f(void* progPtr, const char* name, float value);
 void cinder_gl_set_uniform_2f(void* progPtr, const char* name, float v1, float v2);
 void cinder_gl_set_uniform_4f(void* progPtr, const char* name,
                               float v1, float v2, float v3, float v4);
+/*
+Uniforms can also be set by handle, which avoids looking up the name each
+time. A handle of -1 (returned for names that aren't active uniforms of the
+program) is ignored when setting. Setting a uniform to the value it already
+has does nothing.
+*/
+int cinder_gl_get_uniform_handle(void* progPtr, const char* name);
+void cinder_gl_set_uniform_handle_1i(void* progPtr, int handle, int value);
+void cinder_gl_set_uniform_handle_1f(void* progPtr, int handle, float value);
+void cinder_gl_set_uniform_handle_2f(void* progPtr, int handle,
+                                     float v1, float v2);
+void cinder_gl_set_uniform_handle_4f(void* progPtr, int handle,
+                                     float v1, float v2, float v3, float v4);
+/*
+Set several uniforms in one call. counts[i] is the number of components
+(e.g., 2 for a vec2) of uniform handles[i]. values holds all components,
+packed one uniform after another.
+*/
+void cinder_gl_set_uniforms(void* progPtr, int numUniforms,
+                            const int* handles, const int* counts,
+                            const float* values);
 void cinder_gl_use_shader_program(void* progPtr);
 void* cinder_gl_create_framebuffer(int width, int height, void** texturePtr,
                                    const char** outErrorMsg);
 void cinder_gl_free_framebuffer(void* ptr);
+/*
+Render targets (framebuffers) for transient use come from a pool, matched
+by size, format (0 => RGBA8, 1 => RGBA16F) and whether they have a depth
+buffer. Released targets are reused by later acquires, and freed after
+being unused for a couple of seconds (or when purged). Don't pass pooled
+targets to cinder_gl_free_framebuffer. Memory is reported in kilobytes.
+*/
+void* cinder_gl_acquire_render_target(int width, int height, int format,
+                                      int depth, void** texturePtr,
+                                      const char** outErrorMsg);
+void cinder_gl_release_render_target(void* ptr);
+void cinder_gl_purge_render_targets();
+void cinder_gl_get_render_target_stats(int* numTargets, int* kbAllocated,
+                                       int* kbInUse);
 void cinder_gl_bind_framebuffer(void* ptr);
 void cinder_gl_unbind_framebuffer();
 
@@ -138,6 +427,35 @@ void cinder_vg_fill_path(void* ptr);
 void cinder_vg_draw_text(void* ptr, void* fontPtr, char* text,
                          float x, float y, BOOL isFill);
 
+/* Tiled Surfaces */
+
+/*
+A tiled surface is a surface of any size up to 8388608 pixels across (as
+far as cairo can address), made of square tiles of tileSize (16 to 4096)
+pixels, each allocated the first time something is drawn on it. Tiles
+never drawn on are transparent. cinder_create_tiled_surface returns null if
+a size is out of range.
+Draw on one with a context from cinder_vg_make_tiled_context, which works
+with all the cinder_vg_* functions (except that there's no clipping), and
+free it with cinder_vg_free_context.
+cinder_gl_draw_tiled_surface draws the tiles that can be seen in the view
+from (viewX1, viewY1) to (viewX2, viewY2), which is the part of the current
+target that can be drawn on, in the same units as the projection. The
+transform is given as for cinder_gl_update_transform (which it must already
+have been passed). Each tile drawn has its texture created or brought up to
+date, then bound and drawn.
+The current texture is left unbound. Returns the number of tiles drawn.
+*/
+void* cinder_create_tiled_surface(int width, int height, int tileSize);
+void cinder_tiled_surface_free(void* tiledPtr);
+int cinder_tiled_surface_num_allocated_tiles(void* tiledPtr);
+void* cinder_vg_make_tiled_context(void* tiledPtr);
+int cinder_gl_draw_tiled_surface(void* tiledPtr,
+                                 float sx, float shy, float shx, float sy,
+                                 float tx, float ty,
+                                 float viewX1, float viewY1,
+                                 float viewX2, float viewY2);
+
 /* Fonts */
 
 void* cinder_load_font(char* resourceName, float size);
@@ -147,5 +465,50 @@ void cinder_get_font_info(void* fontPtr, const char** name, float* size,
 void cinder_get_font_extents(void* fontPtr, char* text,
                              float* x, float* y, float* w, float* h);
 
+/* Background loading */
+
+/*
+These start loading a resource on a worker thread and return a request
+right away. Any GL work (for fonts and shaders) is done at the start of a
+frame, for up to the load budget (4 ms by default) each frame, but at least
+one request's worth. Poll cinder_load_request_status: 0 => pending,
+1 => ready, -1 => failed (see cinder_load_request_error). Once it's ready,
+cinder_load_request_take_result hands over what the matching blocking call
+(eg, cinder_load_surface) would have returned, after which the caller owns
+it. Free requests when done with them; a result that was never taken is
+freed along with its request (or when it's done, if it's still pending).
+*/
+void* cinder_load_surface_async(char* resourceName);
+void* cinder_load_font_async(char* resourceName, float size);
+void* cinder_audio_load_sound_async(const char* resourceName);
+void* cinder_gl_load_shader_program_async(char* vertShader, char* fragShader);
+int cinder_load_request_status(void* requestPtr);
+const char* cinder_load_request_error(void* requestPtr);
+void* cinder_load_request_take_result(void* requestPtr);
+void cinder_free_load_request(void* requestPtr);
+void cinder_set_load_budget(float milliseconds);
+/* Number of requests still loading. */
+int cinder_num_pending_loads();
+
+/* Memory */
+
+/*
+Kinds: 0 => surfaces' pixels, 1 => textures, 2 => framebuffers and render
+targets. Usage is in kilobytes, along with the most ever used at once.
+Textures made from surfaces or image files are kept within the texture
+budget (0, the default, for none) by evicting the least recently used ones
+at the start of a frame, and rebuilding them when next bound. Only textures
+that can be rebuilt are evicted: those loaded from files, and those copied
+from a surface that's unchanged since (and only without a render thread).
+The pixels of the latter are copied out of the surface as they're evicted
+(counting as surfaces' pixels), so later changes to the surface, or freeing
+it, don't change what's rebuilt. Textures used in the last frame are kept,
+so the budget is soft. A texture that can't be rebuilt (eg, its file has
+gone) draws untextured.
+*/
+void cinder_set_texture_budget(int kilobytes);
+void cinder_get_memory_usage(int kind, int* kilobytes, int* peakKilobytes);
+void cinder_get_residency_stats(int* evictions, int* rebuilds);
+
 #endif
 
@@ -0,0 +1,63 @@
+#include "command_buffer.h"
+#include <algorithm>
+
+CommandBuffer::CommandBuffer() :
+    m_size(0),
+    m_readPos(0)
+{
+}
+
+void CommandBuffer::clear()
+{
+    m_size = 0;
+    m_readPos = 0;
+}
+
+void CommandBuffer::writeData(const void* data, size_t size)
+{
+    void* dest = reserveData(size);
+    if (size > 0)
+    {
+        std::memcpy(dest, data, size);
+    }
+}
+
+void* CommandBuffer::reserveData(size_t size)
+{
+    write(static_cast<uint32_t>(size));
+    align();
+    return grow(size);
+}
+
+const void* CommandBuffer::readData(size_t* size)
+{
+    *size = read<uint32_t>();
+
+    // Skip the same padding align added.
+    m_readPos = (m_readPos + kDataAlignment - 1) & ~(kDataAlignment - 1);
+
+    const void* data = &m_data[0] + m_readPos;
+    m_readPos += *size;
+    return data;
+}
+
+uint8_t* CommandBuffer::grow(size_t size)
+{
+    if (m_size + size > m_data.size())
+    {
+        // Grow geometrically, so a buffer filled a little at a time only
+        // reallocates a few times.
+        m_data.resize(std::max(m_size + size, m_data.size() * 2));
+    }
+
+    uint8_t* result = &m_data[0] + m_size;
+    m_size += size;
+    return result;
+}
+
+void CommandBuffer::align()
+{
+    size_t padding = (kDataAlignment - m_size % kDataAlignment) %
+                     kDataAlignment;
+    grow(padding);
+}
@@ -0,0 +1,81 @@
+#ifndef orlok_command_buffer_h
+#define orlok_command_buffer_h
+
+/*
+A flat buffer of recorded commands, for replay on another thread (see
+RenderThread). A command is an opcode followed by its arguments, written as
+raw bytes in the order they are to be read back. Variable length data (eg,
+strings, point arrays, pixels) is copied into the buffer too, so nothing
+recorded refers to memory the recording side might change or free before
+the commands are replayed.
+
+Clearing keeps the buffer's capacity, so recording a frame's commands
+doesn't allocate once the buffer has grown to fit a typical frame.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+
+class CommandBuffer
+{
+public:
+    CommandBuffer();
+
+    void clear();
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+
+    // Writing.
+
+    void writeOp(int op) { write(static_cast<uint8_t>(op)); }
+
+    // T must be plain old data (numbers, pointers, or structs of them).
+    template <typename T>
+    void write(const T& value)
+    {
+        std::memcpy(grow(sizeof(T)), &value, sizeof(T));
+    }
+
+    // Copy size bytes (which readData will return suitably aligned for any
+    // type).
+    void writeData(const void* data, size_t size);
+    // As writeData, but returns the space to fill in, eg, to copy pixels
+    // straight into the buffer a row at a time.
+    void* reserveData(size_t size);
+
+    // Reading, in the order things were written.
+
+    void rewind() { m_readPos = 0; }
+    bool atEnd() const { return m_readPos >= m_size; }
+
+    int readOp() { return read<uint8_t>(); }
+
+    template <typename T>
+    T read()
+    {
+        T value;
+        std::memcpy(&value, &m_data[m_readPos], sizeof(T));
+        m_readPos += sizeof(T);
+        return value;
+    }
+
+    // Returns the data written by writeData or reserveData, and its size.
+    const void* readData(size_t* size);
+
+private:
+    // Alignment of data written by writeData.
+    static const size_t kDataAlignment = 8;
+
+    uint8_t* grow(size_t size);
+    void align();
+
+    std::vector<uint8_t> m_data;
+    size_t               m_size;    // bytes used (m_data only ever grows)
+    size_t               m_readPos;
+};
+
+#endif
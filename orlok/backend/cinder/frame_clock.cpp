@@ -0,0 +1,140 @@
+#include "frame_clock.h"
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
+namespace
+{
+
+// Sleeps stop this long (seconds) before a frame is due, and we spin for
+// the rest.
+const double k_spin_time = 0.002;
+
+} // namespace
+
+
+FrameClock::FrameClock() :
+    m_tickTime(1.0 / 60.0),
+    m_accumulator(0.0),
+    m_lastFrameStart(0.0),
+    m_nextFrameDue(0.0),
+    m_started(false),
+    m_droppedTicks(0),
+    m_numSamples(0),
+    m_nextSample(0)
+{
+    m_clock.start();
+}
+
+void FrameClock::setRate(double ticksPerSecond)
+{
+    m_tickTime = 1.0 / std::max(ticksPerSecond, 1.0);
+}
+
+int FrameClock::beginFrame()
+{
+    const double t = now();
+
+    if (!m_started)
+    {
+        // The first frame runs a single tick, however long startup took.
+        m_started = true;
+        m_lastFrameStart = t;
+        m_nextFrameDue = t + m_tickTime;
+        m_accumulator = 0.0;
+        return 1;
+    }
+
+    recordInterval(t - m_lastFrameStart);
+    m_accumulator += t - m_lastFrameStart;
+    m_lastFrameStart = t;
+
+    int ticks = static_cast<int>(m_accumulator / m_tickTime);
+    if (ticks > kMaxTicksPerFrame)
+    {
+        m_droppedTicks += ticks - kMaxTicksPerFrame;
+        ticks = kMaxTicksPerFrame;
+        // Keep the fraction, so interpolation stays smooth.
+        m_accumulator = std::fmod(m_accumulator, m_tickTime) +
+                        ticks * m_tickTime;
+    }
+
+    m_accumulator -= ticks * m_tickTime;
+    return ticks;
+}
+
+int FrameClock::beginFixedFrame()
+{
+    const double t = now();
+
+    if (m_started)
+    {
+        recordInterval(t - m_lastFrameStart);
+    }
+    m_started = true;
+    m_lastFrameStart = t;
+    m_accumulator = 0.0;
+    return 1;
+}
+
+float FrameClock::interpolation() const
+{
+    float alpha = static_cast<float>(m_accumulator / m_tickTime);
+    return std::max(0.0f, std::min(alpha, 0.999f));
+}
+
+void FrameClock::pace()
+{
+    double t = now();
+    const double remaining = m_nextFrameDue - t;
+
+    if (remaining > k_spin_time)
+    {
+        usleep(static_cast<useconds_t>((remaining - k_spin_time) * 1.0e6));
+    }
+
+    while ((t = now()) < m_nextFrameDue)
+    {
+        // spin
+    }
+
+    m_nextFrameDue += m_tickTime;
+    if (m_nextFrameDue < t)
+    {
+        // We fell behind. Don't rush the next frames to catch up.
+        m_nextFrameDue = t + m_tickTime;
+    }
+}
+
+void FrameClock::intervalStats(double* mean, double* stdDev,
+                               double* maxInterval) const
+{
+    *mean = *stdDev = *maxInterval = 0.0;
+    if (m_numSamples == 0)
+    {
+        return;
+    }
+
+    double sum = 0.0;
+    for (int i = 0; i < m_numSamples; ++i)
+    {
+        sum += m_samples[i];
+        *maxInterval = std::max(*maxInterval, m_samples[i]);
+    }
+    *mean = sum / m_numSamples;
+
+    double variance = 0.0;
+    for (int i = 0; i < m_numSamples; ++i)
+    {
+        double d = m_samples[i] - *mean;
+        variance += d * d;
+    }
+    *stdDev = std::sqrt(variance / m_numSamples);
+}
+
+void FrameClock::recordInterval(double interval)
+{
+    m_samples[m_nextSample] = interval;
+    m_nextSample = (m_nextSample + 1) % kNumSamples;
+    m_numSamples = std::min(m_numSamples + 1, kNumSamples);
+}
@@ -0,0 +1,74 @@
+#ifndef orlok_frame_clock_h
+#define orlok_frame_clock_h
+
+/*
+Fixed timestep loop timing. Real time is accumulated each frame and spent in
+fixed size update ticks, so the simulation runs at the same speed however
+fast frames are drawn: a slow frame is followed by more than one tick, a
+fast one possibly by none. What's left over (less than a tick) is given as
+an interpolation factor for drawing.
+
+If frames fall too far behind, the extra ticks are dropped rather than run
+(which would only make the next frame slower still, the "spiral of death"),
+and the simulation slows down instead.
+
+Frames are paced by sleeping until shortly before the next frame is due,
+then spinning for the rest, since sleeps alone can overshoot by a
+millisecond or more.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/Timer.h"
+
+using namespace ci;
+
+
+class FrameClock
+{
+public:
+    // At most this many ticks are run for one frame.
+    static const int kMaxTicksPerFrame = 5;
+    // Number of recent frame intervals kept for statistics.
+    static const int kNumSamples = 120;
+
+    FrameClock();
+
+    // Ticks (and frames) per second.
+    void setRate(double ticksPerSecond);
+
+    // Start a frame. Returns the number of ticks to run.
+    int beginFrame();
+    // Start a frame which runs exactly one tick, regardless of real time
+    // (eg, when running headless, so runs are repeatable).
+    int beginFixedFrame();
+
+    // Fraction of a tick of real time not yet simulated, in [0, 1).
+    float interpolation() const;
+
+    // Wait until the next frame is due.
+    void pace();
+
+    // Statistics of recent frame intervals, in seconds, and the total
+    // number of ticks dropped so far.
+    void intervalStats(double* mean, double* stdDev, double* maxInterval) const;
+    int droppedTicks() const { return m_droppedTicks; }
+
+private:
+    double now() const { return m_clock.getSeconds(); }
+    void recordInterval(double interval);
+
+    Timer  m_clock;
+    double m_tickTime;
+    double m_accumulator;
+    double m_lastFrameStart;
+    double m_nextFrameDue;
+    bool   m_started;
+    int    m_droppedTicks;
+
+    double m_samples[kNumSamples];
+    int    m_numSamples;
+    int    m_nextSample;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "gl_state.h"
+
+using namespace ci;
+
+
+GlStateCache::GlStateCache() :
+    m_defaultFramebuffer(0)
+{
+    invalidate();
+
+    for (int i = 0; i < kNumKinds; ++i)
+    {
+        m_changes[i] = m_filtered[i] = 0;
+        m_lastChanges[i] = m_lastFiltered[i] = 0;
+    }
+}
+
+bool GlStateCache::bindTexture(GLenum target, GLuint texture)
+{
+    bool changed = !m_textureValid ||
+                   target != m_textureTarget ||
+                   texture != m_texture;
+
+    if (changed)
+    {
+        if (m_textureValid && m_textureTarget != target)
+        {
+            glDisable(m_textureTarget);
+        }
+
+        if (texture)
+        {
+            glEnable(target);
+            glBindTexture(target, texture);
+        }
+        else
+        {
+            glBindTexture(target, 0);
+            glDisable(target);
+        }
+
+        m_textureTarget = target;
+        m_texture = texture;
+        m_textureValid = true;
+    }
+
+    count(kTexture, changed);
+    return changed;
+}
+
+bool GlStateCache::useProgram(GLuint program)
+{
+    bool changed = !m_programValid || program != m_program;
+
+    if (changed)
+    {
+        glUseProgram(program);
+        m_program = program;
+        m_programValid = true;
+    }
+
+    count(kProgram, changed);
+    return changed;
+}
+
+bool GlStateCache::setBlend(int mode)
+{
+    bool changed = !m_blendValid || mode != m_blend;
+
+    if (changed)
+    {
+        switch (mode)
+        {
+            case 0:
+                gl::enableAlphaBlending();
+                break;
+            case 1:
+                gl::enableAdditiveBlending();
+                break;
+        }
+        m_blend = mode;
+        m_blendValid = true;
+    }
+
+    count(kBlend, changed);
+    return changed;
+}
+
+bool GlStateCache::bindFramebuffer(GLuint fbo)
+{
+    if (fbo == 0)
+    {
+        fbo = m_defaultFramebuffer;
+    }
+
+    bool changed = !m_framebufferValid || fbo != m_framebuffer;
+
+    if (changed)
+    {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+        m_framebuffer = fbo;
+        m_framebufferValid = true;
+    }
+
+    count(kFramebuffer, changed);
+    return changed;
+}
+
+void GlStateCache::invalidate()
+{
+    m_textureTarget = GL_TEXTURE_2D;
+    m_texture = 0;
+    m_textureValid = false;
+    m_program = 0;
+    m_programValid = false;
+    m_blend = 0;
+    m_blendValid = false;
+    m_framebuffer = 0;
+    m_framebufferValid = false;
+}
+
+void GlStateCache::beginFrame()
+{
+    for (int i = 0; i < kNumKinds; ++i)
+    {
+        m_changes[i] = m_filtered[i] = 0;
+    }
+}
+
+void GlStateCache::endFrame()
+{
+    for (int i = 0; i < kNumKinds; ++i)
+    {
+        m_lastChanges[i] = m_changes[i];
+        m_lastFiltered[i] = m_filtered[i];
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef orlok_gl_state_h
+#define orlok_gl_state_h
+
+/*
+Shadow copy of the bits of OpenGL state that the backend changes most often.
+Redundant changes (setting a value GL already has) are dropped before they
+reach the driver. Both real and filtered changes are counted per frame.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+
+
+class GlStateCache
+{
+public:
+    // Kinds of state tracked. Values must match the Dylan side's
+    // <render-state-kind> mapping in cinder-backend.intr.
+    enum Kind
+    {
+        kTexture = 0,
+        kProgram,
+        kBlend,
+        kFramebuffer,
+        kUniform,
+
+        kNumKinds
+    };
+
+    GlStateCache();
+
+    // Each of these returns true if GL was actually changed.
+
+    // Bind (and enable) a texture on unit 0. A texture of 0 unbinds and
+    // disables target.
+    bool bindTexture(GLenum target, GLuint texture);
+    bool useProgram(GLuint program);
+    // 0 => alpha blending, 1 => additive blending
+    bool setBlend(int mode);
+    // A framebuffer of 0 means the default one (see below).
+    bool bindFramebuffer(GLuint fbo);
+
+    // The framebuffer drawn to in place of the window's (0), eg, when
+    // frames are drawn on a render thread whose context has no window.
+    void setDefaultFramebuffer(GLuint fbo) { m_defaultFramebuffer = fbo; }
+
+    // Uniform values are cached per program (see ShaderProgram), not here;
+    // this just records whether an upload was made or skipped.
+    void countUniform(bool changed) { count(kUniform, changed); }
+
+    // Forget everything we know about GL's state, so the next change of
+    // each kind always goes through. Use after code we don't control (e.g.,
+    // cinder) may have changed state behind our back.
+    void invalidate();
+
+    // Per-frame bookkeeping.
+    void beginFrame();
+    void endFrame();
+
+    // Counts for the last complete frame.
+    int lastFrameChanges(Kind kind) const { return m_lastChanges[kind]; }
+    int lastFrameFiltered(Kind kind) const { return m_lastFiltered[kind]; }
+
+private:
+    void count(Kind kind, bool changed)
+    {
+        if (changed)
+            ++m_changes[kind];
+        else
+            ++m_filtered[kind];
+    }
+
+    GLenum  m_textureTarget;
+    GLuint  m_texture;
+    bool    m_textureValid;
+
+    GLuint  m_program;
+    bool    m_programValid;
+
+    int     m_blend;
+    bool    m_blendValid;
+
+    GLuint  m_framebuffer;
+    bool    m_framebufferValid;
+    GLuint  m_defaultFramebuffer;
+
+    int m_changes[kNumKinds];
+    int m_filtered[kNumKinds];
+    int m_lastChanges[kNumKinds];
+    int m_lastFiltered[kNumKinds];
+};
+
+#endif
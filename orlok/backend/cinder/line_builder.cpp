@@ -0,0 +1,327 @@
+#include "line_builder.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+const float k_pi = 3.14159265358979f;
+
+// Miters longer than this many half widths are drawn as bevels (as cairo
+// does by default).
+const float k_miter_limit = 10.0f;
+
+// Points closer together than this (in window units) are merged.
+const float k_min_distance = 1.0e-4f;
+
+GLubyte to_byte(float f)
+{
+    if (f <= 0.0f) return 0;
+    if (f >= 1.0f) return 255;
+    return static_cast<GLubyte>(f * 255.0f + 0.5f);
+}
+
+// Rotate 90 degrees.
+Vec2f perp(const Vec2f& v)
+{
+    return Vec2f(-v.y, v.x);
+}
+
+float cross(const Vec2f& a, const Vec2f& b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+// Number of triangles for an arc, keeping the distance between the arc and
+// its chords under a quarter pixel.
+int arc_steps(float radius, float sweep)
+{
+    if (radius <= 0.25f)
+    {
+        return 2;
+    }
+
+    float maxStep = 2.0f * std::acos(1.0f - 0.25f / radius);
+    int steps = static_cast<int>(std::ceil(std::fabs(sweep) / maxStep));
+    return std::max(2, std::min(steps, 64));
+}
+
+} // namespace
+
+
+LineBuilder::LineBuilder(QuadBatch& batch) :
+    m_batch(batch)
+{
+}
+
+void LineBuilder::addLines(int numLines, const float* points,
+                           int numWidths, const float* widths,
+                           int numColors, const float* colors,
+                           Cap cap)
+{
+    for (int i = 0; i < numLines; ++i)
+    {
+        const float* p = points + i * 4;
+        LinePoint a = makePoint(p[0], p[1], i, numWidths, widths,
+                                numColors, colors);
+        LinePoint b = makePoint(p[2], p[3], i, numWidths, widths,
+                                numColors, colors);
+
+        Vec2f d = b.pos - a.pos;
+        float len = d.length();
+
+        if (len < k_min_distance)
+        {
+            // Like cairo, a zero length line only shows up with round or
+            // square caps (as a dot).
+            addCap(a, Vec2f(1.0f, 0.0f), cap);
+            addCap(a, Vec2f(-1.0f, 0.0f), cap);
+            continue;
+        }
+
+        d /= len;
+        addSegment(a, b);
+        addCap(a, -d, cap);
+        addCap(b, d, cap);
+    }
+}
+
+void LineBuilder::addPolyline(int numPoints, const float* points,
+                              int numWidths, const float* widths,
+                              int numColors, const float* colors,
+                              Cap cap, Join join, bool closed)
+{
+    m_points.clear();
+
+    for (int i = 0; i < numPoints; ++i)
+    {
+        LinePoint p = makePoint(points[i * 2], points[i * 2 + 1], i,
+                                numWidths, widths, numColors, colors);
+
+        // Repeated points have no direction, so would break joins.
+        if (m_points.empty() ||
+            m_points.back().pos.distance(p.pos) >= k_min_distance)
+        {
+            m_points.push_back(p);
+        }
+    }
+
+    if (closed && m_points.size() > 1 &&
+        m_points.back().pos.distance(m_points.front().pos) < k_min_distance)
+    {
+        m_points.pop_back();
+    }
+
+    const int n = static_cast<int>(m_points.size());
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    if (n == 1)
+    {
+        addCap(m_points[0], Vec2f(1.0f, 0.0f), cap);
+        addCap(m_points[0], Vec2f(-1.0f, 0.0f), cap);
+        return;
+    }
+
+    if (closed && n == 2)
+    {
+        closed = false;
+    }
+
+    const int numSegments = closed ? n : n - 1;
+    for (int i = 0; i < numSegments; ++i)
+    {
+        addSegment(m_points[i], m_points[(i + 1) % n]);
+    }
+
+    const int firstJoin = closed ? 0 : 1;
+    const int lastJoin = closed ? n - 1 : n - 2;
+    for (int i = firstJoin; i <= lastJoin; ++i)
+    {
+        addJoin(m_points[(i + n - 1) % n], m_points[i], m_points[(i + 1) % n],
+                join);
+    }
+
+    if (!closed)
+    {
+        Vec2f startDir = (m_points[0].pos - m_points[1].pos).normalized();
+        Vec2f endDir = (m_points[n - 1].pos - m_points[n - 2].pos).normalized();
+        addCap(m_points[0], startDir, cap);
+        addCap(m_points[n - 1], endDir, cap);
+    }
+}
+
+LineBuilder::LinePoint LineBuilder::makePoint(float x, float y, int index,
+                                              int numWidths,
+                                              const float* widths,
+                                              int numColors,
+                                              const float* colors) const
+{
+    LinePoint p;
+    m_batch.transform().transform(x, y, &p.pos.x, &p.pos.y);
+
+    float width = 1.0f;
+    if (numWidths > 0)
+    {
+        width = widths[std::min(index, numWidths - 1)];
+    }
+    p.halfWidth = width * 0.5f;
+
+    if (numColors > 0)
+    {
+        const float* c = colors + std::min(index, numColors - 1) * 4;
+        for (int i = 0; i < 4; ++i)
+        {
+            p.color[i] = to_byte(c[i]);
+        }
+    }
+    else
+    {
+        const GLubyte* c = m_batch.color();
+        for (int i = 0; i < 4; ++i)
+        {
+            p.color[i] = c[i];
+        }
+    }
+
+    return p;
+}
+
+void LineBuilder::addSegment(const LinePoint& a, const LinePoint& b)
+{
+    Vec2f n = perp((b.pos - a.pos).normalized());
+
+    Vec2f corners[4] = {
+        a.pos + n * a.halfWidth,
+        b.pos + n * b.halfWidth,
+        b.pos - n * b.halfWidth,
+        a.pos - n * a.halfWidth
+    };
+    const GLubyte* colors[4] = { a.color, b.color, b.color, a.color };
+
+    m_batch.addWindowQuad(corners, colors);
+}
+
+void LineBuilder::addCap(const LinePoint& p, const Vec2f& dir, Cap cap)
+{
+    const float hw = p.halfWidth;
+    Vec2f n = perp(dir);
+
+    switch (cap)
+    {
+        case kCapSquare:
+        {
+            Vec2f out = dir * hw;
+            Vec2f corners[4] = {
+                p.pos + n * hw,
+                p.pos + out + n * hw,
+                p.pos + out - n * hw,
+                p.pos - n * hw
+            };
+            const GLubyte* colors[4] = { p.color, p.color, p.color, p.color };
+            m_batch.addWindowQuad(corners, colors);
+            break;
+        }
+        case kCapRound:
+            // Half a circle, from one side of the line around through dir
+            // to the other.
+            addFan(p, std::atan2(n.y, n.x), -k_pi);
+            break;
+        default: // butt
+            break;
+    }
+}
+
+void LineBuilder::addJoin(const LinePoint& prev, const LinePoint& p,
+                          const LinePoint& next, Join join)
+{
+    Vec2f d0 = (p.pos - prev.pos).normalized();
+    Vec2f d1 = (next.pos - p.pos).normalized();
+    float turn = cross(d0, d1);
+
+    if (std::fabs(turn) < 1.0e-6f && d0.dot(d1) > 0.0f)
+    {
+        return; // straight on: the segments already meet
+    }
+
+    // The segments' quads overlap on the inside of the turn, so only the gap
+    // on the outside needs filling.
+    const float side = turn > 0.0f ? -1.0f : 1.0f;
+    const float hw = p.halfWidth;
+    Vec2f n0 = perp(d0) * side;
+    Vec2f n1 = perp(d1) * side;
+    Vec2f a = p.pos + n0 * hw;
+    Vec2f b = p.pos + n1 * hw;
+
+    if (join == kJoinRound)
+    {
+        float sweep = std::acos(std::max(-1.0f, std::min(1.0f, n0.dot(n1))));
+        addFan(p, std::atan2(n0.y, n0.x), turn > 0.0f ? sweep : -sweep);
+        return;
+    }
+
+    if (join == kJoinMiter)
+    {
+        Vec2f m = n0 + n1;
+        float mLen = m.length();
+
+        if (mLen > 1.0e-6f)
+        {
+            m /= mLen;
+            // Length of the miter relative to the half width.
+            float scale = 1.0f / m.dot(n0);
+
+            if (scale <= k_miter_limit)
+            {
+                Vec2f corners[4] = { p.pos, a, p.pos + m * (hw * scale), b };
+                const GLubyte* colors[4] = { p.color, p.color,
+                                             p.color, p.color };
+                m_batch.addWindowQuad(corners, colors);
+                return;
+            }
+        }
+    }
+
+    // Bevel (or a miter that is too long).
+    addTriangle(p.pos, a, b, p.color);
+}
+
+void LineBuilder::addFan(const LinePoint& p, float startAngle, float sweep)
+{
+    const float r = p.halfWidth;
+    const int steps = arc_steps(r, sweep);
+    const float step = sweep / steps;
+
+    Vec2f prev = p.pos + Vec2f(std::cos(startAngle), std::sin(startAngle)) * r;
+
+    // Each quad (center, p0, p1, p2) covers two triangles of the fan.
+    for (int k = 1; k <= steps; k += 2)
+    {
+        float a1 = startAngle + step * k;
+        Vec2f p1 = p.pos + Vec2f(std::cos(a1), std::sin(a1)) * r;
+        Vec2f p2 = p1;
+
+        if (k + 1 <= steps)
+        {
+            float a2 = startAngle + step * (k + 1);
+            p2 = p.pos + Vec2f(std::cos(a2), std::sin(a2)) * r;
+        }
+
+        Vec2f corners[4] = { p.pos, prev, p1, p2 };
+        const GLubyte* colors[4] = { p.color, p.color, p.color, p.color };
+        m_batch.addWindowQuad(corners, colors);
+
+        prev = p2;
+    }
+}
+
+void LineBuilder::addTriangle(const Vec2f& a, const Vec2f& b, const Vec2f& c,
+                              const GLubyte* color)
+{
+    Vec2f corners[4] = { a, b, c, c };
+    const GLubyte* colors[4] = { color, color, color, color };
+    m_batch.addWindowQuad(corners, colors);
+}
@@ -0,0 +1,90 @@
+#ifndef orlok_line_builder_h
+#define orlok_line_builder_h
+
+/*
+Expands thick lines and polylines (with joins and caps) into quads on the
+CPU and appends them to a QuadBatch, so that any number of lines can be
+drawn with a single call (and batched with everything else), rather than
+relying on glLineWidth.
+
+Points are transformed by the batch's current transform, but widths are in
+window (ie, logical) units regardless of the transform, like
+QuadBatch::addLine.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "quad_batch.h"
+#include <vector>
+
+
+class LineBuilder
+{
+public:
+    // Values match the Dylan side's <line-cap> and <line-join> mappings (and
+    // cairo's).
+    enum Cap
+    {
+        kCapButt = 0,
+        kCapRound,
+        kCapSquare
+    };
+
+    enum Join
+    {
+        kJoinMiter = 0,
+        kJoinRound,
+        kJoinBevel
+    };
+
+    explicit LineBuilder(QuadBatch& batch);
+
+    // In both of the following, widths and colors (rgba, 4 floats each) are
+    // given either once for everything (numWidths/numColors of 1), once per
+    // line or point, or not at all (0), in which case the width is 1 and the
+    // batch's current color is used.
+
+    // Add numLines independent lines. points holds x1, y1, x2, y2 for each.
+    void addLines(int numLines, const float* points,
+                  int numWidths, const float* widths,
+                  int numColors, const float* colors,
+                  Cap cap);
+
+    // Add a connected line through numPoints points (x, y for each). Width
+    // and color are interpolated along each segment. If closed, the last
+    // point is joined back to the first and there are no caps.
+    void addPolyline(int numPoints, const float* points,
+                     int numWidths, const float* widths,
+                     int numColors, const float* colors,
+                     Cap cap, Join join, bool closed);
+
+private:
+    struct LinePoint
+    {
+        Vec2f   pos;       // transformed
+        float   halfWidth;
+        GLubyte color[4];
+    };
+
+    LinePoint makePoint(float x, float y, int index,
+                        int numWidths, const float* widths,
+                        int numColors, const float* colors) const;
+
+    void addSegment(const LinePoint& a, const LinePoint& b);
+    // dir is the (unit) direction the line leaves p in.
+    void addCap(const LinePoint& p, const Vec2f& dir, Cap cap);
+    void addJoin(const LinePoint& prev, const LinePoint& p,
+                 const LinePoint& next, Join join);
+    // A fan of triangles around p, of radius p.halfWidth, sweeping through
+    // sweep radians (positive or negative) from startAngle.
+    void addFan(const LinePoint& p, float startAngle, float sweep);
+    // A single triangle (as a quad with a repeated corner).
+    void addTriangle(const Vec2f& a, const Vec2f& b, const Vec2f& c,
+                     const GLubyte* color);
+
+    QuadBatch& m_batch;
+
+    std::vector<LinePoint> m_points; // scratch space for addPolyline
+};
+
+#endif
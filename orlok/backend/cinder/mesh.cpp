@@ -0,0 +1,153 @@
+#include "mesh.h"
+#include <algorithm>
+#include <cstddef>
+
+namespace
+{
+
+GLubyte to_byte(float f)
+{
+    if (f <= 0.0f) return 0;
+    if (f >= 1.0f) return 255;
+    return static_cast<GLubyte>(f * 255.0f + 0.5f);
+}
+
+} // namespace
+
+
+Mesh::Mesh(int numVertices, const float* vertices,
+           int numIndices, const int* indices) :
+    m_vbo(0),
+    m_ibo(0),
+    m_numVertices(std::max(numVertices, 0)),
+    m_numIndices(std::max(numIndices, 0))
+{
+    convert(m_numVertices, vertices);
+
+    // Meshes are meant to be drawn many times for each update.
+    glGenBuffers(1, &m_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferData(GL_ARRAY_BUFFER, m_numVertices * sizeof(BatchVertex),
+                 m_scratch.empty() ? 0 : &m_scratch[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Most meshes are never updated, so don't hang on to a copy.
+    std::vector<BatchVertex>().swap(m_scratch);
+
+    std::vector<GLuint> glIndices(indices, indices + m_numIndices);
+
+    glGenBuffers(1, &m_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_numIndices * sizeof(GLuint),
+                 glIndices.empty() ? 0 : &glIndices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+Mesh::~Mesh()
+{
+    glDeleteBuffers(1, &m_vbo);
+    glDeleteBuffers(1, &m_ibo);
+}
+
+bool Mesh::updateVertices(int first, int count, const float* vertices)
+{
+    if (first < 0 || count < 0 || first + count > m_numVertices)
+    {
+        return false;
+    }
+    if (count == 0)
+    {
+        return true;
+    }
+
+    convert(count, vertices);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(BatchVertex),
+                    count * sizeof(BatchVertex), &m_scratch[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void Mesh::draw(QuadBatch& batch, float uOffset, float vOffset,
+                float uScale, float vScale)
+{
+    if (m_numIndices == 0)
+    {
+        return;
+    }
+
+    // Whatever is already batched has to be drawn first, to keep the order.
+    batch.flush();
+    batch.applyState(batch.key());
+
+    // Affine2 as a column-major 4x4 matrix, applied before the projection.
+    const Affine2& t = batch.transform();
+    const GLfloat transform[16] = { t.sx,  t.shy, 0, 0,
+                                    t.shx, t.sy,  0, 0,
+                                    0,     0,     1, 0,
+                                    t.tx,  t.ty,  0, 1 };
+    const GLfloat texTransform[16] = { uScale,  0,       0, 0,
+                                       0,       vScale,  0, 0,
+                                       0,       0,       1, 0,
+                                       uOffset, vOffset, 0, 1 };
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glMultMatrixf(transform);
+    glMatrixMode(GL_TEXTURE);
+    glPushMatrix();
+    glLoadMatrixf(texTransform);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+
+    const GLsizei stride = sizeof(BatchVertex);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, stride,
+                    reinterpret_cast<GLvoid*>(offsetof(BatchVertex, x)));
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, stride,
+                      reinterpret_cast<GLvoid*>(offsetof(BatchVertex, u)));
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(4, GL_UNSIGNED_BYTE, stride,
+                   reinterpret_cast<GLvoid*>(offsetof(BatchVertex, r)));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, 0);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    // As QuadBatch::flush, leave buffers unbound for cinder.
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+
+    // Two triangles to a quad, for the frame stats.
+    batch.countDraw(m_numIndices / 6);
+}
+
+void Mesh::convert(int count, const float* vertices)
+{
+    m_scratch.resize(count);
+
+    for (int i = 0; i < count; ++i)
+    {
+        const float* f = vertices + i * kVertexFloats;
+        BatchVertex& v = m_scratch[i];
+        v.x = f[0];
+        v.y = f[1];
+        v.u = f[2];
+        v.v = f[3];
+        v.r = to_byte(f[4]);
+        v.g = to_byte(f[5]);
+        v.b = to_byte(f[6]);
+        v.a = to_byte(f[7]);
+    }
+}
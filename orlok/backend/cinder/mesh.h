@@ -0,0 +1,63 @@
+#ifndef orlok_mesh_h
+#define orlok_mesh_h
+
+/*
+Geometry kept in GL buffers between frames, for things that never (or
+rarely) change, like a level's layout or a static background. Unlike quads
+added to a QuadBatch, nothing is transformed or uploaded per frame: drawing
+a mesh is a single draw call.
+
+A mesh is a list of triangles, given as indices into its vertices, which
+use the batch's vertex format (position, texture coordinates and color).
+It is drawn with the batch's current texture, program and blend mode. The
+batch's current transform is applied on the GPU (by multiplying it into the
+projection for the draw), so the same mesh can be drawn anywhere.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "quad_batch.h"
+#include <vector>
+
+
+class Mesh
+{
+public:
+    // Floats per vertex, as passed in: x, y, u, v, r, g, b, a.
+    static const int kVertexFloats = 8;
+
+    // Requires a current GL context. vertices holds numVertices *
+    // kVertexFloats floats. Indices must all be below numVertices.
+    Mesh(int numVertices, const float* vertices,
+         int numIndices, const int* indices);
+    // Frees the buffers. Requires a current GL context.
+    ~Mesh();
+
+    int numVertices() const { return m_numVertices; }
+    int numIndices() const { return m_numIndices; }
+
+    // Replace count vertices starting at first. Returns false (changing
+    // nothing) if they aren't all within the mesh.
+    bool updateVertices(int first, int count, const float* vertices);
+
+    // Draw the mesh with batch's current state, first flushing anything
+    // already batched. Texture coordinates are mapped by u = uOffset + u *
+    // uScale (and likewise for v), eg, for atlas textures, through
+    // gl_TextureMatrix[0]. (A custom program's uvTransform uniform is set
+    // by the caller, through the program's uniform cache.)
+    void draw(QuadBatch& batch, float uOffset, float vOffset,
+              float uScale, float vScale);
+
+private:
+    // Convert vertices into m_scratch.
+    void convert(int count, const float* vertices);
+
+    GLuint m_vbo;
+    GLuint m_ibo;
+    int    m_numVertices;
+    int    m_numIndices;
+
+    std::vector<BatchVertex> m_scratch;
+};
+
+#endif
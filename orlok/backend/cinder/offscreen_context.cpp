@@ -0,0 +1,151 @@
+#include "offscreen_context.h"
+#include "cinder/ip/Flip.h"
+
+OffscreenContext::OffscreenContext() :
+    m_width(0),
+    m_height(0),
+    m_context(0),
+    m_pbuffer(0),
+    m_software(false)
+{
+}
+
+OffscreenContext::~OffscreenContext()
+{
+    destroy();
+}
+
+bool OffscreenContext::create(int width, int height, const char** errorMsg)
+{
+    destroy();
+
+    m_width = width;
+    m_height = height;
+
+    if (!createPBuffer() && !createSoftware())
+    {
+        *errorMsg = "unable to create an offscreen OpenGL context";
+        return false;
+    }
+
+    CGLSetCurrentContext(m_context);
+    return true;
+}
+
+void OffscreenContext::destroy()
+{
+    if (m_context)
+    {
+        if (CGLGetCurrentContext() == m_context)
+        {
+            CGLSetCurrentContext(0);
+        }
+        CGLDestroyContext(m_context);
+        m_context = 0;
+    }
+
+    if (m_pbuffer)
+    {
+        CGLDestroyPBuffer(m_pbuffer);
+        m_pbuffer = 0;
+    }
+
+    m_pixels.clear();
+    m_software = false;
+}
+
+Surface8u OffscreenContext::readPixels() const
+{
+    Surface8u surface(m_width, m_height, true, SurfaceChannelOrder::RGBA);
+
+    glFinish();
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, surface.getRowBytes() / 4);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE,
+                 surface.getData());
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    // GL's rows run bottom to top.
+    ip::flipVertical(&surface);
+    return surface;
+}
+
+bool OffscreenContext::createPBuffer()
+{
+    const CGLPixelFormatAttribute attribs[] = {
+        kCGLPFAAccelerated,
+        kCGLPFAPBuffer,
+        kCGLPFAAllowOfflineRenderers, // eg, a GPU with no display attached
+        kCGLPFAColorSize, static_cast<CGLPixelFormatAttribute>(24),
+        kCGLPFAAlphaSize, static_cast<CGLPixelFormatAttribute>(8),
+        kCGLPFADepthSize, static_cast<CGLPixelFormatAttribute>(24),
+        static_cast<CGLPixelFormatAttribute>(0)
+    };
+
+    if (!createContext(attribs))
+    {
+        return false;
+    }
+
+    GLint screen = 0;
+    if (CGLCreatePBuffer(m_width, m_height, GL_TEXTURE_RECTANGLE_EXT, GL_RGBA,
+                         0, &m_pbuffer) != kCGLNoError ||
+        CGLGetVirtualScreen(m_context, &screen) != kCGLNoError ||
+        CGLSetPBuffer(m_context, m_pbuffer, 0, 0, screen) != kCGLNoError)
+    {
+        destroy();
+        return false;
+    }
+
+    return true;
+}
+
+bool OffscreenContext::createSoftware()
+{
+    const CGLPixelFormatAttribute attribs[] = {
+        kCGLPFAOffScreen,
+        kCGLPFAColorSize, static_cast<CGLPixelFormatAttribute>(32),
+        kCGLPFAAlphaSize, static_cast<CGLPixelFormatAttribute>(8),
+        kCGLPFADepthSize, static_cast<CGLPixelFormatAttribute>(24),
+        static_cast<CGLPixelFormatAttribute>(0)
+    };
+
+    if (!createContext(attribs))
+    {
+        return false;
+    }
+
+    m_pixels.resize(m_width * m_height * 4);
+    if (CGLSetOffScreen(m_context, m_width, m_height, m_width * 4,
+                        &m_pixels[0]) != kCGLNoError)
+    {
+        destroy();
+        return false;
+    }
+
+    m_software = true;
+    return true;
+}
+
+bool OffscreenContext::createContext(const CGLPixelFormatAttribute* attribs)
+{
+    CGLPixelFormatObj format = 0;
+    GLint numFormats = 0;
+
+    if (CGLChoosePixelFormat(attribs, &format, &numFormats) != kCGLNoError ||
+        !format)
+    {
+        return false;
+    }
+
+    CGLError err = CGLCreateContext(format, 0, &m_context);
+    CGLDestroyPixelFormat(format);
+
+    if (err != kCGLNoError)
+    {
+        m_context = 0;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef orlok_offscreen_context_h
+#define orlok_offscreen_context_h
+
+/*
+An OpenGL context with no window, for running headless (eg, benchmarks on
+a build machine with no display). The context draws into a pbuffer on the
+graphics card if there is one, or else into memory through Apple's software
+renderer. Either way framebuffer 0 is the offscreen target, so everything
+that normally draws to the window works unchanged. There is no swap, and so
+no waiting for vsync.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/Surface.h"
+#include <OpenGL/OpenGL.h>
+#include <vector>
+
+using namespace ci;
+
+
+class OffscreenContext
+{
+public:
+    OffscreenContext();
+    ~OffscreenContext();
+
+    // Create the context and make it current. Returns false (and sets
+    // errorMsg) if neither renderer is available.
+    bool create(int width, int height, const char** errorMsg);
+    void destroy();
+
+    // True if drawing with the software renderer.
+    bool isSoftware() const { return m_software; }
+
+    // Read back the whole target (after finishing any pending drawing),
+    // the right way up.
+    Surface8u readPixels() const;
+
+private:
+    bool createPBuffer();
+    bool createSoftware();
+    // Returns false if no pixel format matches.
+    bool createContext(const CGLPixelFormatAttribute* attribs);
+
+    int                  m_width;
+    int                  m_height;
+    CGLContextObj        m_context;
+    CGLPBufferObj        m_pbuffer;
+    bool                 m_software;
+    std::vector<uint8_t> m_pixels; // the software renderer's target
+};
+
+#endif
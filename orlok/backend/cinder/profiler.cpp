@@ -0,0 +1,384 @@
+#include "profiler.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+
+const char* k_builtin_scope_names[Profiler::kNumBuiltinScopes] = {
+    "update",
+    "draw",
+    "key down",
+    "key up",
+    "mouse down",
+    "mouse up",
+    "mouse move",
+    "resize"
+};
+
+const char* k_counter_names[Profiler::kNumCounters] = {
+    "draw calls",
+    "quads",
+    "texture binds",
+    "shader switches",
+    "framebuffer binds",
+    "bytes uploaded"
+};
+
+// Trace timestamps are in microseconds.
+double to_micros(double seconds)
+{
+    return seconds * 1.0e6;
+}
+
+void write_json_string(std::FILE* f, const std::string& s)
+{
+    std::fputc('"', f);
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c == '"' || c == '\\')
+        {
+            std::fprintf(f, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            std::fprintf(f, "\\u%04x", c);
+        }
+        else
+        {
+            std::fputc(c, f);
+        }
+    }
+    std::fputc('"', f);
+}
+
+// Threads (rows) in the trace.
+enum
+{
+    k_tid_frames = 1,
+    k_tid_cpu,
+    k_tid_gpu
+};
+
+} // namespace
+
+
+Profiler::Profiler() :
+    m_enabled(true),
+    m_frames(kMaxFrames),
+    m_current(0),
+    m_frameNumber(0),
+    m_useQueries(false),
+    m_nextQuery(0),
+    m_queryActive(false)
+{
+    for (int i = 0; i < kNumBuiltinScopes; ++i)
+    {
+        scopeId(k_builtin_scope_names[i]);
+    }
+
+    for (int i = 0; i < kNumQueries; ++i)
+    {
+        m_queries[i].id = 0;
+        m_queries[i].frame = -1;
+    }
+
+    std::fill(m_pending, m_pending + kNumCounters, 0);
+
+    m_clock.start();
+    resetFrame(m_frames[0], 0, now());
+}
+
+void Profiler::setup()
+{
+#ifdef GL_EXT_timer_query
+    m_useQueries = gl::isExtensionAvailable("GL_EXT_timer_query") ||
+                   gl::isExtensionAvailable("GL_ARB_timer_query");
+    if (m_useQueries)
+    {
+        for (int i = 0; i < kNumQueries; ++i)
+        {
+            glGenQueries(1, &m_queries[i].id);
+            m_queries[i].frame = -1;
+        }
+    }
+#endif
+}
+
+void Profiler::cleanup()
+{
+#ifdef GL_EXT_timer_query
+    if (m_useQueries)
+    {
+        if (m_queryActive)
+        {
+            glEndQuery(GL_TIME_ELAPSED_EXT);
+            m_queryActive = false;
+        }
+        for (int i = 0; i < kNumQueries; ++i)
+        {
+            glDeleteQueries(1, &m_queries[i].id);
+            m_queries[i].id = 0;
+            m_queries[i].frame = -1;
+        }
+    }
+#endif
+    m_useQueries = false;
+}
+
+int Profiler::scopeId(const std::string& name)
+{
+    std::map<std::string, int>::const_iterator it = m_ids.find(name);
+    if (it != m_ids.end())
+    {
+        return it->second;
+    }
+
+    int id = static_cast<int>(m_names.size());
+    m_names.push_back(name);
+    m_ids[name] = id;
+    return id;
+}
+
+void Profiler::beginScope(int id)
+{
+    Frame& f = m_frames[m_current];
+
+    // Unrecorded scopes are still pushed, so begins and ends keep matching.
+    if (!m_enabled || static_cast<int>(f.scopes.size()) >= kMaxScopesPerFrame)
+    {
+        m_openScopes.push_back(-1);
+        return;
+    }
+
+    Scope s;
+    s.id = id;
+    s.depth = static_cast<int>(m_openScopes.size());
+    s.start = now();
+    s.end = s.start;
+
+    m_openScopes.push_back(static_cast<int>(f.scopes.size()));
+    f.scopes.push_back(s);
+}
+
+void Profiler::endScope()
+{
+    if (m_openScopes.empty())
+    {
+        return; // unbalanced, or closed at the end of the frame
+    }
+
+    int index = m_openScopes.back();
+    m_openScopes.pop_back();
+
+    if (index >= 0)
+    {
+        Frame& f = m_frames[m_current];
+        Scope& s = f.scopes[index];
+        s.end = now();
+        if (s.depth == 0)
+        {
+            f.cpuTime += s.end - s.start;
+        }
+    }
+}
+
+void Profiler::beginGpuFrame()
+{
+#ifdef GL_EXT_timer_query
+    if (!m_useQueries || !m_enabled || m_queryActive)
+    {
+        return;
+    }
+
+    // If this query's last result still hasn't arrived, give up on it
+    // rather than wait (beginning the query again discards it).
+    Query& q = m_queries[m_nextQuery];
+    q.frame = -1;
+
+    glBeginQuery(GL_TIME_ELAPSED_EXT, q.id);
+    m_queryActive = true;
+#endif
+}
+
+void Profiler::endGpuFrame()
+{
+#ifdef GL_EXT_timer_query
+    if (!m_queryActive)
+    {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+    m_queries[m_nextQuery].frame = m_frameNumber;
+    m_nextQuery = (m_nextQuery + 1) % kNumQueries;
+    m_queryActive = false;
+#endif
+}
+
+void Profiler::addCounterFromAnyThread(Counter counter, int amount)
+{
+    boost::lock_guard<boost::mutex> lock(m_pendingMutex);
+    m_pending[counter] += amount;
+}
+
+void Profiler::endFrame()
+{
+    const double t = now();
+    Frame& f = m_frames[m_current];
+
+    while (!m_openScopes.empty())
+    {
+        endScope();
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_pendingMutex);
+        for (int i = 0; i < kNumCounters; ++i)
+        {
+            f.counters[i] += m_pending[i];
+            m_pending[i] = 0;
+        }
+    }
+
+    f.end = t;
+
+    collectQueries();
+
+    m_current = (m_current + 1) % kMaxFrames;
+    ++m_frameNumber;
+    resetFrame(m_frames[m_current], m_frameNumber, t);
+}
+
+int Profiler::numFrames() const
+{
+    // The current (incomplete) frame takes up one slot of the ring.
+    return std::min(m_frameNumber, kMaxFrames - 1);
+}
+
+const Profiler::Frame& Profiler::frame(int age) const
+{
+    return m_frames[(m_current - 1 - age + 2 * kMaxFrames) % kMaxFrames];
+}
+
+bool Profiler::writeTrace(const char* path) const
+{
+    std::FILE* f = std::fopen(path, "w");
+    if (!f)
+    {
+        return false;
+    }
+
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    const char* threadNames[] = { "frames", "CPU", "GPU" };
+    for (int tid = k_tid_frames; tid <= k_tid_gpu; ++tid)
+    {
+        std::fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                        "\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                     tid, threadNames[tid - k_tid_frames]);
+    }
+
+    for (int age = numFrames() - 1; age >= 0; --age)
+    {
+        const Frame& fr = frame(age);
+
+        std::fprintf(f, "{\"name\":\"frame %d\",\"ph\":\"X\",\"pid\":1,"
+                        "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+                     fr.number, k_tid_frames, to_micros(fr.start),
+                     to_micros(fr.end - fr.start));
+
+        // The GPU time is drawn from the start of the frame's drawing, but
+        // only its length is known.
+        double gpuStart = fr.start;
+
+        for (size_t i = 0; i < fr.scopes.size(); ++i)
+        {
+            const Scope& s = fr.scopes[i];
+            if (s.id == kScopeDraw && s.depth == 0)
+            {
+                gpuStart = s.start;
+            }
+
+            std::fprintf(f, "{\"name\":");
+            write_json_string(f, m_names[s.id]);
+            std::fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                            "\"ts\":%.3f,\"dur\":%.3f},\n",
+                         k_tid_cpu, to_micros(s.start),
+                         to_micros(s.end - s.start));
+        }
+
+        if (fr.gpuTime >= 0.0)
+        {
+            std::fprintf(f, "{\"name\":\"gpu\",\"ph\":\"X\",\"pid\":1,"
+                            "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+                         k_tid_gpu, to_micros(gpuStart),
+                         to_micros(fr.gpuTime));
+        }
+
+        std::fprintf(f, "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,"
+                        "\"ts\":%.3f,\"args\":{", to_micros(fr.start));
+        for (int c = 0; c < kNumCounters; ++c)
+        {
+            std::fprintf(f, "%s\"%s\":%d", c ? "," : "", k_counter_names[c],
+                         fr.counters[c]);
+        }
+        std::fprintf(f, "}},\n");
+    }
+
+    // A final event, so every other one can end with a comma.
+    std::fprintf(f, "{\"name\":\"end\",\"ph\":\"i\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"s\":\"g\"}\n]}\n",
+                 k_tid_frames, to_micros(now()));
+
+    bool ok = !std::ferror(f);
+    return std::fclose(f) == 0 && ok;
+}
+
+void Profiler::resetFrame(Frame& f, int number, double start)
+{
+    f.number = number;
+    f.start = start;
+    f.end = start;
+    f.cpuTime = 0.0;
+    f.gpuTime = -1.0;
+    for (int i = 0; i < kNumCounters; ++i)
+    {
+        f.counters[i] = 0;
+    }
+    // Keeps its capacity, so steady state recording doesn't allocate.
+    f.scopes.clear();
+}
+
+void Profiler::collectQueries()
+{
+#ifdef GL_EXT_timer_query
+    for (int i = 0; i < kNumQueries; ++i)
+    {
+        Query& q = m_queries[i];
+        if (q.frame < 0)
+        {
+            continue;
+        }
+
+        GLint available = 0;
+        glGetQueryObjectiv(q.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            continue;
+        }
+
+        GLuint64EXT nanos = 0;
+        glGetQueryObjectui64vEXT(q.id, GL_QUERY_RESULT, &nanos);
+
+        // The frame might have dropped out of the ring already.
+        Frame& f = m_frames[q.frame % kMaxFrames];
+        if (f.number == q.frame)
+        {
+            f.gpuTime = static_cast<double>(nanos) * 1.0e-9;
+        }
+        q.frame = -1;
+    }
+#endif
+}
@@ -0,0 +1,167 @@
+#ifndef orlok_profiler_h
+#define orlok_profiler_h
+
+/*
+Per-frame instrumentation: CPU time in named (nestable) scopes, per-frame
+counters, and GPU time for each frame from asynchronous timer queries. The
+last kMaxFrames frames are kept in a ring, and can be queried or written out
+in Chrome's trace event format (load the file in chrome://tracing).
+
+A frame runs from the end of the previous one to the end of the current
+draw, so input events handled between frames count towards the next one.
+
+GPU timer queries can't be nested, so GPU time is only measured for the
+whole of each frame's drawing. Results arrive a few frames late (we never
+wait for them); a frame whose result hasn't arrived yet, or never will (no
+timer query support), has a GPU time of -1.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/Timer.h"
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace ci;
+
+
+class Profiler
+{
+public:
+    // Values match the Dylan side's <frame-profile> counter mapping.
+    enum Counter
+    {
+        kCounterDrawCalls = 0,
+        kCounterQuads,
+        kCounterTextureBinds,
+        kCounterShaderSwitches,
+        kCounterFramebufferBinds,
+        kCounterBytesUploaded,
+
+        kNumCounters
+    };
+
+    // Ids of the scopes the backend itself records.
+    enum BuiltinScope
+    {
+        kScopeUpdate = 0,
+        kScopeDraw,
+        kScopeKeyDown,
+        kScopeKeyUp,
+        kScopeMouseDown,
+        kScopeMouseUp,
+        kScopeMouseMove,
+        kScopeResize,
+
+        kNumBuiltinScopes
+    };
+
+    static const int kMaxFrames = 240;
+    // Scopes beyond this many in one frame are not recorded.
+    static const int kMaxScopesPerFrame = 1024;
+
+    struct Scope
+    {
+        int    id;
+        int    depth;
+        double start, end; // seconds since the profiler was created
+    };
+
+    struct Frame
+    {
+        int                number;
+        double             start, end;
+        double             cpuTime; // total of the top level scopes
+        double             gpuTime; // -1 if unknown
+        int                counters[kNumCounters];
+        std::vector<Scope> scopes;
+    };
+
+    Profiler();
+
+    // Create (and delete) the timer queries. Require a current GL context.
+    void setup();
+    void cleanup();
+
+    // While disabled, scopes and GPU time are not recorded (frame times and
+    // counters still are).
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+
+    // Id for a scope name, registering it the first time it's seen.
+    int scopeId(const std::string& name);
+    const std::string& scopeName(int id) const { return m_names[id]; }
+
+    void beginScope(int id);
+    void endScope();
+
+    void addCounter(Counter counter, int amount)
+    {
+        m_frames[m_current].counters[counter] += amount;
+    }
+    void setCounter(Counter counter, int value)
+    {
+        m_frames[m_current].counters[counter] = value;
+    }
+    // As addCounter, but safe to call from any thread (eg, the render
+    // thread, while the main thread records the frame). Amounts are held
+    // until endFrame, then added to the frame it ends.
+    void addCounterFromAnyThread(Counter counter, int amount);
+
+    // Bracket the frame's GL work.
+    void beginGpuFrame();
+    void endGpuFrame();
+
+    // Close the current frame (and any scopes left open in it) and start
+    // the next.
+    void endFrame();
+
+    // Number of complete frames available, and one of them by age (0 is the
+    // most recent).
+    int numFrames() const;
+    const Frame& frame(int age) const;
+
+    // Write the available frames as a Chrome trace. Returns false if the
+    // file can't be written.
+    bool writeTrace(const char* path) const;
+
+private:
+    struct Query
+    {
+        GLuint id;
+        int    frame; // number of the frame it measures (-1 if none)
+    };
+
+    static const int kNumQueries = 4;
+
+    double now() const { return m_clock.getSeconds(); }
+    void resetFrame(Frame& f, int number, double start);
+    // Record the results of any queries that have finished.
+    void collectQueries();
+
+    Timer                      m_clock;
+    bool                       m_enabled;
+
+    std::vector<std::string>   m_names;
+    std::map<std::string, int> m_ids;
+
+    std::vector<Frame>         m_frames; // ring of kMaxFrames
+    int                        m_current;
+    int                        m_frameNumber;
+    // Indices into the current frame's scopes (-1 for a scope not recorded).
+    std::vector<int>           m_openScopes;
+
+    // Added by addCounterFromAnyThread since the last endFrame.
+    boost::mutex               m_pendingMutex;
+    int                        m_pending[kNumCounters];
+
+    bool                       m_useQueries;
+    Query                      m_queries[kNumQueries];
+    int                        m_nextQuery;
+    bool                       m_queryActive;
+};
+
+#endif
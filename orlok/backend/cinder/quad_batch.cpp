@@ -0,0 +1,382 @@
+#include "quad_batch.h"
+#include <cmath>
+#include <cstddef>
+
+namespace
+{
+
+// Default programs. These only apply the projection (vertices are already
+// transformed) and modulate by the vertex color. The texture matrix is
+// normally the identity, but meshes use it to map texture coordinates (see
+// Mesh::draw).
+const char* const k_default_vert_shader =
+    "void main()\n"
+    "{\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+    "    gl_Position = gl_ProjectionMatrix * gl_Vertex;\n"
+    "}\n";
+
+const char* const k_default_frag_shader =
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = gl_Color;\n"
+    "}\n";
+
+const char* const k_default_textured_frag_shader =
+    "uniform sampler2D tex0;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = texture2D(tex0, gl_TexCoord[0].st) * gl_Color;\n"
+    "}\n";
+
+gl::GlslProg* create_program(const char* vert, const char* frag)
+{
+    try
+    {
+        return new gl::GlslProg(vert, frag);
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+GLubyte to_byte(float f)
+{
+    if (f <= 0.0f) return 0;
+    if (f >= 1.0f) return 255;
+    return static_cast<GLubyte>(f * 255.0f + 0.5f);
+}
+
+} // namespace
+
+
+QuadBatch::QuadBatch(GlStateCache& state) :
+    m_state(state),
+    m_numQuads(0),
+    m_vbo(0),
+    m_ibo(0),
+    m_defaultProgram(0),
+    m_defaultTexturedProgram(0),
+    m_drawCalls(0),
+    m_quads(0),
+    m_lastDrawCalls(0),
+    m_lastQuads(0)
+{
+    m_color[0] = m_color[1] = m_color[2] = m_color[3] = 255;
+}
+
+QuadBatch::~QuadBatch()
+{
+    // Note: GL resources must be released via cleanup() while the context
+    // is still current.
+}
+
+void QuadBatch::setup()
+{
+    m_vertices.resize(kMaxQuads * 4);
+
+    // The index buffer never changes: two triangles per quad.
+    std::vector<GLushort> indices(kMaxQuads * 6);
+    for (int i = 0; i < kMaxQuads; ++i)
+    {
+        GLushort base = static_cast<GLushort>(i * 4);
+        indices[i * 6 + 0] = base + 0;
+        indices[i * 6 + 1] = base + 1;
+        indices[i * 6 + 2] = base + 2;
+        indices[i * 6 + 3] = base + 0;
+        indices[i * 6 + 4] = base + 2;
+        indices[i * 6 + 5] = base + 3;
+    }
+
+    glGenBuffers(1, &m_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(BatchVertex),
+                 0, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &m_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort),
+                 &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    m_defaultProgram = create_program(k_default_vert_shader,
+                                      k_default_frag_shader);
+    m_defaultTexturedProgram = create_program(k_default_vert_shader,
+                                              k_default_textured_frag_shader);
+}
+
+void QuadBatch::cleanup()
+{
+    if (m_vbo)
+    {
+        glDeleteBuffers(1, &m_vbo);
+        m_vbo = 0;
+    }
+    if (m_ibo)
+    {
+        glDeleteBuffers(1, &m_ibo);
+        m_ibo = 0;
+    }
+    delete m_defaultProgram;
+    m_defaultProgram = 0;
+    delete m_defaultTexturedProgram;
+    m_defaultTexturedProgram = 0;
+    m_numQuads = 0;
+}
+
+void QuadBatch::setTexture(gl::Texture* tex)
+{
+    if (tex)
+    {
+        m_key.texture = tex->getId();
+        m_key.textureTarget = tex->getTarget();
+    }
+    else
+    {
+        m_key.texture = 0;
+        m_key.textureTarget = GL_TEXTURE_2D;
+    }
+}
+
+void QuadBatch::setProgram(gl::GlslProg* prog)
+{
+    m_key.program = prog ? prog->getHandle() : 0;
+}
+
+void QuadBatch::setBlend(int mode)
+{
+    m_key.blend = mode;
+}
+
+void QuadBatch::setColor(float r, float g, float b, float a)
+{
+    // Color is per-vertex, so a color change never requires a flush.
+    m_color[0] = to_byte(r);
+    m_color[1] = to_byte(g);
+    m_color[2] = to_byte(b);
+    m_color[3] = to_byte(a);
+}
+
+void QuadBatch::setColor(const GLubyte rgba[4])
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        m_color[i] = rgba[i];
+    }
+}
+
+void QuadBatch::addQuad(float x1, float y1, float x2, float y2,
+                        float u1, float v1, float u2, float v2)
+{
+    addTexturedQuad(m_key.texture, m_key.textureTarget,
+                    x1, y1, x2, y2, u1, v1, u2, v2);
+}
+
+void QuadBatch::addTexturedQuad(GLuint texture, GLenum target,
+                                float x1, float y1, float x2, float y2,
+                                float u1, float v1, float u2, float v2)
+{
+    BatchKey key = m_key;
+    key.texture = texture;
+    key.textureTarget = target;
+
+    BatchVertex* v = newQuad(key);
+
+    m_transform.transform(x1, y1, &v[0].x, &v[0].y);
+    m_transform.transform(x2, y1, &v[1].x, &v[1].y);
+    m_transform.transform(x2, y2, &v[2].x, &v[2].y);
+    m_transform.transform(x1, y2, &v[3].x, &v[3].y);
+
+    v[0].u = u1; v[0].v = v1;
+    v[1].u = u2; v[1].v = v1;
+    v[2].u = u2; v[2].v = v2;
+    v[3].u = u1; v[3].v = v2;
+
+    setVertexColors(v);
+}
+
+void QuadBatch::addLine(float x1, float y1, float x2, float y2, float width)
+{
+    float ax, ay, bx, by;
+    m_transform.transform(x1, y1, &ax, &ay);
+    m_transform.transform(x2, y2, &bx, &by);
+
+    float dx = bx - ax;
+    float dy = by - ay;
+    float len = std::sqrt(dx * dx + dy * dy);
+
+    if (len == 0.0f)
+    {
+        return;
+    }
+
+    // Half-width offset perpendicular to the line.
+    float nx = -dy / len * width * 0.5f;
+    float ny =  dx / len * width * 0.5f;
+
+    BatchKey key = m_key;
+    key.texture = 0;
+    key.textureTarget = GL_TEXTURE_2D;
+
+    BatchVertex* v = newQuad(key);
+
+    v[0].x = ax + nx; v[0].y = ay + ny;
+    v[1].x = bx + nx; v[1].y = by + ny;
+    v[2].x = bx - nx; v[2].y = by - ny;
+    v[3].x = ax - nx; v[3].y = ay - ny;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        v[i].u = v[i].v = 0.0f;
+    }
+
+    setVertexColors(v);
+}
+
+void QuadBatch::addWindowQuad(const Vec2f corners[4],
+                              const GLubyte* const colors[4])
+{
+    BatchKey key = m_key;
+    key.texture = 0;
+    key.textureTarget = GL_TEXTURE_2D;
+
+    BatchVertex* v = newQuad(key);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        v[i].x = corners[i].x;
+        v[i].y = corners[i].y;
+        v[i].u = v[i].v = 0.0f;
+        v[i].r = colors[i][0];
+        v[i].g = colors[i][1];
+        v[i].b = colors[i][2];
+        v[i].a = colors[i][3];
+    }
+}
+
+BatchVertex* QuadBatch::newQuad(const BatchKey& key)
+{
+    if (m_numQuads > 0 && (key != m_batchKey || m_numQuads == kMaxQuads))
+    {
+        flush();
+    }
+
+    if (m_numQuads == 0)
+    {
+        m_batchKey = key;
+    }
+
+    return &m_vertices[m_numQuads++ * 4];
+}
+
+void QuadBatch::setVertexColors(BatchVertex* v) const
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        v[i].r = m_color[0];
+        v[i].g = m_color[1];
+        v[i].b = m_color[2];
+        v[i].a = m_color[3];
+    }
+}
+
+void QuadBatch::flush()
+{
+    if (m_numQuads == 0)
+    {
+        return;
+    }
+
+    applyKey(m_batchKey);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+
+    // Orphan the old buffer contents so we don't stall waiting for any
+    // previous draw that is still reading them.
+    glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(BatchVertex),
+                 0, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0,
+                    m_numQuads * 4 * sizeof(BatchVertex), &m_vertices[0]);
+
+    const GLsizei stride = sizeof(BatchVertex);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, stride,
+                    reinterpret_cast<GLvoid*>(offsetof(BatchVertex, x)));
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, stride,
+                      reinterpret_cast<GLvoid*>(offsetof(BatchVertex, u)));
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(4, GL_UNSIGNED_BYTE, stride,
+                   reinterpret_cast<GLvoid*>(offsetof(BatchVertex, r)));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glDrawElements(GL_TRIANGLES, m_numQuads * 6, GL_UNSIGNED_SHORT, 0);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    // Leave buffers unbound, since cinder's own drawing code uses client-side
+    // vertex arrays.
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    ++m_drawCalls;
+    m_quads += m_numQuads;
+    m_numQuads = 0;
+}
+
+void QuadBatch::flushIfUsing(GLuint program)
+{
+    if (m_numQuads > 0 && m_batchKey.program == program)
+    {
+        flush();
+    }
+}
+
+void QuadBatch::bindProgram(GLuint program)
+{
+    m_state.useProgram(program);
+}
+
+void QuadBatch::applyKey(const BatchKey& key)
+{
+    GLuint program = key.program;
+
+    if (!program)
+    {
+        gl::GlslProg* prog = 0;
+        if (!key.texture)
+        {
+            prog = m_defaultProgram;
+        }
+        else if (key.textureTarget == GL_TEXTURE_2D)
+        {
+            prog = m_defaultTexturedProgram;
+        }
+        // else (eg, rectangle textures) fall back to fixed-function.
+
+        program = prog ? prog->getHandle() : 0;
+    }
+
+    m_state.bindTexture(key.textureTarget, key.texture);
+    m_state.useProgram(program);
+    m_state.setBlend(key.blend);
+}
+
+void QuadBatch::beginFrame()
+{
+    m_drawCalls = 0;
+    m_quads = 0;
+}
+
+void QuadBatch::endFrame()
+{
+    flush();
+    m_lastDrawCalls = m_drawCalls;
+    m_lastQuads = m_quads;
+}
@@ -0,0 +1,238 @@
+#ifndef orlok_quad_batch_h
+#define orlok_quad_batch_h
+
+/*
+Batching of textured/colored quads for the OpenGL renderer.
+
+Rather than issuing one draw call per cinder_gl_draw_rect, quads are
+transformed on the CPU and appended to a streaming vertex buffer. All quads
+that share the same texture, shader program and blend mode are drawn with a
+single call when the batch is flushed.
+
+Since vertices are already transformed, the GL modelview matrix is always
+the identity: only the projection (set once per render target) is applied.
+Lines and text glyphs are drawn as quads too, so nothing ever needs the
+fixed-function matrix stack.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/gl/GlslProg.h"
+#include "gl_state.h"
+#include <vector>
+
+using namespace ci;
+
+
+// A 2D affine transform, using the same component names (and order) as
+// <affine-transform-2d>:
+//    | sx   shx  tx |
+//    | shy  sy   ty |
+struct Affine2
+{
+    float sx, shy, shx, sy, tx, ty;
+
+    Affine2() : sx(1.0f), shy(0.0f), shx(0.0f), sy(1.0f), tx(0.0f), ty(0.0f)
+    {
+    }
+
+    Affine2(float sx_, float shy_, float shx_, float sy_, float tx_, float ty_)
+        : sx(sx_), shy(shy_), shx(shx_), sy(sy_), tx(tx_), ty(ty_)
+    {
+    }
+
+    void transform(float x, float y, float* outX, float* outY) const
+    {
+        *outX = sx * x + shx * y + tx;
+        *outY = shy * x + sy * y + ty;
+    }
+
+    // The transform that applies o first, then this.
+    Affine2 operator*(const Affine2& o) const
+    {
+        return Affine2(sx * o.sx + shx * o.shy,
+                       shy * o.sx + sy * o.shy,
+                       sx * o.shx + shx * o.sy,
+                       shy * o.shx + sy * o.sy,
+                       sx * o.tx + shx * o.ty + tx,
+                       shy * o.tx + sy * o.ty + ty);
+    }
+
+    // Set *out to the transform that undoes this one. Returns false (and
+    // leaves *out alone) if there is none.
+    bool invert(Affine2* out) const
+    {
+        float det = sx * sy - shx * shy;
+        if (det == 0.0f)
+        {
+            return false;
+        }
+
+        Affine2 inv(sy / det, -shy / det, -shx / det, sx / det, 0.0f, 0.0f);
+        inv.tx = -(inv.sx * tx + inv.shx * ty);
+        inv.ty = -(inv.shy * tx + inv.sy * ty);
+        *out = inv;
+        return true;
+    }
+
+    bool operator==(const Affine2& o) const
+    {
+        return sx == o.sx && shy == o.shy && shx == o.shx &&
+               sy == o.sy && tx == o.tx && ty == o.ty;
+    }
+
+    bool operator!=(const Affine2& o) const { return !(*this == o); }
+};
+
+// Interleaved vertex format used by the batch.
+struct BatchVertex
+{
+    GLfloat x, y;
+    GLfloat u, v;
+    GLubyte r, g, b, a;
+};
+
+// The state that must match for quads to share a draw call.
+struct BatchKey
+{
+    GLuint texture;       // 0 for no texture
+    GLenum textureTarget;
+    GLuint program;       // 0 for fixed-function
+    int    blend;         // as passed to cinder_gl_set_blend
+
+    BatchKey() : texture(0), textureTarget(GL_TEXTURE_2D), program(0), blend(0)
+    {
+    }
+
+    bool operator==(const BatchKey& o) const
+    {
+        return texture == o.texture && textureTarget == o.textureTarget &&
+               program == o.program && blend == o.blend;
+    }
+
+    bool operator!=(const BatchKey& o) const { return !(*this == o); }
+};
+
+
+class QuadBatch
+{
+public:
+    // Maximum number of quads drawn by a single flush. Limited by the use of
+    // 16 bit indices.
+    static const int kMaxQuads = 4096;
+
+    // All GL state changes made by the batch go through state.
+    explicit QuadBatch(GlStateCache& state);
+    ~QuadBatch();
+
+    // Create/destroy GL resources. Both require a current GL context.
+    void setup();
+    void cleanup();
+
+    // Current state. Changes to texture, program and blend mode are not sent
+    // to GL immediately, but only when quads using them are flushed (or
+    // applyState is called). This lets sequences like bind A, draw, unbind,
+    // bind A, draw, ... end up in a single draw call.
+    void setTexture(gl::Texture* tex);
+    void setProgram(gl::GlslProg* prog);
+    void setBlend(int mode);
+    void setColor(float r, float g, float b, float a);
+    void setColor(const GLubyte rgba[4]);
+    void setTransform(const Affine2& t) { m_transform = t; }
+
+    const Affine2& transform() const { return m_transform; }
+    const GLubyte* color() const { return m_color; }
+    // The texture, program and blend mode quads would currently be drawn
+    // with.
+    const BatchKey& key() const { return m_key; }
+
+    // Append an axis-aligned (before transformation) quad with the given
+    // texture coordinates, using the current transform and color.
+    void addQuad(float x1, float y1, float x2, float y2,
+                 float u1, float v1, float u2, float v2);
+
+    // As addQuad, but using the given texture rather than the current one
+    // (eg, for font glyphs).
+    void addTexturedQuad(GLuint texture, GLenum target,
+                         float x1, float y1, float x2, float y2,
+                         float u1, float v1, float u2, float v2);
+
+    // Append an untextured line as a quad. The endpoints are transformed, but
+    // the width is in window (ie, logical) units regardless of transform,
+    // like glLineWidth.
+    void addLine(float x1, float y1, float x2, float y2, float width);
+
+    // Append an untextured quad whose corners are already transformed (eg,
+    // line geometry expanded in window units), with a color per corner.
+    // Triangles can be added by repeating the last corner.
+    void addWindowQuad(const Vec2f corners[4], const GLubyte* const colors[4]);
+
+    // Draw all pending quads.
+    void flush();
+
+    // Flush pending quads only if they are to be drawn with the given
+    // program (e.g., before changing one of its uniforms).
+    void flushIfUsing(GLuint program);
+
+    // Make program the active GL program right away, without changing the
+    // current state. Needed for setting uniforms, which applies to whatever
+    // program is bound. Callers should flushIfUsing(program) first.
+    void bindProgram(GLuint program);
+
+    // Make GL's texture, program and blend mode those of key right away.
+    void applyState(const BatchKey& key) { applyKey(key); }
+
+    // Count a draw call made on the batch's behalf (eg, of instanced
+    // sprites) in the frame stats.
+    void countDraw(int quads)
+    {
+        ++m_drawCalls;
+        m_quads += quads;
+    }
+
+    // Forget what we think GL's state is. Call after code outside the batch
+    // may have changed texture, program or blend state behind our back.
+    void invalidateState() { m_state.invalidate(); }
+
+    // Per-frame bookkeeping. endFrame flushes.
+    void beginFrame();
+    void endFrame();
+
+    int lastFrameDrawCalls() const { return m_lastDrawCalls; }
+    int lastFrameQuads() const { return m_lastQuads; }
+
+private:
+    // Return the vertices for a new quad drawn with key, flushing first if
+    // necessary.
+    BatchVertex* newQuad(const BatchKey& key);
+    void setVertexColors(BatchVertex* v) const;
+
+    void applyKey(const BatchKey& key);
+
+    GlStateCache& m_state;
+
+    std::vector<BatchVertex> m_vertices;
+    int                      m_numQuads;
+    BatchKey                 m_batchKey;   // key of the pending quads
+    BatchKey                 m_key;        // current (requested) key
+
+    Affine2 m_transform;
+    GLubyte m_color[4];
+
+    GLuint m_vbo;
+    GLuint m_ibo;
+
+    // Pass-through programs used when no shader is set (null if they failed
+    // to compile, in which case fixed-function is used).
+    gl::GlslProg* m_defaultProgram;         // untextured
+    gl::GlslProg* m_defaultTexturedProgram; // GL_TEXTURE_2D
+
+    int m_drawCalls;
+    int m_quads;
+    int m_lastDrawCalls;
+    int m_lastQuads;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "render_target_pool.h"
+#include "residency.h"
+
+namespace
+{
+
+GLint internal_format(RenderTargetPool::Format format)
+{
+    switch (format)
+    {
+        case RenderTargetPool::kFormatRGBA16F: return GL_RGBA16F_ARB;
+        default:                               return GL_RGBA8;
+    }
+}
+
+size_t bytes_per_pixel(RenderTargetPool::Format format)
+{
+    switch (format)
+    {
+        case RenderTargetPool::kFormatRGBA16F: return 8;
+        default:                               return 4;
+    }
+}
+
+} // namespace
+
+
+RenderTargetPool::RenderTargetPool(GlStateCache& state) :
+    m_state(state),
+    m_frame(0)
+{
+}
+
+gl::Fbo* RenderTargetPool::acquire(int width, int height, Format format,
+                                   bool depth, const char** errorMsg)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    if (gl::Fbo* existing = findFree(width, height, format, depth))
+    {
+        return existing;
+    }
+
+    gl::Fbo::Format fboFormat;
+    fboFormat.setColorInternalFormat(internal_format(format));
+    // A renderbuffer is enough: nothing samples the depth.
+    fboFormat.enableDepthBuffer(depth, false);
+
+    Target t;
+    try
+    {
+        t.fbo = new gl::Fbo(width, height, fboFormat);
+    }
+    catch (gl::FboExceptionInvalidSpecification& ex)
+    {
+        *errorMsg = "invalid render target specification";
+        return 0;
+    }
+    catch (...)
+    {
+        *errorMsg = "error creating render target";
+        return 0;
+    }
+
+    // Creating a framebuffer changes the framebuffer and texture bindings.
+    m_state.invalidate();
+
+    // As for cinder_gl_create_framebuffer.
+    t.fbo->getTexture().setFlipped(true);
+
+    t.width = width;
+    t.height = height;
+    t.format = format;
+    t.depth = depth;
+    t.inUse = true;
+    t.lastUsedFrame = m_frame;
+    m_targets.push_back(t);
+    memory_ledger().add(kMemoryRenderTextures, targetBytes(t));
+
+    return t.fbo;
+}
+
+gl::Fbo* RenderTargetPool::acquireExisting(int width, int height,
+                                           Format format, bool depth)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return findFree(width, height, format, depth);
+}
+
+void RenderTargetPool::release(gl::Fbo* fbo)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    for (size_t i = 0; i < m_targets.size(); ++i)
+    {
+        if (m_targets[i].fbo == fbo)
+        {
+            m_targets[i].inUse = false;
+            m_targets[i].lastUsedFrame = m_frame;
+            return;
+        }
+    }
+}
+
+void RenderTargetPool::purge()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    for (size_t i = m_targets.size(); i-- > 0; )
+    {
+        if (!m_targets[i].inUse)
+        {
+            destroy(i);
+        }
+    }
+}
+
+void RenderTargetPool::cleanup()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    for (size_t i = 0; i < m_targets.size(); ++i)
+    {
+        memory_ledger().add(kMemoryRenderTextures,
+                            -static_cast<int64_t>(targetBytes(m_targets[i])));
+        delete m_targets[i].fbo;
+    }
+    m_targets.clear();
+    m_state.invalidate();
+}
+
+void RenderTargetPool::endFrame()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    for (size_t i = m_targets.size(); i-- > 0; )
+    {
+        const Target& t = m_targets[i];
+        if (!t.inUse && m_frame - t.lastUsedFrame > kMaxIdleFrames)
+        {
+            destroy(i);
+        }
+    }
+
+    ++m_frame;
+}
+
+size_t RenderTargetPool::bytesAllocated() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    size_t total = 0;
+    for (size_t i = 0; i < m_targets.size(); ++i)
+    {
+        total += targetBytes(m_targets[i]);
+    }
+    return total;
+}
+
+size_t RenderTargetPool::bytesInUse() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    size_t total = 0;
+    for (size_t i = 0; i < m_targets.size(); ++i)
+    {
+        if (m_targets[i].inUse)
+        {
+            total += targetBytes(m_targets[i]);
+        }
+    }
+    return total;
+}
+
+int RenderTargetPool::numTargets() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return static_cast<int>(m_targets.size());
+}
+
+size_t RenderTargetPool::targetBytes(const Target& t)
+{
+    // Depth buffers are (at least) 24 bits, which in practice means 32.
+    size_t pixels = static_cast<size_t>(t.width) * t.height;
+    return pixels * (bytes_per_pixel(t.format) + (t.depth ? 4 : 0));
+}
+
+gl::Fbo* RenderTargetPool::findFree(int width, int height, Format format,
+                                    bool depth)
+{
+    for (size_t i = 0; i < m_targets.size(); ++i)
+    {
+        Target& t = m_targets[i];
+        if (!t.inUse && t.width == width && t.height == height &&
+            t.format == format && t.depth == depth)
+        {
+            t.inUse = true;
+            t.lastUsedFrame = m_frame;
+            return t.fbo;
+        }
+    }
+    return 0;
+}
+
+void RenderTargetPool::destroy(size_t index)
+{
+    memory_ledger().add(kMemoryRenderTextures,
+                        -static_cast<int64_t>(targetBytes(m_targets[index])));
+    delete m_targets[index].fbo;
+    m_targets.erase(m_targets.begin() + index);
+
+    // Deleting a framebuffer resets any binding to it (or its texture).
+    m_state.invalidate();
+}
@@ -0,0 +1,98 @@
+#ifndef orlok_render_target_pool_h
+#define orlok_render_target_pool_h
+
+/*
+A pool of framebuffers (render targets) for transient use, eg, by
+full-screen effects that need intermediate targets only while they run.
+
+Targets are matched by size, color format and whether they have a depth
+buffer. A released target is handed out again by the next matching acquire,
+so an effect that acquires and releases the same targets every frame (eg, a
+ping-pong pair) always gets the same ones back, and never causes an
+allocation after its first frame. Targets left unused for a while (eg, after
+a resize or after an effect is turned off) are freed.
+
+The pool's bookkeeping is locked, so that with a render thread (see
+RenderThread) targets can be reused and released by the recording thread
+while the render thread frees idle ones. Creating and freeing targets
+still has to happen where the GL context is current.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Fbo.h"
+#include "gl_state.h"
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+using namespace ci;
+
+
+class RenderTargetPool
+{
+public:
+    // Values match the Dylan side's <render-texture-format> mapping.
+    enum Format
+    {
+        kFormatRGBA8 = 0,
+        kFormatRGBA16F,
+
+        kNumFormats
+    };
+
+    // Targets unused for this many frames are freed.
+    static const int kMaxIdleFrames = 120;
+
+    // Framebuffer binding changes go through state.
+    explicit RenderTargetPool(GlStateCache& state);
+
+    // Return a target which is not in use, creating one if necessary. The
+    // target's contents are undefined. Returns null (and sets errorMsg) if a
+    // target can't be created.
+    gl::Fbo* acquire(int width, int height, Format format, bool depth,
+                     const char** errorMsg);
+    // As acquire, but only reuses an existing target (so needs no GL
+    // context). Returns null if there is no suitable target.
+    gl::Fbo* acquireExisting(int width, int height, Format format,
+                             bool depth);
+    // Make a target available again. It must have come from acquire.
+    void release(gl::Fbo* fbo);
+
+    // Free every target that isn't in use. Requires a current GL context
+    // (as do cleanup and endFrame).
+    void purge();
+    // Free every target, in use or not (eg, at shutdown).
+    void cleanup();
+
+    // Frees targets that have been idle too long. Call once per frame.
+    void endFrame();
+
+    // Approximate GPU memory used by all targets, and by those in use.
+    size_t bytesAllocated() const;
+    size_t bytesInUse() const;
+    int numTargets() const;
+
+private:
+    struct Target
+    {
+        gl::Fbo* fbo;
+        int      width, height;
+        Format   format;
+        bool     depth;
+        bool     inUse;
+        int      lastUsedFrame;
+    };
+
+    static size_t targetBytes(const Target& t);
+    // These require m_mutex.
+    gl::Fbo* findFree(int width, int height, Format format, bool depth);
+    void destroy(size_t index);
+
+    GlStateCache&        m_state;
+    std::vector<Target>  m_targets;
+    int                  m_frame;
+    mutable boost::mutex m_mutex;
+};
+
+#endif
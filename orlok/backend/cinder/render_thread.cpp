@@ -0,0 +1,166 @@
+#include "render_thread.h"
+#include <OpenGL/gl.h>
+#include <boost/bind.hpp>
+
+RenderThread::RenderThread() :
+    m_context(0),
+    m_replay(0),
+    m_running(false),
+    m_recording(0),
+    m_hasJob(false),
+    m_quit(false)
+{
+    m_job.commands = 0;
+    m_job.fn = 0;
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+bool RenderThread::start(CGLContextObj shareContext, ReplayFunc replay)
+{
+    if (m_running || !shareContext)
+    {
+        return false;
+    }
+
+    if (CGLCreateContext(CGLGetPixelFormat(shareContext), shareContext,
+                         &m_context) != kCGLNoError)
+    {
+        m_context = 0;
+        return false;
+    }
+
+    m_replay = replay;
+    m_quit = false;
+    m_hasJob = false;
+    m_recording = 0;
+    m_buffers[0].clear();
+    m_buffers[1].clear();
+
+    m_thread = boost::thread(boost::bind(&RenderThread::run, this));
+    // Only read by the render thread once it has a job, which happens
+    // after this.
+    m_threadId = m_thread.get_id();
+    m_running = true;
+    return true;
+}
+
+void RenderThread::stop()
+{
+    if (!m_running)
+    {
+        return;
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        if (!commands().empty())
+        {
+            Job job = { &commands(), 0 };
+            post(lock, job);
+        }
+        waitIdle(lock);
+        m_quit = true;
+        m_changed.notify_all();
+    }
+
+    m_thread.join();
+    m_running = false;
+
+    CGLDestroyContext(m_context);
+    m_context = 0;
+}
+
+bool RenderThread::onRenderThread() const
+{
+    return m_running && boost::this_thread::get_id() == m_threadId;
+}
+
+void RenderThread::submit()
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+
+    Job job = { &commands(), 0 };
+    post(lock, job);
+
+    // post waited for the other buffer to be replayed, so it's free.
+    m_recording = 1 - m_recording;
+    commands().clear();
+}
+
+void RenderThread::waitIdle()
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    waitIdle(lock);
+}
+
+void RenderThread::call(const boost::function<void ()>& fn)
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+
+    Job job = { &commands(), &fn };
+    post(lock, job);
+    waitIdle(lock);
+
+    // Carry on recording into the same (now replayed) buffer.
+    commands().clear();
+}
+
+void RenderThread::post(boost::unique_lock<boost::mutex>& lock,
+                        const Job& job)
+{
+    waitIdle(lock);
+    m_job = job;
+    m_hasJob = true;
+    m_changed.notify_all();
+}
+
+void RenderThread::waitIdle(boost::unique_lock<boost::mutex>& lock)
+{
+    while (m_hasJob)
+    {
+        m_changed.wait(lock);
+    }
+}
+
+void RenderThread::run()
+{
+    CGLSetCurrentContext(m_context);
+
+    for (;;)
+    {
+        Job job;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while (!m_hasJob && !m_quit)
+            {
+                m_changed.wait(lock);
+            }
+            if (!m_hasJob)
+            {
+                break; // quitting, with nothing left to do
+            }
+            job = m_job;
+        }
+
+        job.commands->rewind();
+        m_replay(*job.commands);
+        if (job.fn)
+        {
+            (*job.fn)();
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_hasJob = false;
+            m_changed.notify_all();
+        }
+    }
+
+    // Make sure everything replayed has reached GL before the context goes.
+    glFlush();
+    CGLSetCurrentContext(0);
+}
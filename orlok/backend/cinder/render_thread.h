@@ -0,0 +1,94 @@
+#ifndef orlok_render_thread_h
+#define orlok_render_thread_h
+
+/*
+A thread which owns an OpenGL context and replays CommandBuffers on it, so
+that the thread recording the commands (running the app's update and
+render traversal) never waits on the driver.
+
+There are two buffers: while the render thread replays one frame's
+commands, the next frame's are recorded into the other. Submitting a frame
+only waits if the render thread hasn't finished the previous one yet.
+
+Anything that needs an answer from GL right away (eg, creating a texture)
+is run on the render thread with call, which first replays whatever has
+been recorded so far (so everything still happens in order) and then waits
+for the result. That is a full synchronization, so it's best kept to load
+time rather than done every frame.
+
+The render thread's context shares objects (textures, buffers, programs)
+with the context it was started from, but has no drawable of its own, so
+frames have to be drawn into a framebuffer object and shown by the
+original context.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "command_buffer.h"
+#include <OpenGL/OpenGL.h>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+
+class RenderThread
+{
+public:
+    // Called on the render thread to replay a buffer's commands.
+    typedef void (*ReplayFunc)(CommandBuffer& commands);
+
+    RenderThread();
+    ~RenderThread();
+
+    // Start the thread, with a new context sharing objects with
+    // shareContext. Returns false if the context couldn't be created.
+    bool start(CGLContextObj shareContext, ReplayFunc replay);
+    // Replay anything still recorded, then stop the thread and free its
+    // context.
+    void stop();
+
+    bool running() const { return m_running; }
+    // True if called from the render thread itself.
+    bool onRenderThread() const;
+
+    // Where commands for the render thread are recorded.
+    CommandBuffer& commands() { return m_buffers[m_recording]; }
+
+    // Hand the recorded commands over for replay, and start recording into
+    // the other buffer.
+    void submit();
+    // Wait until everything submitted has been replayed.
+    void waitIdle();
+    // Replay everything recorded so far, then run fn on the render thread,
+    // and wait for both.
+    void call(const boost::function<void ()>& fn);
+
+private:
+    struct Job
+    {
+        CommandBuffer*                  commands;
+        const boost::function<void ()>* fn;     // 0 for none
+    };
+
+    void run();
+    // Wait for the previous job to finish, then post job. Requires
+    // m_mutex.
+    void post(boost::unique_lock<boost::mutex>& lock, const Job& job);
+    void waitIdle(boost::unique_lock<boost::mutex>& lock);
+
+    CGLContextObj m_context;
+    ReplayFunc    m_replay;
+    bool          m_running;
+
+    CommandBuffer m_buffers[2];
+    int           m_recording; // index of the buffer being recorded
+
+    boost::thread             m_thread;
+    boost::thread::id         m_threadId;
+    boost::mutex              m_mutex;
+    boost::condition_variable m_changed;
+    bool                      m_hasJob;
+    Job                       m_job;
+    bool                      m_quit;
+};
+
+#endif
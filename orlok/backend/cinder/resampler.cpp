@@ -0,0 +1,387 @@
+#include "resampler.h"
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+// Filters, as functions of the distance from a sample in source pixels. The
+// first three match cinder's FilterBox, FilterTriangle and FilterGaussian.
+
+const double kPi = 3.14159265358979323846;
+
+double filter_support(ResampleFilter filter)
+{
+    switch (filter)
+    {
+    case kResampleBox:      return 0.5;
+    case kResampleTriangle: return 1.0;
+    case kResampleGaussian: return 1.25;
+    case kResampleLanczos:  return 3.0;
+    default:                return 0.5;
+    }
+}
+
+double sinc(double x)
+{
+    if (x == 0.0)
+    {
+        return 1.0;
+    }
+    x *= kPi;
+    return std::sin(x) / x;
+}
+
+double filter_value(ResampleFilter filter, double x)
+{
+    x = std::fabs(x);
+
+    switch (filter)
+    {
+    case kResampleBox:
+        return x < 0.5 ? 1.0 : 0.0;
+    case kResampleTriangle:
+        return x < 1.0 ? 1.0 - x : 0.0;
+    case kResampleGaussian:
+        return std::exp(-2.0 * x * x) * std::sqrt(2.0 / kPi);
+    case kResampleLanczos:
+        return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    default:
+        return 0.0;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Weights
+
+// How each of dstSize output pixels is made from the srcSize input pixels
+// along one axis: output pixel i is the sum, over k < count[i], of
+// weights[i * stride + k] times input pixel first[i] + k.
+struct AxisWeights
+{
+    std::vector<int>   first;
+    std::vector<int>   count;
+    std::vector<float> weights;
+    int                stride;
+};
+
+typedef boost::shared_ptr<const AxisWeights> AxisWeightsPtr;
+
+AxisWeightsPtr compute_weights(int srcSize, int dstSize,
+                               ResampleFilter filter)
+{
+    AxisWeights* w = new AxisWeights;
+
+    // When shrinking, the filter is stretched to cover every source pixel.
+    const double scale = static_cast<double>(dstSize) / srcSize;
+    const double filterScale = std::max(1.0, 1.0 / scale);
+    const double support = filter_support(filter) * filterScale;
+
+    w->stride = static_cast<int>(std::ceil(support * 2.0)) + 2;
+    w->first.resize(dstSize);
+    w->count.resize(dstSize);
+    w->weights.assign(dstSize * w->stride, 0.0f);
+
+    std::vector<double> values(w->stride);
+
+    for (int i = 0; i < dstSize; ++i)
+    {
+        // Pixel centers are at half pixels.
+        const double center = (i + 0.5) / scale;
+        int left = std::max(0, static_cast<int>(std::floor(center - support)));
+        int right = std::min(srcSize,
+                             static_cast<int>(std::ceil(center + support)));
+        right = std::min(right, left + w->stride);
+
+        double total = 0.0;
+        for (int j = left; j < right; ++j)
+        {
+            values[j - left] = filter_value(filter,
+                                            (j + 0.5 - center) / filterScale);
+            total += values[j - left];
+        }
+
+        // Weights sum to 1, so flat areas stay flat. The box filter can
+        // miss every pixel center when enlarging; take the nearest then.
+        if (total == 0.0)
+        {
+            left = std::min(srcSize - 1, static_cast<int>(center));
+            right = left + 1;
+            values[0] = total = 1.0;
+        }
+
+        w->first[i] = left;
+        w->count[i] = right - left;
+        for (int j = 0; j < right - left; ++j)
+        {
+            w->weights[i * w->stride + j] =
+                static_cast<float>(values[j] / total);
+        }
+    }
+
+    return AxisWeightsPtr(w);
+}
+
+// Weights are kept for every size pair seen, up to a limit (past which the
+// cache starts over), since they are usually reused many times.
+class WeightCache
+{
+public:
+    AxisWeightsPtr get(int srcSize, int dstSize, ResampleFilter filter)
+    {
+        const Key key(filter, std::make_pair(srcSize, dstSize));
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        std::map<Key, AxisWeightsPtr>::const_iterator it = m_weights.find(key);
+        if (it != m_weights.end())
+        {
+            return it->second;
+        }
+
+        if (m_weights.size() >= kMaxEntries)
+        {
+            m_weights.clear();
+        }
+        AxisWeightsPtr w = compute_weights(srcSize, dstSize, filter);
+        m_weights[key] = w;
+        return w;
+    }
+
+private:
+    static const size_t kMaxEntries = 64;
+
+    typedef std::pair<int, std::pair<int, int> > Key;
+
+    boost::mutex                  m_mutex;
+    std::map<Key, AxisWeightsPtr> m_weights;
+};
+
+WeightCache& weight_cache()
+{
+    static WeightCache cache;
+    return cache;
+}
+
+//----------------------------------------------------------------------------
+// Passes
+
+struct ResampleJob
+{
+    const Surface8u* src;
+    Surface8u*       dst;
+    Area             srcArea;
+    Area             dstArea;
+    AxisWeightsPtr   xWeights;
+    AxisWeightsPtr   yWeights;
+    int              firstRow;    // first source row used (within srcArea)
+    std::vector<float> rows;      // filtered source rows, 4 floats a pixel
+    int              alphaOffset; // -1 to not clamp colors to alpha
+};
+
+// Filter source rows [begin, end) (counted from job.firstRow) horizontally
+// into job.rows.
+void horizontal_pass(ResampleJob& job, int begin, int end)
+{
+    const AxisWeights& xw = *job.xWeights;
+    const int dstWidth = job.dstArea.getWidth();
+
+    for (int r = begin; r < end; ++r)
+    {
+        const uint8_t* in = job.src->getData(
+            Vec2i(job.srcArea.getX1(), job.srcArea.getY1() + job.firstRow + r));
+        float* out = &job.rows[r * dstWidth * 4];
+
+        for (int x = 0; x < dstWidth; ++x, out += 4)
+        {
+            const uint8_t* p = in + xw.first[x] * 4;
+            const float* w = &xw.weights[x * xw.stride];
+            const int n = xw.count[x];
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < n; ++k, p += 4)
+            {
+                __m128i px = _mm_cvtsi32_si128(
+                    *reinterpret_cast<const int*>(p));
+                px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(px, zero), zero);
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(px),
+                                                 _mm_set1_ps(w[k])));
+            }
+            _mm_storeu_ps(out, sum);
+#else
+            float sum[4] = { 0, 0, 0, 0 };
+            for (int k = 0; k < n; ++k, p += 4)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    sum[c] += p[c] * w[k];
+                }
+            }
+            std::copy(sum, sum + 4, out);
+#endif
+        }
+    }
+}
+
+// Filter job.rows vertically into destination rows [begin, end) (counted
+// from the top of job.dstArea).
+void vertical_pass(ResampleJob& job, int begin, int end)
+{
+    const AxisWeights& yw = *job.yWeights;
+    const int dstWidth = job.dstArea.getWidth();
+    const int rowFloats = dstWidth * 4;
+
+    for (int y = begin; y < end; ++y)
+    {
+        uint8_t* out = job.dst->getData(
+            Vec2i(job.dstArea.getX1(), job.dstArea.getY1() + y));
+        const float* in = &job.rows[(yw.first[y] - job.firstRow) * rowFloats];
+        const float* w = &yw.weights[y * yw.stride];
+        const int n = yw.count[y];
+
+        for (int x = 0; x < dstWidth; ++x, out += 4)
+        {
+            const float* p = in + x * 4;
+#ifdef __SSE2__
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < n; ++k, p += rowFloats)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(p),
+                                                 _mm_set1_ps(w[k])));
+            }
+
+            if (job.alphaOffset == 3)
+            {
+                sum = _mm_min_ps(sum, _mm_shuffle_ps(sum, sum,
+                                                     _MM_SHUFFLE(3, 3, 3, 3)));
+            }
+            else if (job.alphaOffset == 0)
+            {
+                sum = _mm_min_ps(sum, _mm_shuffle_ps(sum, sum,
+                                                     _MM_SHUFFLE(0, 0, 0, 0)));
+            }
+
+            // Round to nearest; the packs clamp to 0..255.
+            __m128i v = _mm_cvtps_epi32(sum);
+            v = _mm_packs_epi32(v, v);
+            v = _mm_packus_epi16(v, v);
+            *reinterpret_cast<int*>(out) = _mm_cvtsi128_si32(v);
+#else
+            float sum[4] = { 0, 0, 0, 0 };
+            for (int k = 0; k < n; ++k, p += rowFloats)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    sum[c] += p[c] * w[k];
+                }
+            }
+
+            for (int c = 0; c < 4; ++c)
+            {
+                float v = sum[c];
+                if (job.alphaOffset >= 0)
+                {
+                    v = std::min(v, sum[job.alphaOffset]);
+                }
+                out[c] = static_cast<uint8_t>(
+                    std::max(0.0f, std::min(255.0f, v + 0.5f)));
+            }
+#endif
+        }
+    }
+}
+
+bool is_within(const Area& area, const Surface8u& surface)
+{
+    return area.getX1() >= 0 && area.getY1() >= 0 &&
+           area.getX2() <= surface.getWidth() &&
+           area.getY2() <= surface.getHeight() &&
+           area.getWidth() > 0 && area.getHeight() > 0;
+}
+
+} // namespace
+
+
+bool resample(const Surface8u& src, const Area& srcArea,
+              Surface8u& dst, const Area& dstArea,
+              ResampleFilter filter, WorkerPool& pool)
+{
+    if (src.getPixelInc() != 4 || dst.getPixelInc() != 4 ||
+        !is_within(srcArea, src) || !is_within(dstArea, dst))
+    {
+        return false;
+    }
+    if (filter < 0 || filter >= kNumResampleFilters)
+    {
+        filter = kResampleBox;
+    }
+
+    ResampleJob job;
+    job.src = &src;
+    job.dst = &dst;
+    job.srcArea = srcArea;
+    job.dstArea = dstArea;
+    job.xWeights = weight_cache().get(srcArea.getWidth(), dstArea.getWidth(),
+                                      filter);
+    job.yWeights = weight_cache().get(srcArea.getHeight(),
+                                      dstArea.getHeight(), filter);
+    job.alphaOffset = src.hasAlpha() && src.isPremultiplied()
+                      ? src.getChannelOrder().getAlphaOffset() : -1;
+
+    // Only the source rows some destination row uses.
+    const AxisWeights& yw = *job.yWeights;
+    const int lastY = dstArea.getHeight() - 1;
+    job.firstRow = yw.first[0];
+    const int numRows = yw.first[lastY] + yw.count[lastY] - job.firstRow;
+    job.rows.resize(numRows * dstArea.getWidth() * 4);
+
+    // Rows are cheap on their own, so hand them out a few at a time.
+    pool.parallelFor(numRows, 8,
+                     boost::bind(&horizontal_pass, boost::ref(job), _1, _2));
+    pool.parallelFor(dstArea.getHeight(), 8,
+                     boost::bind(&vertical_pass, boost::ref(job), _1, _2));
+    return true;
+}
+
+bool build_mip_chain(const Surface8u& base, ResampleFilter filter,
+                     WorkerPool& pool, std::vector<Surface8u>& levels)
+{
+    levels.clear();
+
+    const Surface8u* prev = &base;
+    int width = base.getWidth();
+    int height = base.getHeight();
+
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+
+        Surface8u level(width, height, base.hasAlpha(),
+                        base.getChannelOrder());
+        level.setPremultiplied(base.isPremultiplied());
+
+        if (!resample(*prev, prev->getBounds(), level, level.getBounds(),
+                      filter, pool))
+        {
+            levels.clear();
+            return false;
+        }
+
+        levels.push_back(level);
+        prev = &levels.back();
+    }
+
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef orlok_resampler_h
+#define orlok_resampler_h
+
+/*
+Image resampling, in place of cinder::ip::resizeCopy: results are written
+into a surface the caller provides (rather than a new one, which would only
+be copied again), and the work is split across a WorkerPool.
+
+Resampling is separable: rows are filtered horizontally into a float
+buffer, which is then filtered vertically. The filter weights for each
+(source size, destination size, filter) are worked out once and cached, so
+resizing many images between the same sizes (eg, for resolution tiers) only
+does the multiply-adds. Pixels are filtered as 4 floats at a time with SSE2.
+
+Only 8 bit surfaces with 4 bytes per pixel are handled (which covers all
+cairo surfaces). Premultiplied pixels stay valid: if the source is
+premultiplied, colors are clamped to alpha, since filters with negative
+lobes (Lanczos) can overshoot.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/Surface.h"
+#include "worker_pool.h"
+#include <vector>
+
+using namespace ci;
+
+
+// Values match the Dylan side's <bitmap-filter> mapping.
+enum ResampleFilter
+{
+    kResampleBox = 0,
+    kResampleTriangle,
+    kResampleGaussian,
+    kResampleLanczos,   // 3 lobes
+
+    kNumResampleFilters
+};
+
+// Resample srcArea of src into dstArea of dst. Returns false (doing
+// nothing) if either surface isn't 4 bytes per pixel, or an area is empty
+// or not within its surface. src and dst must be different surfaces.
+bool resample(const Surface8u& src, const Area& srcArea,
+              Surface8u& dst, const Area& dstArea,
+              ResampleFilter filter, WorkerPool& pool);
+
+// Fill levels with base's mip chain (not including base itself): each level
+// is half the size of the one before (rounding down, but at least 1), down
+// to 1x1. Each level is resampled from the one before it.
+bool build_mip_chain(const Surface8u& base, ResampleFilter filter,
+                     WorkerPool& pool, std::vector<Surface8u>& levels);
+
+#endif
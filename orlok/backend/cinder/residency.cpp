@@ -0,0 +1,324 @@
+#include "residency.h"
+#include "tracked_surface.h"
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+
+bool older_use(const std::pair<unsigned, gl::Texture*>& a,
+               const std::pair<unsigned, gl::Texture*>& b)
+{
+    return a.first < b.first;
+}
+
+int64_t surface_bytes(const Surface& surface)
+{
+    return static_cast<int64_t>(surface.getRowBytes()) * surface.getHeight();
+}
+
+} // namespace
+
+
+MemoryLedger::MemoryLedger()
+{
+    std::fill(m_current, m_current + kNumMemoryKinds, 0);
+    std::fill(m_peak, m_peak + kNumMemoryKinds, 0);
+}
+
+void MemoryLedger::add(MemoryKind kind, int64_t bytes)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_current[kind] += bytes;
+    m_peak[kind] = std::max(m_peak[kind], m_current[kind]);
+}
+
+int64_t MemoryLedger::current(MemoryKind kind) const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_current[kind];
+}
+
+int64_t MemoryLedger::peak(MemoryKind kind) const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_peak[kind];
+}
+
+MemoryLedger& memory_ledger()
+{
+    static MemoryLedger ledger;
+    return ledger;
+}
+
+
+ResidencyManager::ResidencyManager(MemoryLedger& ledger) :
+    m_ledger(ledger),
+    m_budget(0),
+    m_resident(0),
+    m_frame(0),
+    m_evictions(0),
+    m_rebuilds(0)
+{
+}
+
+void ResidencyManager::setBudget(int64_t bytes)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_budget = std::max<int64_t>(0, bytes);
+}
+
+void ResidencyManager::add(gl::Texture* tex, int64_t bytes,
+                           const Rebuild& rebuild, TrackedSurface* source,
+                           const Area& sourceArea)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    Entry entry;
+    entry.bytes = bytes;
+    entry.width = tex->getWidth();
+    entry.height = tex->getHeight();
+    entry.lastUse = m_frame;
+    entry.resident = true;
+    entry.rebuild = rebuild;
+    entry.fromSurface = source != 0;
+    entry.source = source;
+    entry.sourceArea = sourceArea;
+    entry.sourceGeneration = source ? source->damage().generation() : 0;
+    m_entries[tex] = entry;
+    m_resident += bytes;
+    m_ledger.add(kMemoryTextures, bytes);
+}
+
+void ResidencyManager::remove(gl::Texture* tex)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    Entries::iterator it = m_entries.find(tex);
+    if (it == m_entries.end())
+    {
+        return;
+    }
+
+    if (it->second.resident)
+    {
+        m_resident -= it->second.bytes;
+        m_ledger.add(kMemoryTextures, -it->second.bytes);
+    }
+    dropPixels(it->second);
+    m_entries.erase(it);
+}
+
+bool ResidencyManager::use(gl::Texture* tex)
+{
+    // The rebuild may decode an image or upload a lot, so it's done without
+    // holding the lock. Only the GL thread adds, removes or rebuilds
+    // entries, so tex's entry is still there afterwards.
+    Rebuild rebuild;
+    Surface pixels;
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        Entries::iterator it = m_entries.find(tex);
+        if (it == m_entries.end())
+        {
+            return true;
+        }
+
+        Entry& entry = it->second;
+        entry.lastUse = m_frame;
+        if (entry.resident)
+        {
+            return true;
+        }
+        if (!entry.rebuild)
+        {
+            return false;
+        }
+        rebuild = entry.rebuild;
+        pixels = entry.pixels;
+    }
+
+    bool rebuilt = rebuild(*tex, pixels ? &pixels : 0);
+
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    Entry& entry = m_entries[tex];
+    if (!rebuilt)
+    {
+        // Don't try again every time it's used.
+        entry.rebuild.clear();
+        entry.source = 0;
+        dropPixels(entry);
+        return false;
+    }
+
+    entry.resident = true;
+    m_resident += entry.bytes;
+    m_ledger.add(kMemoryTextures, entry.bytes);
+    ++m_rebuilds;
+
+    if (entry.fromSurface)
+    {
+        dropPixels(entry);
+        // Still a copy of its source (and so can be evicted again) only if
+        // the source is around and hasn't changed since it was evicted.
+        if (!entry.source ||
+            entry.source->damage().generation() != entry.sourceGeneration)
+        {
+            entry.rebuild.clear();
+            entry.source = 0;
+        }
+    }
+    return true;
+}
+
+void ResidencyManager::contentsChanged(gl::Texture* tex,
+                                       const TrackedSurface* from, bool whole)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    Entries::iterator it = m_entries.find(tex);
+    if (it == m_entries.end())
+    {
+        return;
+    }
+
+    Entry& entry = it->second;
+    if (from && from == entry.source && whole)
+    {
+        // Caught up with its source again.
+        entry.sourceGeneration = from->damage().generation();
+    }
+    else
+    {
+        entry.rebuild.clear();
+        entry.source = 0;
+    }
+}
+
+void ResidencyManager::sourceFreed(const TrackedSurface* source)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    for (Entries::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        Entry& entry = it->second;
+        if (entry.source == source)
+        {
+            entry.source = 0;
+            // An evicted texture is rebuilt from its own copy of the pixels,
+            // but a resident one has nothing to copy them from any more.
+            if (entry.resident)
+            {
+                entry.rebuild.clear();
+            }
+        }
+    }
+}
+
+void ResidencyManager::beginFrame(GLuint bound)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    ++m_frame;
+    if (m_budget > 0 && m_resident > m_budget)
+    {
+        evictToBudget(bound);
+    }
+}
+
+// Called with m_mutex locked.
+bool ResidencyManager::evictable(const Entry& entry, GLuint id,
+                                 GLuint bound) const
+{
+    return entry.resident && entry.rebuild &&
+           entry.lastUse + 1 < m_frame && id != bound &&
+           (!entry.fromSurface ||
+            (entry.source &&
+             entry.source->damage().generation() == entry.sourceGeneration));
+}
+
+// Called with m_mutex locked.
+void ResidencyManager::evictToBudget(GLuint bound)
+{
+    std::vector<std::pair<unsigned, gl::Texture*> > candidates;
+    for (Entries::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        if (evictable(it->second, it->first->getId(), bound))
+        {
+            candidates.push_back(std::make_pair(it->second.lastUse, it->first));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), older_use);
+
+    for (size_t i = 0; i < candidates.size() && m_resident > m_budget; ++i)
+    {
+        gl::Texture* tex = candidates[i].second;
+        Entry& entry = m_entries[tex];
+
+        if (entry.fromSurface)
+        {
+            keepPixels(entry);
+        }
+
+        // Deletes the GL texture, but leaves the object the Dylan side
+        // points to.
+        *tex = gl::Texture();
+        entry.resident = false;
+        m_resident -= entry.bytes;
+        m_ledger.add(kMemoryTextures, -entry.bytes);
+        ++m_evictions;
+    }
+}
+
+// Called with m_mutex locked, on the main thread (see the class comment).
+void ResidencyManager::keepPixels(Entry& entry)
+{
+    entry.source->flush();
+    const Surface& from = entry.source->getSurface();
+    const Area& area = entry.sourceArea;
+
+    entry.pixels = Surface(area.getWidth(), area.getHeight(), from.hasAlpha(),
+                           from.getChannelOrder());
+    entry.pixels.copyFrom(from, area, -area.getUL());
+    entry.pixels.setPremultiplied(from.isPremultiplied());
+    m_ledger.add(kMemorySurfaces, surface_bytes(entry.pixels));
+}
+
+// Called with m_mutex locked.
+void ResidencyManager::dropPixels(Entry& entry)
+{
+    if (entry.pixels)
+    {
+        m_ledger.add(kMemorySurfaces, -surface_bytes(entry.pixels));
+        entry.pixels = Surface();
+    }
+}
+
+bool ResidencyManager::getSize(gl::Texture* tex, int* width,
+                               int* height) const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    Entries::const_iterator it = m_entries.find(tex);
+    if (it == m_entries.end())
+    {
+        return false;
+    }
+
+    *width = it->second.width;
+    *height = it->second.height;
+    return true;
+}
+
+int64_t ResidencyManager::residentBytes() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_resident;
+}
+
+int ResidencyManager::numEvictions() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_evictions;
+}
+
+int ResidencyManager::numRebuilds() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_rebuilds;
+}
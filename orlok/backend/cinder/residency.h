@@ -0,0 +1,167 @@
+#ifndef orlok_residency_h
+#define orlok_residency_h
+
+/*
+Keeping track of how much memory surfaces and textures use, and keeping
+textures' GPU memory within a budget.
+
+MemoryLedger counts bytes per kind of resource, along with the most ever
+used at once (the high-water mark).
+
+ResidencyManager keeps a budget for the GPU memory of textures made from
+surfaces or image files. When resident textures add up to more than the
+budget, the least recently used ones that can be made again are evicted:
+their GL textures are deleted, but the gl::Texture objects (which the Dylan
+side holds pointers to) stay, and are rebuilt the next time they're bound.
+A texture made from an image file can always be rebuilt (cheaply, with a
+texture cache). One copied from a surface can be evicted while the surface
+is unchanged since it was copied; its pixels are then copied out of the
+surface (into CPU memory, counted as surfaces), and it's rebuilt from that
+copy, so changing or freeing the surface afterwards doesn't matter.
+Textures whose contents were changed some other way, render textures and
+atlas pages are never evicted.
+
+Budgets are soft: textures used in the last frame (or still bound) are
+never evicted, even if that leaves more resident than the budget.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/Area.h"
+#include "cinder/Surface.h"
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <stdint.h>
+
+using namespace ci;
+
+class TrackedSurface;
+
+
+enum MemoryKind
+{
+    kMemorySurfaces = 0,    // CPU: surfaces' pixels
+    kMemoryTextures,        // GPU: resident textures made by the backend
+    kMemoryRenderTextures,  // GPU: framebuffers' color and depth buffers
+
+    kNumMemoryKinds
+};
+
+// Safe to use from several threads at once.
+class MemoryLedger
+{
+public:
+    MemoryLedger();
+
+    // Negative bytes for memory freed.
+    void add(MemoryKind kind, int64_t bytes);
+
+    int64_t current(MemoryKind kind) const;
+    int64_t peak(MemoryKind kind) const;
+
+private:
+    mutable boost::mutex m_mutex;
+    int64_t              m_current[kNumMemoryKinds];
+    int64_t              m_peak[kNumMemoryKinds];
+};
+
+// Surfaces are counted by the one ledger for the whole process, since they
+// can be made before the app starts and freed after it stops.
+MemoryLedger& memory_ledger();
+
+
+// Used on the GL thread (the render thread, if there is one), apart from
+// sourceFreed and the stats, which are safe from any thread. Textures
+// copied from surfaces may only be added while the GL thread is the main
+// thread, since evicting them reads their surfaces.
+class ResidencyManager
+{
+public:
+    // Make an evicted texture's contents again, into tex (which is empty).
+    // For a texture copied from a surface, pixels is the copy of its area
+    // made when it was evicted; otherwise it's null.
+    typedef boost::function<bool (gl::Texture& tex, const Surface* pixels)>
+        Rebuild;
+
+    explicit ResidencyManager(MemoryLedger& ledger);
+
+    // Keep at most bytes of textures resident (0 for no limit). Textures
+    // are only evicted at the start of a frame, when GL state is reset.
+    void setBudget(int64_t bytes);
+
+    // Track tex, which uses bytes of GPU memory. If rebuild is empty, tex is
+    // never evicted. If source is not null, tex is a copy of sourceArea of
+    // it, so can only be evicted while source is unchanged and not freed.
+    void add(gl::Texture* tex, int64_t bytes, const Rebuild& rebuild,
+             TrackedSurface* source, const Area& sourceArea);
+    // Call before deleting tex.
+    void remove(gl::Texture* tex);
+
+    // Call before tex is bound or updated, to rebuild it if it was evicted.
+    // Returns false if tex is evicted and couldn't be rebuilt, in which case
+    // it has no GL texture, and never will again.
+    bool use(gl::Texture* tex);
+
+    // tex's contents were changed, from surface from (null if not from a
+    // surface), and all of it if whole. Unless that leaves tex a copy of
+    // its source, tex can no longer be evicted.
+    void contentsChanged(gl::Texture* tex, const TrackedSurface* from,
+                         bool whole);
+
+    // source is about to be freed, so resident textures copied from it can
+    // no longer be evicted. Evicted ones have their own copy of its pixels.
+    void sourceFreed(const TrackedSurface* source);
+
+    // Start a new frame, then evict down to the budget. bound is the GL
+    // texture currently bound for drawing, which is kept.
+    void beginFrame(GLuint bound);
+
+    // Get tex's size, which (unlike tex's own) is safe to ask for from any
+    // thread, even while tex is evicted. Returns false if tex isn't tracked.
+    bool getSize(gl::Texture* tex, int* width, int* height) const;
+
+    int64_t residentBytes() const;
+    int numEvictions() const;
+    int numRebuilds() const;
+
+private:
+    struct Entry
+    {
+        int64_t         bytes;
+        int             width;
+        int             height;
+        unsigned        lastUse;     // frame number
+        bool            resident;
+        Rebuild         rebuild;
+        // Whether rebuild needs a copy of the source's pixels.
+        bool            fromSurface;
+        // Null once freed, or once tex no longer matches it.
+        TrackedSurface* source;
+        Area            sourceArea;
+        unsigned        sourceGeneration;
+        // The source's pixels, while evicted.
+        Surface         pixels;
+    };
+
+    typedef std::map<gl::Texture*, Entry> Entries;
+
+    bool evictable(const Entry& entry, GLuint id, GLuint bound) const;
+    void evictToBudget(GLuint bound);
+    // Keep (or drop) the copy of an evicted entry's source pixels.
+    void keepPixels(Entry& entry);
+    void dropPixels(Entry& entry);
+
+    MemoryLedger&        m_ledger;
+    mutable boost::mutex m_mutex;
+    Entries              m_entries;
+    int64_t              m_budget;
+    int64_t              m_resident;
+    unsigned             m_frame;
+    int                  m_evictions;
+    int                  m_rebuilds;
+};
+
+#endif
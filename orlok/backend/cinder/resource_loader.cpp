@@ -0,0 +1,219 @@
+#include "resource_loader.h"
+#include "cinder/Timer.h"
+#include <boost/bind.hpp>
+#include <exception>
+
+using namespace ci;
+
+
+LoadRequest::LoadRequest() :
+    m_stage(kDecoding),
+    m_status(kPending),
+    m_value(0),
+    m_abandoned(false)
+{
+}
+
+LoadRequest::Status LoadRequest::status() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_status;
+}
+
+void* LoadRequest::takeResult()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if (m_status != kReady)
+    {
+        return 0;
+    }
+
+    void* result = m_value;
+    m_value = 0;
+    return result;
+}
+
+// Called with m_mutex locked.
+void LoadRequest::finishStep(void* value, const std::string& error)
+{
+    if (!value)
+    {
+        m_stage = kDone;
+        m_status = kFailed;
+        m_error = error.empty() ? "error loading resource" : error;
+        return;
+    }
+
+    if (m_stage == kDecoding && m_finishGl)
+    {
+        if (m_abandoned)
+        {
+            m_freeDecoded(value);
+            m_stage = kDone;
+            return;
+        }
+        m_value = value;
+        m_stage = kNeedsGl;
+        return;
+    }
+
+    m_stage = kDone;
+    m_status = kReady;
+    if (m_abandoned)
+    {
+        m_freeResult(value);
+    }
+    else
+    {
+        m_value = value;
+    }
+}
+
+
+ResourceLoader::ResourceLoader(WorkerPool& pool) :
+    m_pool(pool)
+{
+}
+
+LoadRequestPtr ResourceLoader::load(const Decode& decode,
+                                    const FinishGl& finishGl,
+                                    const Free& freeDecoded,
+                                    const Free& freeResult)
+{
+    LoadRequestPtr request(new LoadRequest);
+    request->m_finishGl = finishGl;
+    request->m_freeDecoded = freeDecoded;
+    request->m_freeResult = freeResult;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_inFlight.push_back(request);
+    }
+
+    // The job holds on to the request, so it's fine for it to be abandoned
+    // while decoding.
+    m_pool.post(boost::bind(&ResourceLoader::decode, request, decode));
+    return request;
+}
+
+void ResourceLoader::decode(LoadRequestPtr request, Decode decode)
+{
+    std::string error;
+    void* value = 0;
+
+    try
+    {
+        value = decode(&error);
+    }
+    catch (const std::exception& exc)
+    {
+        error = exc.what();
+    }
+    catch (...)
+    {
+    }
+
+    boost::lock_guard<boost::mutex> lock(request->m_mutex);
+    request->finishStep(value, error);
+}
+
+void ResourceLoader::abandon(const LoadRequestPtr& request)
+{
+    boost::lock_guard<boost::mutex> lock(request->m_mutex);
+    request->m_abandoned = true;
+
+    if (request->m_stage == LoadRequest::kDone && request->m_value)
+    {
+        request->m_freeResult(request->m_value);
+        request->m_value = 0;
+    }
+}
+
+void ResourceLoader::finishGlWork(double budgetSeconds)
+{
+    Timer timer(true);
+
+    // Drop requests that are done, and pick out those waiting for GL.
+    std::vector<LoadRequestPtr> due;
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        std::vector<LoadRequestPtr>::iterator out = m_inFlight.begin();
+        for (std::vector<LoadRequestPtr>::iterator it = m_inFlight.begin();
+             it != m_inFlight.end(); ++it)
+        {
+            boost::lock_guard<boost::mutex> requestLock((*it)->m_mutex);
+            if ((*it)->m_stage == LoadRequest::kDone)
+            {
+                continue;
+            }
+            if ((*it)->m_stage == LoadRequest::kNeedsGl)
+            {
+                due.push_back(*it);
+            }
+            *out++ = *it;
+        }
+        m_inFlight.erase(out, m_inFlight.end());
+    }
+
+    int finished = 0;
+    for (size_t i = 0; i < due.size(); ++i)
+    {
+        LoadRequest& request = *due[i];
+
+        void* decoded;
+        FinishGl finishGl;
+        {
+            boost::lock_guard<boost::mutex> lock(request.m_mutex);
+            if (request.m_abandoned)
+            {
+                // Costs next to nothing, so doesn't count against the budget.
+                request.m_freeDecoded(request.m_value);
+                request.m_value = 0;
+                request.m_stage = LoadRequest::kDone;
+                continue;
+            }
+            if (finished > 0 && timer.getSeconds() >= budgetSeconds)
+            {
+                break;
+            }
+            decoded = request.m_value;
+            request.m_value = 0;
+            finishGl = request.m_finishGl;
+        }
+
+        std::string error;
+        void* result = 0;
+        try
+        {
+            result = finishGl(decoded, &error);
+        }
+        catch (const std::exception& exc)
+        {
+            error = exc.what();
+        }
+        catch (...)
+        {
+        }
+
+        boost::lock_guard<boost::mutex> lock(request.m_mutex);
+        request.finishStep(result, error);
+        ++finished;
+    }
+}
+
+int ResourceLoader::numPending()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    int pending = 0;
+    for (size_t i = 0; i < m_inFlight.size(); ++i)
+    {
+        boost::lock_guard<boost::mutex> requestLock(m_inFlight[i]->m_mutex);
+        if (m_inFlight[i]->m_stage != LoadRequest::kDone)
+        {
+            ++pending;
+        }
+    }
+    return pending;
+}
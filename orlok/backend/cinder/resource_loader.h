@@ -0,0 +1,116 @@
+#ifndef orlok_resource_loader_h
+#define orlok_resource_loader_h
+
+/*
+Loading resources without blocking the main thread. Each load has two
+steps: decoding (reading and decompressing the resource, eg, into a surface
+or an audio source), done on a WorkerPool thread so that several loads go
+on at once, and optionally a GL step (eg, making a font's glyph textures or
+compiling a shader), done by finishGlWork with GL current.
+
+finishGlWork is called once a frame, and runs GL steps until its time
+budget is used up, so that a burst of loads is spread over several frames
+rather than causing a hitch. It always runs at least one, so loading keeps
+making progress however small the budget.
+
+Requests are polled (eg, from the update loop) rather than calling back,
+so results are only ever handed over on the polling thread.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "worker_pool.h"
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <vector>
+
+
+class LoadRequest
+{
+public:
+    enum Status
+    {
+        kFailed = -1,
+        kPending = 0,
+        kReady = 1
+    };
+
+    Status status() const;
+    // Why a request failed. Doesn't change once status() is kFailed.
+    const std::string& error() const { return m_error; }
+
+    // The result of a ready request, which the caller then owns. Returns
+    // null if the request isn't ready, or its result was already taken.
+    void* takeResult();
+
+private:
+    friend class ResourceLoader;
+
+    enum Stage
+    {
+        kDecoding,
+        kNeedsGl,
+        kDone
+    };
+
+    LoadRequest();
+
+    // Take the value from finished step, and free it if it's not wanted.
+    void finishStep(void* value, const std::string& error);
+
+    mutable boost::mutex m_mutex;
+    Stage                m_stage;
+    Status               m_status;
+    // Decoded, before the GL step (if any), and the result after it.
+    void*                m_value;
+    std::string          m_error;
+    bool                 m_abandoned;
+
+    boost::function<void* (void*, std::string*)> m_finishGl;
+    boost::function<void (void*)>                m_freeDecoded;
+    boost::function<void (void*)>                m_freeResult;
+};
+
+typedef boost::shared_ptr<LoadRequest> LoadRequestPtr;
+
+
+class ResourceLoader
+{
+public:
+    // Decode returns what it loaded, or null with an error message.
+    typedef boost::function<void* (std::string* error)> Decode;
+    // The GL step takes what was decoded (which it then owns), and returns
+    // the result, or null with an error message.
+    typedef boost::function<void* (void* decoded, std::string* error)> FinishGl;
+    typedef boost::function<void (void*)> Free;
+
+    explicit ResourceLoader(WorkerPool& pool);
+
+    // Start a load. finishGl may be empty, in which case what was decoded
+    // is the result, and freeDecoded isn't needed. The Free functions are
+    // for results that end up unwanted, because the request was abandoned.
+    LoadRequestPtr load(const Decode& decode, const FinishGl& finishGl,
+                        const Free& freeDecoded, const Free& freeResult);
+
+    // Forget request. Its result is freed, now if it's ready, or else when
+    // it's done.
+    void abandon(const LoadRequestPtr& request);
+
+    // Run GL steps that are due for up to budgetSeconds, but at least one.
+    // Must be called with GL current.
+    void finishGlWork(double budgetSeconds);
+
+    // Number of requests not yet done (ready or failed).
+    int numPending();
+
+private:
+    static void decode(LoadRequestPtr request, Decode decode);
+
+    WorkerPool&                 m_pool;
+    boost::mutex                m_mutex;
+    std::vector<LoadRequestPtr> m_inFlight;
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "shader_program.h"
+
+namespace
+{
+
+// Number of components of a GLSL uniform type, and whether it is uploaded
+// with the integer variants of glUniform.
+int uniform_type_components(GLenum type, bool* isInt)
+{
+    *isInt = false;
+
+    switch (type)
+    {
+        case GL_FLOAT:      return 1;
+        case GL_FLOAT_VEC2: return 2;
+        case GL_FLOAT_VEC3: return 3;
+        case GL_FLOAT_VEC4: return 4;
+        case GL_FLOAT_MAT2: return 4;
+        case GL_FLOAT_MAT3: return 9;
+        case GL_FLOAT_MAT4: return 16;
+
+        case GL_INT:
+        case GL_BOOL:
+        case GL_SAMPLER_1D:
+        case GL_SAMPLER_2D:
+        case GL_SAMPLER_3D:
+        case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_RECT_ARB:
+            *isInt = true;
+            return 1;
+        case GL_INT_VEC2:
+        case GL_BOOL_VEC2:
+            *isInt = true;
+            return 2;
+        case GL_INT_VEC3:
+        case GL_BOOL_VEC3:
+            *isInt = true;
+            return 3;
+        case GL_INT_VEC4:
+        case GL_BOOL_VEC4:
+            *isInt = true;
+            return 4;
+
+        default:
+            return 0; // unsupported
+    }
+}
+
+} // namespace
+
+
+ShaderProgram::ShaderProgram(gl::GlslProg* prog) :
+    m_prog(prog)
+{
+    GLuint handle = prog->getHandle();
+
+    GLint numUniforms = 0;
+    GLint maxNameLength = 0;
+    glGetProgramiv(handle, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(handle, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    std::vector<GLchar> nameBuf(maxNameLength + 1);
+
+    for (GLint i = 0; i < numUniforms; ++i)
+    {
+        GLint size = 0;
+        GLenum type = 0;
+        GLsizei length = 0;
+        glGetActiveUniform(handle, i, maxNameLength, &length, &size, &type,
+                           &nameBuf[0]);
+        std::string name(&nameBuf[0], length);
+
+        Uniform u;
+        u.location = glGetUniformLocation(handle, name.c_str());
+        bool isInt;
+        u.type = type;
+        u.components = uniform_type_components(type, &isInt);
+        u.valid = false;
+        u.values.resize(u.components);
+
+        // Skip built-ins (gl_*), which have no location.
+        if (u.location < 0)
+        {
+            continue;
+        }
+
+        int h = static_cast<int>(m_uniforms.size());
+        m_uniforms.push_back(u);
+
+        // Arrays are reported as "name[0]". Allow plain "name" as well.
+        m_handles[name] = h;
+        std::string::size_type bracket = name.find('[');
+        if (bracket != std::string::npos)
+        {
+            m_handles[name.substr(0, bracket)] = h;
+        }
+    }
+}
+
+ShaderProgram::~ShaderProgram()
+{
+    delete m_prog;
+}
+
+int ShaderProgram::uniformHandle(const std::string& name) const
+{
+    std::map<std::string, int>::const_iterator i = m_handles.find(name);
+    return i == m_handles.end() ? -1 : i->second;
+}
+
+int ShaderProgram::uniformComponents(int handle) const
+{
+    if (handle < 0 || handle >= static_cast<int>(m_uniforms.size()))
+    {
+        return 0;
+    }
+    return m_uniforms[handle].components;
+}
+
+bool ShaderProgram::wouldChange(int handle, const float* values,
+                                int count) const
+{
+    if (count <= 0 || uniformComponents(handle) != count)
+    {
+        return false;
+    }
+
+    const Uniform& u = m_uniforms[handle];
+
+    if (!u.valid)
+    {
+        return true;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (u.values[i] != values[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ShaderProgram::upload(int handle, const float* values, int count)
+{
+    if (count <= 0 || uniformComponents(handle) != count)
+    {
+        return;
+    }
+
+    Uniform& u = m_uniforms[handle];
+    bool isInt;
+    uniform_type_components(u.type, &isInt);
+
+    if (isInt)
+    {
+        GLint ints[4];
+        for (int i = 0; i < count; ++i)
+        {
+            ints[i] = static_cast<GLint>(values[i]);
+        }
+
+        switch (count)
+        {
+            case 1: glUniform1iv(u.location, 1, ints); break;
+            case 2: glUniform2iv(u.location, 1, ints); break;
+            case 3: glUniform3iv(u.location, 1, ints); break;
+            case 4: glUniform4iv(u.location, 1, ints); break;
+        }
+    }
+    else
+    {
+        switch (u.type)
+        {
+            case GL_FLOAT_MAT2:
+                glUniformMatrix2fv(u.location, 1, GL_FALSE, values);
+                break;
+            case GL_FLOAT_MAT3:
+                glUniformMatrix3fv(u.location, 1, GL_FALSE, values);
+                break;
+            case GL_FLOAT_MAT4:
+                glUniformMatrix4fv(u.location, 1, GL_FALSE, values);
+                break;
+            default:
+                switch (count)
+                {
+                    case 1: glUniform1fv(u.location, 1, values); break;
+                    case 2: glUniform2fv(u.location, 1, values); break;
+                    case 3: glUniform3fv(u.location, 1, values); break;
+                    case 4: glUniform4fv(u.location, 1, values); break;
+                }
+                break;
+        }
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        u.values[i] = values[i];
+    }
+    u.valid = true;
+}
@@ -0,0 +1,66 @@
+#ifndef orlok_shader_program_h
+#define orlok_shader_program_h
+
+/*
+Wraps a cinder GlslProg with a table of its active uniforms, so that uniforms
+can be set by small integer handles (rather than by name), and a cache of
+the last value uploaded for each, so that setting a uniform to the value it
+already has costs nothing.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/GlslProg.h"
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace ci;
+
+
+class ShaderProgram
+{
+public:
+    // Takes ownership of prog.
+    explicit ShaderProgram(gl::GlslProg* prog);
+    ~ShaderProgram();
+
+    gl::GlslProg* glslProg() const { return m_prog; }
+    GLuint        glHandle() const { return m_prog->getHandle(); }
+
+    // Return the handle for the named uniform, or -1 if there is no such
+    // active uniform. For arrays, either "name" or "name[0]" refers to the
+    // first element.
+    int uniformHandle(const std::string& name) const;
+
+    // Number of float/int components of the uniform (e.g., 2 for a vec2, 16
+    // for a mat4). Returns 0 for an invalid handle.
+    int uniformComponents(int handle) const;
+
+    // Return true if uploading values (of count components) to the uniform
+    // would change it. Always false for invalid handles or a count that
+    // doesn't match the uniform's type.
+    bool wouldChange(int handle, const float* values, int count) const;
+
+    // Upload values to the uniform and remember them. The program must be
+    // bound. Integer (and sampler and bool) uniforms are uploaded with the
+    // values converted to ints.
+    void upload(int handle, const float* values, int count);
+
+private:
+    struct Uniform
+    {
+        GLint              location;
+        GLenum             type;
+        int                components;
+        bool               valid;   // false until first upload
+        std::vector<float> values;
+    };
+
+    gl::GlslProg*              m_prog;
+    std::vector<Uniform>       m_uniforms;
+    std::map<std::string, int> m_handles;
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include "sprite_instancer.h"
+#include <algorithm>
+
+namespace
+{
+
+// Attribute locations, bound before linking. The corner must be attribute 0
+// (in place of gl_Vertex), since some drivers draw nothing otherwise.
+enum
+{
+    kAttribCorner = 0,
+    kAttribLinear,
+    kAttribOffset,
+    kAttribUV,
+    kAttribColor
+};
+
+// Expands a sprite from the shared quad's corner (0 or 1 in each
+// direction): the corner picks a point of rect and of instUV, which are
+// then transformed by the sprite's transform and the view (ie, the batch's
+// current) transform. Matrices are given as columns: (sx, shy), (shx, sy).
+const char* const k_instanced_vert_shader =
+    "attribute vec2 corner;\n"
+    "attribute vec4 instLinear;\n"
+    "attribute vec2 instOffset;\n"
+    "attribute vec4 instUV;\n"
+    "attribute vec4 instColor;\n"
+    "uniform vec4 rect;\n"
+    "uniform vec4 viewLinear;\n"
+    "uniform vec2 viewOffset;\n"
+    "uniform vec4 uvTransform;\n"
+    "uniform vec4 tint;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 p = mix(rect.xy, rect.zw, corner);\n"
+    "    p = mat2(instLinear.xy, instLinear.zw) * p + instOffset;\n"
+    "    p = mat2(viewLinear.xy, viewLinear.zw) * p + viewOffset;\n"
+    "    vec2 uv = mix(instUV.xy, instUV.zw, corner);\n"
+    "    gl_TexCoord[0] = vec4(uvTransform.xy + uv * uvTransform.zw, 0.0, 1.0);\n"
+    "    gl_FrontColor = instColor * tint;\n"
+    "    gl_Position = gl_ProjectionMatrix * vec4(p, 0.0, 1.0);\n"
+    "}\n";
+
+const char* const k_frag_shader =
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = gl_Color;\n"
+    "}\n";
+
+const char* const k_textured_frag_shader =
+    "uniform sampler2D tex0;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = texture2D(tex0, gl_TexCoord[0].st) * gl_Color;\n"
+    "}\n";
+
+// Compile and link a program with our attribute locations, or return null.
+gl::GlslProg* create_program(const char* vert, const char* frag)
+{
+    gl::GlslProg* prog;
+    try
+    {
+        prog = new gl::GlslProg(vert, frag);
+    }
+    catch (...)
+    {
+        return 0;
+    }
+
+    // Attribute locations only take effect when the program is linked, so
+    // link it again.
+    GLuint handle = prog->getHandle();
+    glBindAttribLocation(handle, kAttribCorner, "corner");
+    glBindAttribLocation(handle, kAttribLinear, "instLinear");
+    glBindAttribLocation(handle, kAttribOffset, "instOffset");
+    glBindAttribLocation(handle, kAttribUV, "instUV");
+    glBindAttribLocation(handle, kAttribColor, "instColor");
+    glLinkProgram(handle);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(handle, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        delete prog;
+        return 0;
+    }
+    return prog;
+}
+
+void sprite_attrib(GLuint index, GLint size, int firstFloat)
+{
+    const GLsizei stride = SpriteInstancer::kSpriteFloats * sizeof(float);
+
+    glEnableVertexAttribArray(index);
+    glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, stride,
+                          reinterpret_cast<GLvoid*>(firstFloat *
+                                                    sizeof(float)));
+#if defined(GL_ARB_instanced_arrays) && defined(GL_ARB_draw_instanced)
+    glVertexAttribDivisorARB(index, 1);
+#endif
+}
+
+} // namespace
+
+
+SpriteInstancer::SpriteInstancer(QuadBatch& batch, GlStateCache& state) :
+    m_batch(batch),
+    m_state(state),
+    m_useInstancing(false),
+    m_cornerVbo(0),
+    m_spriteVbo(0)
+{
+    m_program.program = 0;
+    m_texturedProgram.program = 0;
+}
+
+void SpriteInstancer::makeProgram(InstancedProgram& p, const char* fragShader)
+{
+    gl::GlslProg* prog = create_program(k_instanced_vert_shader, fragShader);
+    p.program = prog ? new ShaderProgram(prog) : 0;
+    if (!p.program)
+    {
+        return;
+    }
+
+    p.rect = p.program->uniformHandle("rect");
+    p.viewLinear = p.program->uniformHandle("viewLinear");
+    p.viewOffset = p.program->uniformHandle("viewOffset");
+    p.uvTransform = p.program->uniformHandle("uvTransform");
+    p.tint = p.program->uniformHandle("tint");
+}
+
+void SpriteInstancer::freeProgram(InstancedProgram& p)
+{
+    delete p.program;
+    p.program = 0;
+}
+
+void SpriteInstancer::setup()
+{
+#if defined(GL_ARB_instanced_arrays) && defined(GL_ARB_draw_instanced)
+    // Divisors come from one extension, and the instanced draw call from
+    // the other.
+    m_useInstancing = gl::isExtensionAvailable("GL_ARB_instanced_arrays") &&
+                      gl::isExtensionAvailable("GL_ARB_draw_instanced");
+#endif
+    if (!m_useInstancing)
+    {
+        return;
+    }
+
+    makeProgram(m_program, k_frag_shader);
+    makeProgram(m_texturedProgram, k_textured_frag_shader);
+
+    // In the same order as QuadBatch::addQuad's corners, drawn as a fan.
+    static const GLfloat corners[] = { 0, 0,  1, 0,  1, 1,  0, 1 };
+
+    glGenBuffers(1, &m_cornerVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_cornerVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &m_spriteVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void SpriteInstancer::cleanup()
+{
+    if (m_cornerVbo)
+    {
+        glDeleteBuffers(1, &m_cornerVbo);
+        m_cornerVbo = 0;
+    }
+    if (m_spriteVbo)
+    {
+        glDeleteBuffers(1, &m_spriteVbo);
+        m_spriteVbo = 0;
+    }
+    freeProgram(m_program);
+    freeProgram(m_texturedProgram);
+    m_useInstancing = false;
+}
+
+void SpriteInstancer::draw(float x1, float y1, float x2, float y2,
+                           float uOffset, float vOffset,
+                           float uScale, float vScale,
+                           int numSprites, const float* sprites)
+{
+    if (numSprites <= 0)
+    {
+        return;
+    }
+
+    if (const InstancedProgram* prog = programFor(m_batch.key()))
+    {
+        drawInstanced(*prog, x1, y1, x2, y2, uOffset, vOffset, uScale, vScale,
+                      numSprites, sprites);
+    }
+    else
+    {
+        drawExpanded(x1, y1, x2, y2, uOffset, vOffset, uScale, vScale,
+                     numSprites, sprites);
+    }
+}
+
+const SpriteInstancer::InstancedProgram* SpriteInstancer::programFor(
+    const BatchKey& key) const
+{
+    if (!m_useInstancing || key.program)
+    {
+        return 0;
+    }
+
+    const InstancedProgram* p = 0;
+    if (!key.texture)
+    {
+        p = &m_program;
+    }
+    else if (key.textureTarget == GL_TEXTURE_2D)
+    {
+        p = &m_texturedProgram;
+    }
+    return p && p->program ? p : 0;
+}
+
+void SpriteInstancer::setUniform(ShaderProgram& prog, int handle,
+                                 const float* values, int count)
+{
+    if (prog.uniformComponents(handle) == 0)
+    {
+        return; // optimized away
+    }
+
+    bool changed = prog.wouldChange(handle, values, count);
+    m_state.countUniform(changed);
+    if (changed)
+    {
+        prog.upload(handle, values, count);
+    }
+}
+
+void SpriteInstancer::drawInstanced(const InstancedProgram& prog,
+                                    float x1, float y1, float x2, float y2,
+                                    float uOffset, float vOffset,
+                                    float uScale, float vScale,
+                                    int numSprites, const float* sprites)
+{
+#if defined(GL_ARB_instanced_arrays) && defined(GL_ARB_draw_instanced)
+    // Whatever is already batched has to be drawn first, to keep the order.
+    m_batch.flush();
+
+    BatchKey key = m_batch.key();
+    key.program = prog.program->glHandle();
+    m_batch.applyState(key);
+
+    const Affine2& view = m_batch.transform();
+    const GLubyte* color = m_batch.color();
+
+    const float rect[4] = { x1, y1, x2, y2 };
+    const float viewLinear[4] = { view.sx, view.shy, view.shx, view.sy };
+    const float viewOffset[2] = { view.tx, view.ty };
+    const float uvTransform[4] = { uOffset, vOffset, uScale, vScale };
+    const float tint[4] = { color[0] / 255.0f, color[1] / 255.0f,
+                            color[2] / 255.0f, color[3] / 255.0f };
+
+    ShaderProgram& p = *prog.program;
+    setUniform(p, prog.rect, rect, 4);
+    setUniform(p, prog.viewLinear, viewLinear, 4);
+    setUniform(p, prog.viewOffset, viewOffset, 2);
+    setUniform(p, prog.uvTransform, uvTransform, 4);
+    setUniform(p, prog.tint, tint, 4);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_cornerVbo);
+    glEnableVertexAttribArray(kAttribCorner);
+    glVertexAttribPointer(kAttribCorner, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    // Specifying the data anew orphans the previous contents, so we don't
+    // wait for an earlier draw that is still reading them.
+    glBindBuffer(GL_ARRAY_BUFFER, m_spriteVbo);
+    glBufferData(GL_ARRAY_BUFFER, numSprites * kSpriteFloats * sizeof(float),
+                 sprites, GL_STREAM_DRAW);
+
+    sprite_attrib(kAttribLinear, 4, 0);
+    sprite_attrib(kAttribOffset, 2, 4);
+    sprite_attrib(kAttribUV, 4, 6);
+    sprite_attrib(kAttribColor, 4, 10);
+
+    glDrawArraysInstancedARB(GL_TRIANGLE_FAN, 0, 4, numSprites);
+
+    // Divisors stick to the attribute, not the program, so reset them for
+    // anyone else using these attributes.
+    for (GLuint i = kAttribCorner; i <= kAttribColor; ++i)
+    {
+        glVertexAttribDivisorARB(i, 0);
+        glDisableVertexAttribArray(i);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    m_batch.countDraw(numSprites);
+#endif
+}
+
+void SpriteInstancer::drawExpanded(float x1, float y1, float x2, float y2,
+                                   float uOffset, float vOffset,
+                                   float uScale, float vScale,
+                                   int numSprites, const float* sprites)
+{
+    const Affine2 view = m_batch.transform();
+
+    GLubyte tint[4];
+    std::copy(m_batch.color(), m_batch.color() + 4, tint);
+
+    for (int i = 0; i < numSprites; ++i)
+    {
+        const float* s = sprites + i * kSpriteFloats;
+
+        m_batch.setTransform(view * Affine2(s[0], s[1], s[2], s[3],
+                                            s[4], s[5]));
+        m_batch.setColor(s[10] * tint[0] / 255.0f,
+                         s[11] * tint[1] / 255.0f,
+                         s[12] * tint[2] / 255.0f,
+                         s[13] * tint[3] / 255.0f);
+        m_batch.addQuad(x1, y1, x2, y2,
+                        uOffset + s[6] * uScale, vOffset + s[7] * vScale,
+                        uOffset + s[8] * uScale, vOffset + s[9] * vScale);
+    }
+
+    m_batch.setTransform(view);
+    m_batch.setColor(tint);
+}
@@ -0,0 +1,97 @@
+#ifndef orlok_sprite_instancer_h
+#define orlok_sprite_instancer_h
+
+/*
+Draws many copies of a sprite (eg, particles) from a packed array of
+per-sprite data, in one draw call. Every sprite is the same rect in its own
+local space, placed by its own 2D affine transform (on top of the batch's
+current transform), with its own texture coordinates and color.
+
+With GL_ARB_instanced_arrays and GL_ARB_draw_instanced, the array is
+uploaded as it is and the vertex shader expands each sprite from a single
+shared quad. Otherwise, or
+when the sprites are drawn with a custom shader (which expects vertices
+transformed on the CPU, like everything else the batch draws) or a texture
+the default shader can't sample (eg, a rectangle texture), each sprite is
+expanded on the CPU and added to the QuadBatch instead.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "quad_batch.h"
+#include "shader_program.h"
+
+
+class SpriteInstancer
+{
+public:
+    // Floats per sprite: the transform (sx, shy, shx, sy, tx, ty, as for
+    // Affine2), texture coordinates (u1, v1, u2, v2) and color (r, g, b, a).
+    static const int kSpriteFloats = 14;
+
+    // Uniforms set for instanced draws are counted by state.
+    SpriteInstancer(QuadBatch& batch, GlStateCache& state);
+
+    // Create/destroy GL resources. Both require a current GL context.
+    void setup();
+    void cleanup();
+
+    // Draw numSprites sprites covering x1, y1, x2, y2 in their local space,
+    // with the batch's current texture, program, blend mode and transform.
+    // Texture coordinates are mapped by u = uOffset + u * uScale (and
+    // likewise for v) before use, and colors are modulated by the batch's
+    // current color.
+    void draw(float x1, float y1, float x2, float y2,
+              float uOffset, float vOffset, float uScale, float vScale,
+              int numSprites, const float* sprites);
+
+private:
+    // One of the instanced programs, with its uniforms' handles (looked up
+    // once, when it's made).
+    struct InstancedProgram
+    {
+        ShaderProgram* program;  // null if it couldn't be made
+        int            rect;
+        int            viewLinear;
+        int            viewOffset;
+        int            uvTransform;
+        int            tint;
+    };
+
+    static void makeProgram(InstancedProgram& p, const char* fragShader);
+    static void freeProgram(InstancedProgram& p);
+
+    // Null if there is no suitable program for key (so the sprites have to
+    // be expanded on the CPU).
+    const InstancedProgram* programFor(const BatchKey& key) const;
+
+    // Set a uniform of the bound program, if it's changing (as the backend
+    // sets uniforms for custom programs).
+    void setUniform(ShaderProgram& prog, int handle, const float* values,
+                    int count);
+
+    void drawInstanced(const InstancedProgram& prog,
+                       float x1, float y1, float x2, float y2,
+                       float uOffset, float vOffset,
+                       float uScale, float vScale,
+                       int numSprites, const float* sprites);
+    void drawExpanded(float x1, float y1, float x2, float y2,
+                      float uOffset, float vOffset,
+                      float uScale, float vScale,
+                      int numSprites, const float* sprites);
+
+    QuadBatch&    m_batch;
+    GlStateCache& m_state;
+
+    bool m_useInstancing;
+
+    GLuint m_cornerVbo;   // the shared quad's corners
+    GLuint m_spriteVbo;   // per-sprite data, streamed
+
+    // Instanced versions of QuadBatch's default programs (without programs
+    // unless m_useInstancing).
+    InstancedProgram m_program;          // untextured
+    InstancedProgram m_texturedProgram;  // GL_TEXTURE_2D
+};
+
+#endif
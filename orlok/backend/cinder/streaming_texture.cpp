@@ -0,0 +1,194 @@
+#include "streaming_texture.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef GL_ARB_sync
+namespace
+{
+
+// How long to wait for GL to finish with a buffer before giving up and
+// writing to it anyway (nanoseconds).
+const GLuint64 kFenceTimeout = 100 * 1000 * 1000;
+
+} // namespace
+#endif
+
+
+StreamingTexture::StreamingTexture(GlStateCache& state, int width, int height,
+                                   int numBuffers) :
+    m_state(state),
+    m_texture(width, height),
+    m_bufferSize(width * height * 4),
+    m_useBuffers(false),
+    m_useFences(false),
+    m_numBuffers(std::max(1, std::min(numBuffers, kMaxBuffers))),
+    m_current(0),
+    m_mapped(false)
+{
+    // Creating a texture changes the texture binding.
+    m_state.invalidate();
+
+    m_useBuffers = gl::isExtensionAvailable("GL_ARB_pixel_buffer_object");
+#ifdef GL_ARB_sync
+    m_useFences = gl::isExtensionAvailable("GL_ARB_sync");
+#endif
+
+    for (int i = 0; i < kMaxBuffers; ++i)
+    {
+        m_buffers[i] = 0;
+#ifdef GL_ARB_sync
+        m_fences[i] = 0;
+#endif
+    }
+
+    if (m_useBuffers)
+    {
+        glGenBuffers(m_numBuffers, m_buffers);
+        for (int i = 0; i < m_numBuffers; ++i)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[i]);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, m_bufferSize, 0,
+                         GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else
+    {
+        m_fallback.resize(m_bufferSize);
+    }
+}
+
+StreamingTexture::~StreamingTexture()
+{
+#ifdef GL_ARB_sync
+    for (int i = 0; i < m_numBuffers; ++i)
+    {
+        if (m_fences[i])
+        {
+            glDeleteSync(m_fences[i]);
+        }
+    }
+#endif
+
+    if (m_useBuffers)
+    {
+        if (m_mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[m_current]);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        glDeleteBuffers(m_numBuffers, m_buffers);
+    }
+
+    // m_texture is deleted after this, resetting any binding to it.
+    m_state.invalidate();
+}
+
+void StreamingTexture::update(const Surface8u& surface, const Area& area,
+                              const Vec2i& dest)
+{
+    Area clipped = area.getClipBy(surface.getBounds());
+    const int w = std::min(clipped.getWidth(), m_texture.getWidth() - dest.x);
+    const int h = std::min(clipped.getHeight(), m_texture.getHeight() - dest.y);
+
+    if (w <= 0 || h <= 0 || dest.x < 0 || dest.y < 0 ||
+        surface.getPixelInc() != 4)
+    {
+        return;
+    }
+
+    uint8_t* data = beginWrite();
+
+    const size_t rowBytes = w * 4;
+    for (int row = 0; row < h; ++row)
+    {
+        std::memcpy(data + row * rowBytes,
+                    surface.getData(clipped.getUL() + Vec2i(0, row)),
+                    rowBytes);
+    }
+
+    GLint dataFormat;
+    GLenum type;
+    gl::Texture::SurfaceChannelOrderToDataFormatAndType(
+        surface.getChannelOrder(), &dataFormat, &type);
+
+    endWrite(Area(dest.x, dest.y, dest.x + w, dest.y + h), dataFormat, type);
+}
+
+uint8_t* StreamingTexture::beginWrite()
+{
+    if (!m_useBuffers)
+    {
+        return &m_fallback[0];
+    }
+
+    waitForBuffer(m_current);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[m_current]);
+    if (!m_useFences)
+    {
+        // Orphan the old storage: if GL is still reading from it, the driver
+        // hands us new storage rather than making us wait.
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, m_bufferSize, 0, GL_STREAM_DRAW);
+    }
+    void* data = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!data)
+    {
+        // Shouldn't happen, but if it does write to memory this time.
+        m_fallback.resize(m_bufferSize);
+        return &m_fallback[0];
+    }
+
+    m_mapped = true;
+    return static_cast<uint8_t*>(data);
+}
+
+void StreamingTexture::endWrite(const Area& area, GLint dataFormat,
+                                GLenum type)
+{
+    m_state.bindTexture(m_texture.getTarget(), m_texture.getId());
+
+    if (!m_mapped)
+    {
+        glTexSubImage2D(m_texture.getTarget(), 0, area.getX1(), area.getY1(),
+                        area.getWidth(), area.getHeight(), dataFormat, type,
+                        &m_fallback[0]);
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[m_current]);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    m_mapped = false;
+
+    // With a buffer bound the data "pointer" is an offset into it. The copy
+    // happens asynchronously.
+    glTexSubImage2D(m_texture.getTarget(), 0, area.getX1(), area.getY1(),
+                    area.getWidth(), area.getHeight(), dataFormat, type, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+#ifdef GL_ARB_sync
+    if (m_useFences)
+    {
+        m_fences[m_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+#endif
+
+    m_current = (m_current + 1) % m_numBuffers;
+}
+
+void StreamingTexture::waitForBuffer(int index)
+{
+#ifdef GL_ARB_sync
+    if (m_fences[index])
+    {
+        // With enough buffers in the ring this normally returns at once.
+        glClientWaitSync(m_fences[index], GL_SYNC_FLUSH_COMMANDS_BIT,
+                         kFenceTimeout);
+        glDeleteSync(m_fences[index]);
+        m_fences[index] = 0;
+    }
+#endif
+}
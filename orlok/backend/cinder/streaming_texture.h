@@ -0,0 +1,74 @@
+#ifndef orlok_streaming_texture_h
+#define orlok_streaming_texture_h
+
+/*
+A texture for contents that change every frame (eg, a canvas drawn with
+cairo). Pixels are uploaded through a ring of pixel buffer objects: while GL
+copies one buffer into the texture, the next frame's pixels are written into
+another, so neither side waits for the other. A fence on each buffer makes
+sure it isn't overwritten before GL has finished reading it.
+
+Without pixel buffer objects this falls back to uploading straight from
+memory (like gl::Texture::update), and without fences buffers are orphaned
+before being rewritten instead.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/Surface.h"
+#include "gl_state.h"
+#include <vector>
+
+using namespace ci;
+
+
+class StreamingTexture
+{
+public:
+    static const int kMaxBuffers = 3;
+
+    // numBuffers is clamped to 1..kMaxBuffers. Requires a current GL
+    // context.
+    StreamingTexture(GlStateCache& state, int width, int height,
+                     int numBuffers);
+    ~StreamingTexture();
+
+    gl::Texture& texture() { return m_texture; }
+
+    // Copy area of surface into the texture at dest.
+    void update(const Surface8u& surface, const Area& area, const Vec2i& dest);
+
+    // Lower level interface used by update. beginWrite returns memory to
+    // write a tightly packed image of up to the texture's size into (4 bytes
+    // per pixel), which stays valid until endWrite. endWrite then uploads
+    // the image to area of the texture.
+    uint8_t* beginWrite();
+    void endWrite(const Area& area, GLint dataFormat, GLenum type);
+
+    // False if this is using the fallback (no pixel buffer objects).
+    bool usingBuffers() const { return m_useBuffers; }
+
+private:
+    // Wait until GL has finished reading from buffer index.
+    void waitForBuffer(int index);
+
+    GlStateCache& m_state;
+    gl::Texture   m_texture;
+    int           m_bufferSize;
+
+    bool   m_useBuffers;
+    bool   m_useFences;
+    int    m_numBuffers;
+    int    m_current;  // buffer being written (or to be written next)
+    bool   m_mapped;   // whether m_current is mapped (vs. using m_fallback)
+    GLuint m_buffers[kMaxBuffers];
+#ifdef GL_ARB_sync
+    GLsync m_fences[kMaxBuffers];
+#endif
+
+    std::vector<uint8_t> m_fallback;
+};
+
+#endif
@@ -0,0 +1,432 @@
+#include "surface_ops.h"
+#include "cinder/ip/Fill.h"
+#include "cinder/ip/Flip.h"
+#include "cinder/ip/Premultiply.h"
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+namespace
+{
+
+// Kernels work on runs of n 4 byte pixels. The premultiply kernels expect
+// alpha in the last byte of each pixel.
+typedef void (*PixelKernel)(uint8_t* pixels, int n);
+
+//----------------------------------------------------------------------------
+// Plain C++ versions. These define the results the SIMD versions must
+// match, and handle whatever is left over after their last full block.
+
+void premultiply_scalar(uint8_t* p, int n)
+{
+    for (int i = 0; i < n; ++i, p += 4)
+    {
+        uint32_t a = p[3];
+        p[0] = static_cast<uint8_t>(p[0] * a / 255);
+        p[1] = static_cast<uint8_t>(p[1] * a / 255);
+        p[2] = static_cast<uint8_t>(p[2] * a / 255);
+    }
+}
+
+void unpremultiply_scalar(uint8_t* p, int n)
+{
+    for (int i = 0; i < n; ++i, p += 4)
+    {
+        uint32_t a = p[3];
+        if (a != 0)
+        {
+            // Only invalid (color > alpha) pixels need the clamp.
+            p[0] = static_cast<uint8_t>(std::min<uint32_t>(255, p[0] * 255 / a));
+            p[1] = static_cast<uint8_t>(std::min<uint32_t>(255, p[1] * 255 / a));
+            p[2] = static_cast<uint8_t>(std::min<uint32_t>(255, p[2] * 255 / a));
+        }
+    }
+}
+
+void fill_scalar(uint8_t* p, int n, uint32_t pixel)
+{
+    for (int i = 0; i < n; ++i, p += 4)
+    {
+        std::memcpy(p, &pixel, 4);
+    }
+}
+
+void swap_scalar(uint8_t* a, uint8_t* b, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        std::swap(a[i], b[i]);
+    }
+}
+
+#ifdef __SSE2__
+//----------------------------------------------------------------------------
+// SSE2 versions, 4 pixels (16 bytes) at a time.
+
+// x * a / 255 for two pixels widened to 16 bits per channel, using
+// x / 255 == (x + 1 + (x >> 8)) >> 8, which is exact for x <= 255 * 255.
+inline __m128i premultiply_2_pixels(__m128i px)
+{
+    // 255 in the alpha channels (so alpha * 255 / 255 leaves alpha as it
+    // is), and each pixel's alpha in its color channels.
+    const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i all255 = _mm_set1_epi16(255);
+    const __m128i one = _mm_set1_epi16(1);
+
+    __m128i alpha = _mm_shufflehi_epi16(
+        _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i factor = _mm_or_si128(_mm_andnot_si128(alphaMask, alpha),
+                                  _mm_and_si128(alphaMask, all255));
+
+    __m128i x = _mm_mullo_epi16(px, factor);
+    x = _mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8));
+    return _mm_srli_epi16(x, 8);
+}
+
+void premultiply_sse2(uint8_t* p, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int blocks = n / 4;
+    for (int i = 0; i < blocks; ++i, p += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i*>(p));
+        __m128i lo = premultiply_2_pixels(_mm_unpacklo_epi8(v, zero));
+        __m128i hi = premultiply_2_pixels(_mm_unpackhi_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+                         _mm_packus_epi16(lo, hi));
+    }
+
+    premultiply_scalar(p, n % 4);
+}
+
+// Multipliers for unpremultiplying, indexed by alpha: 255 / alpha for the
+// color channels (nudged up by 2^-18 so that truncating the product gives
+// exactly color * 255 / alpha for every color and alpha), and 1 for the
+// alpha channel. All 1 for zero alpha.
+struct UnpremultiplyTable
+{
+    __m128 factors[256];
+
+    UnpremultiplyTable()
+    {
+        factors[0] = _mm_set1_ps(1.0f);
+        for (int a = 1; a < 256; ++a)
+        {
+            float f = static_cast<float>(255.0 / a * (1.0 + 1.0 / 262144));
+            factors[a] = _mm_set_ps(1.0f, f, f, f);
+        }
+    }
+};
+
+inline __m128i unpremultiply_pixel(__m128i px, const uint8_t* p,
+                                   const UnpremultiplyTable& table)
+{
+    __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(px), table.factors[p[3]]);
+    return _mm_cvttps_epi32(x);
+}
+
+void unpremultiply_sse2(uint8_t* p, int n)
+{
+    static const UnpremultiplyTable table;
+    const __m128i zero = _mm_setzero_si128();
+
+    int blocks = n / 4;
+    for (int i = 0; i < blocks; ++i, p += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i*>(p));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+        __m128i p0 = unpremultiply_pixel(_mm_unpacklo_epi16(lo, zero), p, table);
+        __m128i p1 = unpremultiply_pixel(_mm_unpackhi_epi16(lo, zero), p + 4, table);
+        __m128i p2 = unpremultiply_pixel(_mm_unpacklo_epi16(hi, zero), p + 8, table);
+        __m128i p3 = unpremultiply_pixel(_mm_unpackhi_epi16(hi, zero), p + 12, table);
+
+        // Both packs saturate, which clamps to 255.
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+                         _mm_packus_epi16(_mm_packs_epi32(p0, p1),
+                                          _mm_packs_epi32(p2, p3)));
+    }
+
+    unpremultiply_scalar(p, n % 4);
+}
+
+void fill_sse2(uint8_t* p, int n, uint32_t pixel)
+{
+    const __m128i v = _mm_set1_epi32(static_cast<int>(pixel));
+
+    int blocks = n / 4;
+    for (int i = 0; i < blocks; ++i, p += 16)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+    }
+
+    fill_scalar(p, n % 4, pixel);
+}
+
+void swap_sse2(uint8_t* a, uint8_t* b, int bytes)
+{
+    int blocks = bytes / 16;
+    for (int i = 0; i < blocks; ++i, a += 16, b += 16)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<__m128i*>(a));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<__m128i*>(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(a), vb);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(b), va);
+    }
+
+    swap_scalar(a, b, bytes % 16);
+}
+#endif // __SSE2__
+
+//----------------------------------------------------------------------------
+// Dispatch
+
+struct Kernels
+{
+    PixelKernel premultiply;
+    PixelKernel unpremultiply;
+    void (*fill)(uint8_t* pixels, int n, uint32_t pixel);
+    void (*swap)(uint8_t* a, uint8_t* b, int bytes);
+
+    Kernels()
+    {
+        select(true);
+    }
+
+    void select(bool simd)
+    {
+        premultiply = premultiply_scalar;
+        unpremultiply = unpremultiply_scalar;
+        fill = fill_scalar;
+        swap = swap_scalar;
+#ifdef __SSE2__
+        if (simd && cpu_has_sse2())
+        {
+            premultiply = premultiply_sse2;
+            unpremultiply = unpremultiply_sse2;
+            fill = fill_sse2;
+            swap = swap_sse2;
+        }
+#endif
+    }
+};
+
+Kernels& kernels()
+{
+    static Kernels k;
+    return k;
+}
+
+// True if the fast paths can handle surface's pixels.
+bool is_4_byte(const Surface8u& surface)
+{
+    return surface.getPixelInc() == 4;
+}
+
+// True if surface has alpha in the last byte of each pixel, as the
+// premultiply kernels need.
+bool has_last_byte_alpha(const Surface8u& surface)
+{
+    return is_4_byte(surface) && surface.hasAlpha() &&
+           surface.getChannelOrder().getAlphaOffset() == 3;
+}
+
+// Apply kernel to every row of surface.
+void apply_to_rows(Surface8u& surface, PixelKernel kernel)
+{
+    for (int y = 0; y < surface.getHeight(); ++y)
+    {
+        kernel(surface.getData(Vec2i(0, y)), surface.getWidth());
+    }
+}
+
+bool within_surface(const Surface8u& surface, const Area& area)
+{
+    return area.getX1() >= 0 && area.getY1() >= 0 &&
+           area.getX2() <= surface.getWidth() &&
+           area.getY2() <= surface.getHeight() &&
+           area.getX1() <= area.getX2() && area.getY1() <= area.getY2();
+}
+
+inline uint8_t to_byte(float value)
+{
+    return static_cast<uint8_t>(
+        std::max(0.0f, std::min(1.0f, value)) * 255.0f + 0.5f);
+}
+
+} // namespace
+
+
+bool cpu_has_sse2()
+{
+#if defined(__SSE2__) && defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    return sysctlbyname("hw.optional.sse2", &value, &size, 0, 0) == 0 &&
+           value != 0;
+#elif defined(__SSE2__)
+    // Part of the baseline we were compiled for.
+    return true;
+#else
+    return false;
+#endif
+}
+
+void set_simd_enabled(bool enabled)
+{
+    kernels().select(enabled);
+}
+
+void premultiply_surface(Surface8u& surface)
+{
+    if (!has_last_byte_alpha(surface))
+    {
+        ip::premultiply(&surface);
+        return;
+    }
+
+    apply_to_rows(surface, kernels().premultiply);
+    surface.setPremultiplied(true);
+}
+
+void unpremultiply_surface(Surface8u& surface)
+{
+    if (!has_last_byte_alpha(surface))
+    {
+        ip::unpremultiply(&surface);
+        return;
+    }
+
+    apply_to_rows(surface, kernels().unpremultiply);
+    surface.setPremultiplied(false);
+}
+
+void fill_surface(Surface8u& surface, const ColorA8u& color,
+                  const Area& area)
+{
+    if (!is_4_byte(surface))
+    {
+        ip::fill(&surface, color, area);
+        return;
+    }
+
+    Area clipped = area.getClipBy(surface.getBounds());
+    if (clipped.getWidth() <= 0 || clipped.getHeight() <= 0)
+    {
+        return;
+    }
+
+    const SurfaceChannelOrder& order = surface.getChannelOrder();
+    uint8_t bytes[4] = { 0, 0, 0, 0 };
+    bytes[order.getRedOffset()] = color.r;
+    bytes[order.getGreenOffset()] = color.g;
+    bytes[order.getBlueOffset()] = color.b;
+    if (surface.hasAlpha())
+    {
+        bytes[order.getAlphaOffset()] = color.a;
+    }
+    uint32_t pixel;
+    std::memcpy(&pixel, bytes, 4);
+
+    for (int y = clipped.getY1(); y < clipped.getY2(); ++y)
+    {
+        kernels().fill(surface.getData(Vec2i(clipped.getX1(), y)),
+                       clipped.getWidth(), pixel);
+    }
+}
+
+void flip_surface_vertical(Surface8u& surface)
+{
+    const int rowBytes = surface.getWidth() * surface.getPixelInc();
+    const int height = surface.getHeight();
+
+    for (int y = 0; y < height / 2; ++y)
+    {
+        kernels().swap(surface.getData(Vec2i(0, y)),
+                       surface.getData(Vec2i(0, height - 1 - y)),
+                       rowBytes);
+    }
+}
+
+bool read_surface_colors(const Surface8u& surface, const Area& area,
+                         bool premultiplied, float* rgba)
+{
+    if (!within_surface(surface, area))
+    {
+        return false;
+    }
+
+    const SurfaceChannelOrder& order = surface.getChannelOrder();
+    const int r = order.getRedOffset();
+    const int g = order.getGreenOffset();
+    const int b = order.getBlueOffset();
+    const int a = surface.hasAlpha() ? order.getAlphaOffset() : -1;
+    const int inc = surface.getPixelInc();
+    const float kInv255 = 1.0f / 255.0f;
+
+    for (int y = area.getY1(); y < area.getY2(); ++y)
+    {
+        const uint8_t* p = surface.getData(Vec2i(area.getX1(), y));
+        for (int x = area.getX1(); x < area.getX2(); ++x, p += inc, rgba += 4)
+        {
+            float alpha = a >= 0 ? p[a] * kInv255 : 1.0f;
+            float scale = kInv255;
+            if (premultiplied && a >= 0)
+            {
+                // Zero alpha has no color to recover.
+                scale = p[a] != 0 ? 1.0f / p[a] : 0.0f;
+            }
+
+            rgba[0] = std::min(1.0f, p[r] * scale);
+            rgba[1] = std::min(1.0f, p[g] * scale);
+            rgba[2] = std::min(1.0f, p[b] * scale);
+            rgba[3] = alpha;
+        }
+    }
+    return true;
+}
+
+bool write_surface_colors(Surface8u& surface, const Area& area,
+                          bool premultiplied, const float* rgba)
+{
+    if (!within_surface(surface, area))
+    {
+        return false;
+    }
+
+    const SurfaceChannelOrder& order = surface.getChannelOrder();
+    const int r = order.getRedOffset();
+    const int g = order.getGreenOffset();
+    const int b = order.getBlueOffset();
+    const int a = surface.hasAlpha() ? order.getAlphaOffset() : -1;
+    const int inc = surface.getPixelInc();
+
+    for (int y = area.getY1(); y < area.getY2(); ++y)
+    {
+        uint8_t* p = surface.getData(Vec2i(area.getX1(), y));
+        for (int x = area.getX1(); x < area.getX2(); ++x, p += inc, rgba += 4)
+        {
+            float alpha = std::max(0.0f, std::min(1.0f, rgba[3]));
+            float scale = premultiplied && a >= 0 ? alpha : 1.0f;
+
+            p[r] = to_byte(rgba[0] * scale);
+            p[g] = to_byte(rgba[1] * scale);
+            p[b] = to_byte(rgba[2] * scale);
+            if (a >= 0)
+            {
+                p[a] = to_byte(alpha);
+            }
+        }
+    }
+    return true;
+}
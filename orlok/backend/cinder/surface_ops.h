@@ -0,0 +1,58 @@
+#ifndef orlok_surface_ops_h
+#define orlok_surface_ops_h
+
+/*
+Faster versions of the cinder::ip operations the backend applies to whole
+surfaces (premultiply, unpremultiply, fill and vertical flip), with SSE2
+kernels chosen at runtime when the CPU has them. Results are identical to
+the plain C++ versions, bit for bit.
+
+The fast paths handle 8 bit surfaces with 4 bytes per pixel (which is what
+cairo uses), and premultiplying needs alpha in the last byte (as with
+cairo's BGRA). Anything else is passed on to cinder::ip.
+
+Also converts rects of pixels to and from straight (not premultiplied)
+float colors, so that the Dylan side can move whole spans at once.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/Surface.h"
+
+using namespace ci;
+
+
+// True if SSE2 kernels were compiled in and this CPU can run them.
+bool cpu_has_sse2();
+
+// With enabled false, use the plain C++ kernels even where faster ones
+// could run (eg, to compare the two; see surface_ops_bench.cpp). Not safe
+// while other threads use the functions below.
+void set_simd_enabled(bool enabled);
+
+// color = color * alpha / 255, rounding down.
+void premultiply_surface(Surface8u& surface);
+
+// color = min(255, color * 255 / alpha), rounding down, for non-zero alpha.
+// Pixels with zero alpha are left alone.
+void unpremultiply_surface(Surface8u& surface);
+
+// Set the pixels of area (clipped to the surface) to color.
+void fill_surface(Surface8u& surface, const ColorA8u& color,
+                  const Area& area);
+
+void flip_surface_vertical(Surface8u& surface);
+
+// Copy area's pixels, row by row, into rgba as 4 floats (0 to 1) per pixel
+// in r, g, b, a order, undoing premultiplication if premultiplied is true.
+// Surfaces without alpha read as opaque. Returns false (doing nothing) if
+// area isn't entirely within the surface.
+bool read_surface_colors(const Surface8u& surface, const Area& area,
+                         bool premultiplied, float* rgba);
+
+// The reverse of read_surface_colors: set area's pixels from rgba (clamping
+// to 0 to 1 and rounding), premultiplying if premultiplied is true.
+bool write_surface_colors(Surface8u& surface, const Area& area,
+                          bool premultiplied, const float* rgba);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+Micro-benchmark for surface_ops: times premultiply, unpremultiply, fill and
+vertical flip on a large surface with the plain C++ kernels and with the
+SIMD ones, and checks that both give the same pixels.
+
+Build with "make bench", then run
+    ./surface_ops_bench [size [repeats]]
+to use a size x size surface (2048 by default), timing each operation
+repeats times (20 by default).
+
+Not part of the backend library.
+*/
+
+#include "surface_ops.h"
+#include "cinder/Timer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+namespace
+{
+
+enum Op
+{
+    kPremultiply,
+    kUnpremultiply,
+    kFill,
+    kFlip,
+
+    kNumOps
+};
+
+const char* k_op_names[kNumOps] = {
+    "premultiply",
+    "unpremultiply",
+    "fill",
+    "flip vertical"
+};
+
+// Random, but the same every run, and valid premultiplied pixels (no color
+// above its alpha), so unpremultiply sees realistic input.
+void make_pixels(Surface8u& surface)
+{
+    uint32_t seed = 12345;
+    for (int y = 0; y < surface.getHeight(); ++y)
+    {
+        uint8_t* p = surface.getData(Vec2i(0, y));
+        for (int x = 0; x < surface.getWidth(); ++x, p += 4)
+        {
+            seed = seed * 1664525 + 1013904223;
+            uint32_t a = seed >> 24;
+            p[0] = static_cast<uint8_t>(((seed >> 16) & 0xff) * a / 255);
+            p[1] = static_cast<uint8_t>(((seed >> 8) & 0xff) * a / 255);
+            p[2] = static_cast<uint8_t>((seed & 0xff) * a / 255);
+            p[3] = static_cast<uint8_t>(a);
+        }
+    }
+}
+
+void copy_pixels(const Surface8u& from, Surface8u& to)
+{
+    to.copyFrom(from, from.getBounds());
+}
+
+void run_op(Op op, Surface8u& surface)
+{
+    switch (op)
+    {
+    case kPremultiply:
+        premultiply_surface(surface);
+        break;
+    case kUnpremultiply:
+        unpremultiply_surface(surface);
+        break;
+    case kFill:
+        fill_surface(surface, ColorA8u(10, 20, 30, 40), surface.getBounds());
+        break;
+    case kFlip:
+        flip_surface_vertical(surface);
+        break;
+    default:
+        break;
+    }
+}
+
+// Mean milliseconds per run of op, starting from input each time.
+double time_op(Op op, const Surface8u& input, Surface8u& work, int repeats)
+{
+    double total = 0.0;
+    for (int i = 0; i < repeats; ++i)
+    {
+        copy_pixels(input, work);
+        Timer timer(true);
+        run_op(op, work);
+        total += timer.getSeconds();
+    }
+    return total / repeats * 1000.0;
+}
+
+bool same_pixels(const Surface8u& a, const Surface8u& b)
+{
+    const size_t rowBytes = a.getWidth() * 4;
+    for (int y = 0; y < a.getHeight(); ++y)
+    {
+        if (std::memcmp(a.getData(Vec2i(0, y)), b.getData(Vec2i(0, y)),
+                        rowBytes) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+    const int size = argc > 1 ? std::atoi(argv[1]) : 2048;
+    const int repeats = argc > 2 ? std::atoi(argv[2]) : 20;
+    if (size < 1 || repeats < 1)
+    {
+        std::fprintf(stderr, "usage: %s [size [repeats]]\n", argv[0]);
+        return 2;
+    }
+
+    // cairo's layout, as for every surface the backend makes.
+    Surface8u input(size, size, true, SurfaceChannelOrder::BGRA);
+    Surface8u scalar(size, size, true, SurfaceChannelOrder::BGRA);
+    Surface8u simd(size, size, true, SurfaceChannelOrder::BGRA);
+    make_pixels(input);
+
+    std::printf("%dx%d surface, %d runs each, SSE2 %s\n", size, size,
+                repeats, cpu_has_sse2() ? "available" : "not available");
+    std::printf("%-14s %10s %10s %8s  %s\n", "", "scalar ms", "simd ms",
+                "speedup", "result");
+
+    bool allSame = true;
+    for (int op = 0; op < kNumOps; ++op)
+    {
+        set_simd_enabled(false);
+        double scalarMs = time_op(static_cast<Op>(op), input, scalar,
+                                  repeats);
+        set_simd_enabled(true);
+        double simdMs = time_op(static_cast<Op>(op), input, simd, repeats);
+
+        // Each surface holds the result of its last run, from input.
+        bool same = same_pixels(scalar, simd);
+        allSame = allSame && same;
+
+        std::printf("%-14s %10.3f %10.3f %7.2fx  %s\n", k_op_names[op],
+                    scalarMs, simdMs, scalarMs / std::max(simdMs, 1.0e-9),
+                    same ? "identical" : "DIFFERENT");
+    }
+
+    return allSame ? 0 : 1;
+}
@@ -0,0 +1,413 @@
+#include "texture_atlas.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+struct TallerFirst
+{
+    explicit TallerFirst(const std::vector<int>& heights) : h(heights) {}
+
+    bool operator()(int a, int b) const { return h[a] > h[b]; }
+
+    const std::vector<int>& h;
+};
+
+} // namespace
+
+
+TextureAtlas::TextureAtlas(GlStateCache& state, int pageSize, int padding) :
+    m_state(state),
+    m_pageSize(pageSize),
+    m_padding(padding)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+    for (size_t i = 0; i < m_pages.size(); ++i)
+    {
+        delete m_pages[i].texture;
+    }
+    m_state.invalidate();
+}
+
+int TextureAtlas::add(const Surface8u& surface, const Area& area)
+{
+    Entry e;
+    e.w = area.getWidth() + 2 * m_padding;
+    e.h = area.getHeight() + 2 * m_padding;
+    e.live = true;
+
+    if (!allocate(m_pages, e.w, e.h, &e.page, &e.x, &e.y))
+    {
+        return -1;
+    }
+
+    upload(e, surface, area);
+
+    Page& page = m_pages[e.page];
+    page.usedArea += e.w * e.h;
+    ++page.numEntries;
+
+    int id;
+    if (m_freeEntries.empty())
+    {
+        id = static_cast<int>(m_entries.size());
+        m_entries.push_back(e);
+    }
+    else
+    {
+        id = m_freeEntries.back();
+        m_freeEntries.pop_back();
+        m_entries[id] = e;
+    }
+
+    return id;
+}
+
+bool TextureAtlas::update(int entry, const Surface8u& surface,
+                          const Area& area)
+{
+    if (entry < 0 || entry >= static_cast<int>(m_entries.size()) ||
+        !m_entries[entry].live)
+    {
+        return false;
+    }
+
+    const Entry& e = m_entries[entry];
+
+    if (area.getWidth() + 2 * m_padding != e.w ||
+        area.getHeight() + 2 * m_padding != e.h)
+    {
+        return false;
+    }
+
+    upload(e, surface, area);
+    return true;
+}
+
+void TextureAtlas::remove(int entry)
+{
+    if (entry < 0 || entry >= static_cast<int>(m_entries.size()) ||
+        !m_entries[entry].live)
+    {
+        return;
+    }
+
+    Entry& e = m_entries[entry];
+    Page& page = m_pages[e.page];
+
+    page.usedArea -= e.w * e.h;
+    if (--page.numEntries == 0)
+    {
+        resetSkyline(page);
+    }
+
+    e.live = false;
+    m_freeEntries.push_back(entry);
+}
+
+void TextureAtlas::defragment()
+{
+    // Repack tallest first, which packs a skyline much more tightly.
+    std::vector<int> order;
+    std::vector<int> heights(m_entries.size());
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (m_entries[i].live)
+        {
+            order.push_back(static_cast<int>(i));
+            heights[i] = m_entries[i].h;
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), TallerFirst(heights));
+
+    std::vector<Page> pages;
+    std::vector<Entry> moved(m_entries);
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        Entry& e = moved[order[i]];
+        // Can't fail: everything fitted in a page before.
+        allocate(pages, e.w, e.h, &e.page, &e.x, &e.y);
+        pages[e.page].usedArea += e.w * e.h;
+        ++pages[e.page].numEntries;
+    }
+
+    // Copy texels from the old pages to the new ones by attaching each old
+    // page to a framebuffer and reading from it.
+    // (Defragmenting is rare, so querying GL here is fine.)
+    GLint prevFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prevFramebuffer);
+    GLuint fbo = 0;
+    glGenFramebuffersEXT(1, &fbo);
+    m_state.bindFramebuffer(fbo);
+
+    for (size_t p = 0; p < m_pages.size(); ++p)
+    {
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                  GL_TEXTURE_2D, m_pages[p].texture->getId(), 0);
+
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const Entry& from = m_entries[order[i]];
+            const Entry& to = moved[order[i]];
+
+            if (from.page != static_cast<int>(p))
+            {
+                continue;
+            }
+
+            m_state.bindTexture(GL_TEXTURE_2D, pages[to.page].texture->getId());
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, to.x, to.y,
+                                from.x, from.y, from.w, from.h);
+        }
+    }
+
+    m_state.bindFramebuffer(static_cast<GLuint>(prevFramebuffer));
+    glDeleteFramebuffersEXT(1, &fbo);
+
+    for (size_t p = 0; p < m_pages.size(); ++p)
+    {
+        delete m_pages[p].texture;
+    }
+    // Deleting textures resets any binding to them.
+    m_state.invalidate();
+
+    m_pages.swap(pages);
+    m_entries.swap(moved);
+}
+
+bool TextureAtlas::entryInfo(int entry, gl::Texture** page,
+                             float* u1, float* v1, float* u2, float* v2) const
+{
+    if (entry < 0 || entry >= static_cast<int>(m_entries.size()) ||
+        !m_entries[entry].live)
+    {
+        return false;
+    }
+
+    const Entry& e = m_entries[entry];
+    const float scale = 1.0f / m_pageSize;
+
+    *page = m_pages[e.page].texture;
+    *u1 = (e.x + m_padding) * scale;
+    *v1 = (e.y + m_padding) * scale;
+    *u2 = (e.x + e.w - m_padding) * scale;
+    *v2 = (e.y + e.h - m_padding) * scale;
+    return true;
+}
+
+float TextureAtlas::usage() const
+{
+    if (m_pages.empty())
+    {
+        return 0.0f;
+    }
+
+    double used = 0.0;
+    for (size_t i = 0; i < m_pages.size(); ++i)
+    {
+        used += m_pages[i].usedArea;
+    }
+
+    double total = static_cast<double>(m_pageSize) * m_pageSize *
+                   m_pages.size();
+    return static_cast<float>(used / total);
+}
+
+int TextureAtlas::newPage(std::vector<Page>& pages)
+{
+    Page page;
+    page.texture = new gl::Texture(m_pageSize, m_pageSize);
+    page.usedArea = 0;
+    page.numEntries = 0;
+    resetSkyline(page);
+
+    // Creating a texture changes the texture binding.
+    m_state.invalidate();
+
+    pages.push_back(page);
+    return static_cast<int>(pages.size()) - 1;
+}
+
+void TextureAtlas::resetSkyline(Page& page) const
+{
+    SkylineNode node = { 0, 0, m_pageSize };
+    page.skyline.assign(1, node);
+}
+
+bool TextureAtlas::allocate(std::vector<Page>& pages, int w, int h,
+                            int* page, int* x, int* y)
+{
+    if (w > m_pageSize || h > m_pageSize)
+    {
+        return false;
+    }
+
+    // Use the first page with room, placing the rect as low (ie, near the
+    // top of the texture) as possible, then in the narrowest gap.
+    for (size_t p = 0; p <= pages.size(); ++p)
+    {
+        if (p == pages.size())
+        {
+            newPage(pages);
+        }
+
+        Page& pg = pages[p];
+        int bestIndex = -1;
+        int bestBottom = 0;
+        int bestWidth = 0;
+
+        for (size_t i = 0; i < pg.skyline.size(); ++i)
+        {
+            int top = skylineFit(pg, static_cast<int>(i), w, h);
+            if (top < 0)
+            {
+                continue;
+            }
+
+            int bottom = top + h;
+            int width = pg.skyline[i].width;
+            if (bestIndex < 0 || bottom < bestBottom ||
+                (bottom == bestBottom && width < bestWidth))
+            {
+                bestIndex = static_cast<int>(i);
+                bestBottom = bottom;
+                bestWidth = width;
+            }
+        }
+
+        if (bestIndex >= 0)
+        {
+            *page = static_cast<int>(p);
+            *x = pg.skyline[bestIndex].x;
+            *y = bestBottom - h;
+            skylinePlace(pg, bestIndex, *x, *y, w, h);
+            return true;
+        }
+    }
+
+    return false; // not reached: a new page always fits
+}
+
+// Return the y at which a w x h rect fits with its left edge at skyline node
+// index, or -1 if it doesn't fit there.
+int TextureAtlas::skylineFit(const Page& page, int index, int w, int h) const
+{
+    const std::vector<SkylineNode>& sky = page.skyline;
+    int x = sky[index].x;
+
+    if (x + w > m_pageSize)
+    {
+        return -1;
+    }
+
+    int y = 0;
+    int remaining = w;
+
+    for (size_t i = index; remaining > 0; ++i)
+    {
+        y = std::max(y, sky[i].y);
+        if (y + h > m_pageSize)
+        {
+            return -1;
+        }
+        remaining -= sky[i].width;
+    }
+
+    return y;
+}
+
+void TextureAtlas::skylinePlace(Page& page, int index,
+                                int x, int y, int w, int h)
+{
+    std::vector<SkylineNode>& sky = page.skyline;
+
+    SkylineNode node = { x, y + h, w };
+    sky.insert(sky.begin() + index, node);
+
+    // Trim (or remove) the nodes now covered by the new one.
+    for (size_t i = index + 1; i < sky.size(); )
+    {
+        int prevRight = sky[i - 1].x + sky[i - 1].width;
+        if (sky[i].x >= prevRight)
+        {
+            break;
+        }
+
+        int shrink = prevRight - sky[i].x;
+        sky[i].x += shrink;
+        sky[i].width -= shrink;
+
+        if (sky[i].width > 0)
+        {
+            break;
+        }
+        sky.erase(sky.begin() + i);
+    }
+
+    // Merge neighbours at the same height.
+    for (size_t i = 0; i + 1 < sky.size(); )
+    {
+        if (sky[i].y == sky[i + 1].y)
+        {
+            sky[i].width += sky[i + 1].width;
+            sky.erase(sky.begin() + i + 1);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void TextureAtlas::upload(const Entry& entry, const Surface8u& surface,
+                          const Area& area)
+{
+    const int p = m_padding;
+    const int w = area.getWidth();
+    const int h = area.getHeight();
+    const int inc = surface.getPixelInc();
+
+    // Build the padded image: the source in the middle, with its edge
+    // pixels repeated out into the padding.
+    Surface8u padded(entry.w, entry.h, surface.hasAlpha(),
+                     surface.getChannelOrder());
+
+    for (int row = 0; row < h; ++row)
+    {
+        const uint8_t* src = surface.getData(Vec2i(area.getX1(),
+                                                   area.getY1() + row));
+        uint8_t* dst = padded.getData(Vec2i(0, p + row));
+
+        for (int i = 0; i < p; ++i)
+        {
+            std::memcpy(dst + i * inc, src, inc);
+            std::memcpy(dst + (p + w + i) * inc, src + (w - 1) * inc, inc);
+        }
+        std::memcpy(dst + p * inc, src, w * inc);
+    }
+
+    for (int i = 0; i < p; ++i)
+    {
+        std::memcpy(padded.getData(Vec2i(0, i)),
+                    padded.getData(Vec2i(0, p)), entry.w * inc);
+        std::memcpy(padded.getData(Vec2i(0, p + h + i)),
+                    padded.getData(Vec2i(0, p + h - 1)), entry.w * inc);
+    }
+
+    GLint dataFormat;
+    GLenum type;
+    gl::Texture::SurfaceChannelOrderToDataFormatAndType(
+        padded.getChannelOrder(), &dataFormat, &type);
+
+    m_state.bindTexture(GL_TEXTURE_2D, m_pages[entry.page].texture->getId());
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, padded.getRowBytes() / inc);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, entry.x, entry.y, entry.w, entry.h,
+                    dataFormat, type, padded.getData());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
@@ -0,0 +1,103 @@
+#ifndef orlok_texture_atlas_h
+#define orlok_texture_atlas_h
+
+/*
+Packs many small images into a few large textures ("pages"), so that quads
+drawn from different images can share a texture binding (and therefore a
+batch).
+
+Entries are placed with a skyline bottom-left packer. Each entry is
+surrounded by padding filled by extruding its edge pixels, so that bilinear
+filtering never samples a neighbouring entry.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/Surface.h"
+#include "gl_state.h"
+#include <vector>
+
+using namespace ci;
+
+
+class TextureAtlas
+{
+public:
+    // All texture and framebuffer binding goes through state.
+    TextureAtlas(GlStateCache& state, int pageSize, int padding);
+    // Frees all pages. Requires a current GL context.
+    ~TextureAtlas();
+
+    // Copy area of surface into the atlas, adding a new page if necessary.
+    // Returns the new entry's id, or -1 if area (plus padding) is larger
+    // than a page.
+    int add(const Surface8u& surface, const Area& area);
+
+    // Replace the pixels of an entry. area must be the same size as the
+    // entry. Returns false on failure.
+    bool update(int entry, const Surface8u& surface, const Area& area);
+
+    // Free an entry's space. Pages that become empty are reused by later
+    // adds, but partially used pages are only compacted by defragment().
+    void remove(int entry);
+
+    // Repack all entries into as few pages as possible, copying texels on
+    // the GPU. Entry ids stay the same, but their pages and texture
+    // coordinates may change.
+    void defragment();
+
+    // Get the page texture holding entry, and entry's normalized texture
+    // coordinates within it. Returns false for an invalid entry.
+    bool entryInfo(int entry, gl::Texture** page,
+                   float* u1, float* v1, float* u2, float* v2) const;
+
+    int numPages() const { return static_cast<int>(m_pages.size()); }
+
+    // Fraction of the total page area used by entries (including padding).
+    float usage() const;
+
+private:
+    struct SkylineNode
+    {
+        int x, y, width;
+    };
+
+    struct Page
+    {
+        gl::Texture*             texture;
+        std::vector<SkylineNode> skyline;
+        int                      usedArea;
+        int                      numEntries;
+    };
+
+    // x, y, w and h describe the padded rect (ie, including padding).
+    struct Entry
+    {
+        int  page;
+        int  x, y, w, h;
+        bool live;
+    };
+
+    int newPage(std::vector<Page>& pages);
+    void resetSkyline(Page& page) const;
+    // Find space for a padded w x h rect in pages, adding a page if needed.
+    bool allocate(std::vector<Page>& pages, int w, int h,
+                  int* page, int* x, int* y);
+    int skylineFit(const Page& page, int index, int w, int h) const;
+    void skylinePlace(Page& page, int index, int x, int y, int w, int h);
+
+    void upload(const Entry& entry, const Surface8u& surface,
+                const Area& area);
+
+    GlStateCache& m_state;
+    int           m_pageSize;
+    int           m_padding;
+
+    std::vector<Page>  m_pages;
+    std::vector<Entry> m_entries;
+    std::vector<int>   m_freeEntries; // ids of removed entries, for reuse
+};
+
+#endif
@@ -0,0 +1,330 @@
+#include "texture_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+const char kMagic[4] = { 'O', 'K', 'T', 'X' };
+const uint32_t kMaxLevels = 32;
+
+// 64 bit FNV-1a.
+const uint64_t kHashSeed = 14695981039346656037ULL;
+
+uint64_t hash_bytes(const uint8_t* bytes, size_t n, uint64_t hash)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool hash_file(const std::string& path, uint64_t* hash)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    *hash = kHashSeed;
+    uint8_t buffer[64 * 1024];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        *hash = hash_bytes(buffer, n, *hash);
+    }
+
+    bool ok = !std::ferror(file);
+    std::fclose(file);
+    return ok;
+}
+
+bool stat_file(const std::string& path, uint64_t* size, int64_t* time)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    *size = static_cast<uint64_t>(st.st_size);
+    *time = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+size_t align16(size_t n)
+{
+    return (n + 15) & ~static_cast<size_t>(15);
+}
+
+bool write_all(std::FILE* file, const void* data, size_t n)
+{
+    return std::fwrite(data, 1, n, file) == n;
+}
+
+bool write_padding(std::FILE* file, size_t n)
+{
+    static const uint8_t zeros[16] = { 0 };
+    return write_all(file, zeros, n);
+}
+
+} // namespace
+
+
+CookedImage::CookedImage(void* map, size_t size) :
+    m_map(map),
+    m_size(size)
+{
+}
+
+CookedImage::~CookedImage()
+{
+    munmap(m_map, m_size);
+}
+
+
+TextureCache::TextureCache(const std::string& dir) :
+    m_dir(dir),
+    m_hits(0),
+    m_misses(0),
+    m_tempCounter(0)
+{
+    // Fails harmlessly if it's already there; if it can't be made, every
+    // lookup misses and every store fails.
+    mkdir(m_dir.c_str(), 0755);
+}
+
+std::string TextureCache::cookedPath(const std::string& sourcePath,
+                                     int mipFilter) const
+{
+    uint64_t hash = hash_bytes(
+        reinterpret_cast<const uint8_t*>(sourcePath.data()),
+        sourcePath.size(), kHashSeed);
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "/%016llx-%d.tex",
+                  static_cast<unsigned long long>(hash), mipFilter);
+    return m_dir + name;
+}
+
+void TextureCache::countLookup(bool hit)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if (hit)
+    {
+        ++m_hits;
+    }
+    else
+    {
+        ++m_misses;
+    }
+}
+
+CookedImageRef TextureCache::find(const std::string& sourcePath,
+                                  int mipFilter)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!stat_file(sourcePath, &sourceSize, &sourceTime))
+    {
+        countLookup(false);
+        return CookedImageRef();
+    }
+
+    std::string path = cookedPath(sourcePath, mipFilter);
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        countLookup(false);
+        return CookedImageRef();
+    }
+
+    struct stat st;
+    CookedHeader header;
+    bool ok = fstat(fd, &st) == 0 &&
+              static_cast<size_t>(st.st_size) >= sizeof(header) &&
+              pread(fd, &header, sizeof(header), 0) ==
+                  static_cast<ssize_t>(sizeof(header)) &&
+              std::memcmp(header.magic, kMagic, 4) == 0 &&
+              header.version == kVersion &&
+              header.numLevels >= 1 && header.numLevels <= kMaxLevels &&
+              static_cast<int>(header.mipFilter) == mipFilter &&
+              header.sourceSize == sourceSize;
+
+    // File times may only be to the second, so a source changed (to the same
+    // size) just after it was cooked could have the time recorded. Trust
+    // the time only if it's well before the cooked file was written.
+    bool timeTrusted = header.sourceTime == sourceTime &&
+                       sourceTime + 2 <= static_cast<int64_t>(st.st_mtime);
+
+    if (ok && !timeTrusted)
+    {
+        // Touched (eg, by a checkout) but maybe not changed.
+        uint64_t hash;
+        ok = hash_file(sourcePath, &hash) && hash == header.sourceHash;
+        if (ok)
+        {
+            // A short write (eg, a full disk) may leave the file's header
+            // torn, so then the file goes, to be cooked again next time.
+            // The levels (and our copy of the header) are still fine.
+            header.sourceTime = sourceTime;
+            if (pwrite(fd, &header, sizeof(header), 0) !=
+                static_cast<ssize_t>(sizeof(header)))
+            {
+                unlink(path.c_str());
+            }
+        }
+    }
+
+    void* map = MAP_FAILED;
+    if (ok)
+    {
+        // Private and writable, so that the levels can be wrapped in
+        // (non-const) Surfaces without any risk to the file.
+        map = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        countLookup(false);
+        return CookedImageRef();
+    }
+
+    CookedImageRef image(new CookedImage(map, st.st_size));
+    uint8_t* bytes = static_cast<uint8_t*>(map);
+    const CookedLevel* levels =
+        reinterpret_cast<const CookedLevel*>(bytes + sizeof(header));
+    size_t tableEnd = sizeof(header) + header.numLevels * sizeof(CookedLevel);
+    SurfaceChannelOrder order(header.channelOrder);
+
+    for (uint32_t i = 0; i < header.numLevels && ok; ++i)
+    {
+        const CookedLevel& level = levels[i];
+        uint64_t end = level.offset +
+                       static_cast<uint64_t>(level.rowBytes) * level.height;
+        ok = tableEnd <= static_cast<size_t>(st.st_size) &&
+             level.width > 0 && level.height > 0 &&
+             level.rowBytes >= level.width * 4 &&
+             level.offset >= tableEnd &&
+             end <= static_cast<uint64_t>(st.st_size);
+        if (ok)
+        {
+            Surface surface(bytes + level.offset, level.width, level.height,
+                            level.rowBytes, order);
+            surface.setPremultiplied(header.hasAlpha != 0);
+            image->m_levels.push_back(surface);
+        }
+    }
+
+    if (!ok)
+    {
+        countLookup(false);
+        return CookedImageRef();
+    }
+
+    countLookup(true);
+    return image;
+}
+
+bool TextureCache::store(const std::string& sourcePath, int mipFilter,
+                         const Surface& base,
+                         const std::vector<Surface>& levels)
+{
+    if (base.getPixelInc() != 4 || levels.size() + 1 > kMaxLevels)
+    {
+        return false;
+    }
+
+    CookedHeader header;
+    std::memcpy(header.magic, kMagic, 4);
+    header.version = kVersion;
+    header.channelOrder = base.getChannelOrder().getCode();
+    header.hasAlpha = base.hasAlpha() ? 1 : 0;
+    header.numLevels = static_cast<uint32_t>(levels.size() + 1);
+    header.mipFilter = static_cast<uint32_t>(mipFilter);
+    if (!stat_file(sourcePath, &header.sourceSize, &header.sourceTime) ||
+        !hash_file(sourcePath, &header.sourceHash))
+    {
+        return false;
+    }
+
+    std::vector<const Surface*> surfaces;
+    surfaces.push_back(&base);
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        surfaces.push_back(&levels[i]);
+    }
+
+    std::vector<CookedLevel> table(surfaces.size());
+    size_t offset = align16(sizeof(header) + table.size() * sizeof(CookedLevel));
+    for (size_t i = 0; i < surfaces.size(); ++i)
+    {
+        const Surface& s = *surfaces[i];
+        table[i].width = s.getWidth();
+        table[i].height = s.getHeight();
+        table[i].rowBytes = s.getWidth() * 4;
+        table[i].reserved = 0;
+        table[i].offset = offset;
+        offset = align16(offset + table[i].rowBytes * table[i].height);
+    }
+
+    std::string path = cookedPath(sourcePath, mipFilter);
+    std::ostringstream temp;
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        temp << path << ".tmp" << getpid() << "-" << m_tempCounter++;
+    }
+
+    std::FILE* file = std::fopen(temp.str().c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+
+    size_t written = sizeof(header) + table.size() * sizeof(CookedLevel);
+    bool ok = write_all(file, &header, sizeof(header)) &&
+              write_all(file, &table[0], table.size() * sizeof(CookedLevel));
+
+    for (size_t i = 0; i < surfaces.size() && ok; ++i)
+    {
+        ok = write_padding(file, table[i].offset - written);
+        written = table[i].offset;
+
+        const Surface& s = *surfaces[i];
+        for (int y = 0; y < s.getHeight() && ok; ++y)
+        {
+            ok = write_all(file, s.getData(Vec2i(0, y)), table[i].rowBytes);
+        }
+        written += table[i].rowBytes * table[i].height;
+    }
+
+    ok = std::fclose(file) == 0 && ok;
+    if (ok)
+    {
+        ok = std::rename(temp.str().c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        std::remove(temp.str().c_str());
+    }
+    return ok;
+}
+
+int TextureCache::hits() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+int TextureCache::misses() const
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_misses;
+}
@@ -0,0 +1,119 @@
+#ifndef orlok_texture_cache_h
+#define orlok_texture_cache_h
+
+/*
+An on-disk cache of decoded images ("cooked" textures), so that starting an
+app again doesn't decode its images again. Each cooked file holds an
+image's pixels exactly as the backend uses them (premultiplied, in cairo's
+channel order), optionally followed by its mip chain, and is memory mapped
+when loaded, so that textures can be uploaded straight from the mapping.
+
+Cooked files are keyed by source path, and record the source's size,
+modification time and content hash. A cooked file is used if the source's
+size and time match (and the time is well before the file was cooked), or
+otherwise if the contents hash the same (in which case the recorded time is
+brought up to date).
+
+File format (version 1, native byte order): a CookedHeader, then a
+CookedLevel for each level (the full size image first), then each level's
+pixels, rows packed together, each level starting on a 16 byte boundary.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/Surface.h"
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace ci;
+
+
+struct CookedHeader
+{
+    char     magic[4];        // "OKTX"
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t  sourceTime;      // seconds since the epoch
+    uint64_t sourceHash;
+    uint32_t channelOrder;    // a SurfaceChannelOrder code
+    uint32_t hasAlpha;
+    uint32_t numLevels;
+    uint32_t mipFilter;       // a ResampleFilter, or ~0 if there is no chain
+};
+
+struct CookedLevel
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowBytes;
+    uint32_t reserved;
+    uint64_t offset;          // from the start of the file
+};
+
+
+// A mapped cooked file. Its levels point into the mapping, so are only
+// valid while it is.
+class CookedImage
+{
+public:
+    ~CookedImage();
+
+    int numLevels() const { return static_cast<int>(m_levels.size()); }
+    // Level 0 is the full size image, and the rest its mip chain.
+    const Surface& level(int i) const { return m_levels[i]; }
+
+private:
+    friend class TextureCache;
+
+    CookedImage(void* map, size_t size);
+
+    void*                m_map;
+    size_t               m_size;
+    std::vector<Surface> m_levels;
+};
+
+typedef boost::shared_ptr<CookedImage> CookedImageRef;
+
+
+// Safe to use from several threads at once.
+class TextureCache
+{
+public:
+    static const uint32_t kVersion = 1;
+    // mipFilter for images cooked without a mip chain.
+    static const int kNoMips = -1;
+
+    // Cooked files go in dir, which is created if need be.
+    explicit TextureCache(const std::string& dir);
+
+    const std::string& dir() const { return m_dir; }
+
+    // Map the cooked version of sourcePath, made with mipFilter. Returns a
+    // null ref (a miss) if there is none, or it's stale or unreadable.
+    CookedImageRef find(const std::string& sourcePath, int mipFilter);
+
+    // Cook base (and levels, its mip chain, unless mipFilter is kNoMips) as
+    // the cooked version of sourcePath. The file is written under another
+    // name and then renamed, so a partly written file is never found.
+    // Returns false if it couldn't be written.
+    bool store(const std::string& sourcePath, int mipFilter,
+               const Surface& base, const std::vector<Surface>& levels);
+
+    int hits() const;
+    int misses() const;
+
+private:
+    std::string cookedPath(const std::string& sourcePath, int mipFilter) const;
+    void countLookup(bool hit);
+
+    std::string          m_dir;
+    mutable boost::mutex m_mutex;
+    int                  m_hits;
+    int                  m_misses;
+    int                  m_tempCounter;
+};
+
+#endif
@@ -0,0 +1,315 @@
+#include "tiled_surface.h"
+#include "cairo/cairo.h"
+#include <algorithm>
+
+namespace
+{
+
+int64_t tile_key(const TiledSurface& tiled, int tx, int ty)
+{
+    return static_cast<int64_t>(ty) * tiled.numTilesX() + tx;
+}
+
+// Paths and state for every TiledContext are kept on a context on this.
+// Nothing is ever drawn on it.
+TrackedSurface& scratch_surface()
+{
+    static TrackedSurface* surface = new TrackedSurface(1, 1, true);
+    return *surface;
+}
+
+// Whether the source is a solid, fully transparent color.
+bool transparent_source(cairo_t* cr)
+{
+    double r, g, b, a;
+    return cairo_pattern_get_rgba(cairo_get_source(cr), &r, &g, &b, &a) ==
+               CAIRO_STATUS_SUCCESS &&
+           a == 0.0;
+}
+
+} // namespace
+
+
+TiledSurface::TiledSurface(int width, int height, int tileSize) :
+    m_width(width),
+    m_height(height),
+    m_tileSize(tileSize),
+    m_tilesX((width + tileSize - 1) / tileSize),
+    m_tilesY((height + tileSize - 1) / tileSize)
+{
+}
+
+TiledSurface::~TiledSurface()
+{
+    for (Tiles::iterator it = m_tiles.begin(); it != m_tiles.end(); ++it)
+    {
+        delete it->second.surface;
+    }
+}
+
+Area TiledSurface::tileBounds(int tx, int ty) const
+{
+    int x = tx * m_tileSize;
+    int y = ty * m_tileSize;
+    return Area(x, y, std::min(x + m_tileSize, m_width),
+                std::min(y + m_tileSize, m_height));
+}
+
+bool TiledSurface::tileRange(const Area& area, Area* tiles) const
+{
+    int x1 = std::max(area.getX1(), 0);
+    int y1 = std::max(area.getY1(), 0);
+    int x2 = std::min(area.getX2(), m_width);
+    int y2 = std::min(area.getY2(), m_height);
+
+    if (x1 >= x2 || y1 >= y2)
+    {
+        return false;
+    }
+
+    *tiles = Area(x1 / m_tileSize, y1 / m_tileSize,
+                  (x2 + m_tileSize - 1) / m_tileSize,
+                  (y2 + m_tileSize - 1) / m_tileSize);
+    return true;
+}
+
+TrackedSurface* TiledSurface::tile(int tx, int ty) const
+{
+    Tiles::const_iterator it = m_tiles.find(key(tx, ty));
+    return it == m_tiles.end() ? 0 : it->second.surface;
+}
+
+TrackedSurface& TiledSurface::allocateTile(int tx, int ty)
+{
+    Tile& t = m_tiles[key(tx, ty)];
+    if (!t.surface)
+    {
+        // New cairo surfaces are cleared to transparent.
+        Area bounds = tileBounds(tx, ty);
+        t.surface = new TrackedSurface(bounds.getWidth(), bounds.getHeight(),
+                                       true);
+        t.texture = 0;
+    }
+    return *t.surface;
+}
+
+gl::Texture*& TiledSurface::tileTexture(int tx, int ty)
+{
+    return m_tiles[key(tx, ty)].texture;
+}
+
+void TiledSurface::allocatedTiles(std::vector<TileRef>& tiles) const
+{
+    tiles.clear();
+    for (Tiles::const_iterator it = m_tiles.begin(); it != m_tiles.end(); ++it)
+    {
+        TileRef ref;
+        ref.tx = static_cast<int>(it->first % m_tilesX);
+        ref.ty = static_cast<int>(it->first / m_tilesX);
+        ref.surface = it->second.surface;
+        ref.texture = it->second.texture;
+        tiles.push_back(ref);
+    }
+}
+
+
+TiledContext::TiledContext(TiledSurface& target) :
+    TrackedContext(scratch_surface()),
+    m_tiled(target)
+{
+}
+
+TiledContext::~TiledContext()
+{
+    for (std::map<int64_t, TrackedContext*>::iterator it = m_contexts.begin();
+         it != m_contexts.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+void TiledContext::fillPath()
+{
+    double x1, y1, x2, y2;
+    cairo_fill_extents(getCairo(), &x1, &y1, &x2, &y2);
+
+    Area area;
+    if (userToDeviceArea(x1, y1, x2, y2, &area))
+    {
+        drawTiles(kFill, area);
+    }
+}
+
+void TiledContext::strokePath()
+{
+    double x1, y1, x2, y2;
+    cairo_stroke_extents(getCairo(), &x1, &y1, &x2, &y2);
+
+    Area area;
+    if (userToDeviceArea(x1, y1, x2, y2, &area))
+    {
+        drawTiles(kStroke, area);
+    }
+}
+
+void TiledContext::paintClip()
+{
+    // The scratch surface's clip is meaningless here, and there's no other.
+    drawTiles(kPaint, m_tiled.getBounds());
+}
+
+void TiledContext::fillText(const char* text, double x, double y)
+{
+    save();
+    translate(x, y);
+    cairo::TextExtents extents = textExtents(text);
+    Area area;
+    bool any = userToDeviceArea(extents.xBearing(), extents.yBearing(),
+                                extents.xBearing() + extents.width(),
+                                extents.yBearing() + extents.height(), &area);
+    restore();
+
+    if (any)
+    {
+        drawTiles(kText, area, text, x, y);
+    }
+}
+
+bool TiledContext::drawsNothing()
+{
+    cairo_t* cr = getCairo();
+    return cairo_get_operator(cr) == CAIRO_OPERATOR_OVER &&
+           transparent_source(cr);
+}
+
+bool TiledContext::keepsTransparent()
+{
+    cairo_t* cr = getCairo();
+    switch (cairo_get_operator(cr))
+    {
+    // Transparent wherever the destination is, whatever the source.
+    case CAIRO_OPERATOR_CLEAR:
+    case CAIRO_OPERATOR_IN:
+    case CAIRO_OPERATOR_DEST:
+    case CAIRO_OPERATOR_DEST_IN:
+    case CAIRO_OPERATOR_DEST_OUT:
+    case CAIRO_OPERATOR_ATOP:
+        return true;
+    default:
+        // Every operator gives transparent from transparent on transparent.
+        return transparent_source(cr);
+    }
+}
+
+TrackedContext& TiledContext::tileContext(int tx, int ty)
+{
+    TrackedContext*& ctx = m_contexts[tile_key(m_tiled, tx, ty)];
+    if (!ctx)
+    {
+        ctx = new TrackedContext(m_tiled.allocateTile(tx, ty));
+    }
+    return *ctx;
+}
+
+void TiledContext::drawTiles(Op op, const Area& area, const char* text,
+                             double x, double y)
+{
+    Area tiles;
+    if (!m_tiled.tileRange(area, &tiles) || drawsNothing())
+    {
+        return;
+    }
+
+    // The tiles to draw on, as (tx, ty).
+    std::vector<std::pair<int, int> > targets;
+    if (keepsTransparent())
+    {
+        std::vector<TiledSurface::TileRef> allocated;
+        m_tiled.allocatedTiles(allocated);
+        for (size_t i = 0; i < allocated.size(); ++i)
+        {
+            const TiledSurface::TileRef& t = allocated[i];
+            if (t.tx >= tiles.getX1() && t.tx < tiles.getX2() &&
+                t.ty >= tiles.getY1() && t.ty < tiles.getY2())
+            {
+                targets.push_back(std::make_pair(t.tx, t.ty));
+            }
+        }
+    }
+    else
+    {
+        for (int ty = tiles.getY1(); ty < tiles.getY2(); ++ty)
+        {
+            for (int tx = tiles.getX1(); tx < tiles.getX2(); ++tx)
+            {
+                targets.push_back(std::make_pair(tx, ty));
+            }
+        }
+    }
+
+    cairo_t* cr = getCairo();
+    cairo_matrix_t matrix;
+    cairo_get_matrix(cr, &matrix);
+    cairo_matrix_t fontMatrix;
+    cairo_get_font_matrix(cr, &fontMatrix);
+
+    // In user space, so it's the same for every tile.
+    cairo_path_t* path = 0;
+    if (op == kFill || op == kStroke)
+    {
+        path = cairo_copy_path(cr);
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        const int tx = targets[i].first;
+        const int ty = targets[i].second;
+        TrackedContext& tile = tileContext(tx, ty);
+        cairo_t* tcr = tile.getCairo();
+
+        // The same matrix, then moved so that the tile's origin is at
+        // the device origin.
+        Area bounds = m_tiled.tileBounds(tx, ty);
+        cairo_matrix_t offset;
+        cairo_matrix_init_translate(&offset, -bounds.getX1(),
+                                    -bounds.getY1());
+        cairo_matrix_t tileMatrix;
+        cairo_matrix_multiply(&tileMatrix, &matrix, &offset);
+        cairo_set_matrix(tcr, &tileMatrix);
+
+        cairo_set_source(tcr, cairo_get_source(cr));
+        cairo_set_operator(tcr, cairo_get_operator(cr));
+        cairo_set_antialias(tcr, cairo_get_antialias(cr));
+        cairo_set_fill_rule(tcr, cairo_get_fill_rule(cr));
+        cairo_set_line_width(tcr, cairo_get_line_width(cr));
+        cairo_set_line_cap(tcr, cairo_get_line_cap(cr));
+        cairo_set_line_join(tcr, cairo_get_line_join(cr));
+        cairo_set_miter_limit(tcr, cairo_get_miter_limit(cr));
+
+        cairo_new_path(tcr);
+        switch (op)
+        {
+        case kFill:
+            cairo_append_path(tcr, path);
+            tile.fillPath();
+            break;
+        case kStroke:
+            cairo_append_path(tcr, path);
+            tile.strokePath();
+            break;
+        case kPaint:
+            tile.paintClip();
+            break;
+        case kText:
+            cairo_set_font_face(tcr, cairo_get_font_face(cr));
+            cairo_set_font_matrix(tcr, &fontMatrix);
+            tile.fillText(text, x, y);
+            break;
+        }
+    }
+
+    if (path)
+    {
+        cairo_path_destroy(path);
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef orlok_tiled_surface_h
+#define orlok_tiled_surface_h
+
+/*
+Surfaces too large to be one cairo surface or one texture (scrolling
+backgrounds, level maps), stored as square tiles. Each tile is a
+TrackedSurface of its own, allocated the first time something is drawn on
+it, so a sparse map only costs what's actually drawn; tiles never drawn on
+are transparent. Tiles along the right and bottom edges are cut down to the
+surface's size. Each tile can have a texture of its own, kept up to date
+from its damage by the backend (see cinder_gl_draw_tiled_surface).
+
+Keeping every cairo surface small also keeps cairo (and pixman) well inside
+the coordinate ranges they can handle.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/Area.h"
+#include "cinder/gl/Texture.h"
+#include "tracked_surface.h"
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+using namespace ci;
+
+
+class TiledSurface
+{
+public:
+    static const int kMinTileSize = 16;
+    static const int kMaxTileSize = 4096;
+    // cairo's fixed point device coordinates go no further than this.
+    static const int kMaxSize = 1 << 23;
+
+    // All sizes must be in range (see above).
+    TiledSurface(int width, int height, int tileSize);
+    // Frees the tiles' surfaces, but not their textures, which must already
+    // have been freed on the GL thread.
+    ~TiledSurface();
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    Area getBounds() const { return Area(0, 0, m_width, m_height); }
+    int tileSize() const { return m_tileSize; }
+    int numTilesX() const { return m_tilesX; }
+    int numTilesY() const { return m_tilesY; }
+
+    // The part of the surface tile (tx, ty) covers.
+    Area tileBounds(int tx, int ty) const;
+    // Set *tiles to the range of tiles (x2 and y2 exclusive) overlapping
+    // area. Returns false if there are none.
+    bool tileRange(const Area& area, Area* tiles) const;
+
+    // Null if the tile hasn't been allocated.
+    TrackedSurface* tile(int tx, int ty) const;
+    TrackedSurface& allocateTile(int tx, int ty);
+    int numAllocatedTiles() const { return static_cast<int>(m_tiles.size()); }
+
+    // The tile's texture (null if it has none). Only for allocated tiles.
+    gl::Texture*& tileTexture(int tx, int ty);
+
+    // Allocated tiles, with their tile coordinates.
+    struct TileRef
+    {
+        int             tx, ty;
+        TrackedSurface* surface;
+        gl::Texture*    texture;
+    };
+    void allocatedTiles(std::vector<TileRef>& tiles) const;
+
+private:
+    struct Tile
+    {
+        TrackedSurface* surface;
+        gl::Texture*    texture;
+    };
+
+    // Keyed by ty * numTilesX + tx.
+    typedef std::map<int64_t, Tile> Tiles;
+
+    int64_t key(int tx, int ty) const
+    {
+        return static_cast<int64_t>(ty) * m_tilesX + tx;
+    }
+
+    int   m_width;
+    int   m_height;
+    int   m_tileSize;
+    int   m_tilesX;
+    int   m_tilesY;
+    Tiles m_tiles;
+};
+
+
+// A cairo context that draws on a TiledSurface. Paths and state (matrix,
+// source, line style, font) are kept on a context of its own, on a tiny
+// scratch surface; each fill, stroke or paint is then repeated on the
+// context of each tile it covers (allocating the tile if need be), under
+// the same matrix offset by the tile's position.
+//
+// The source is set on each tile under the current matrix, which is how
+// orlok always sets it (the matrix, then the source, for each draw).
+// Clipping isn't supported. A draw that leaves transparent pixels
+// transparent (eg, a paint with CAIRO_OPERATOR_CLEAR, or with a transparent
+// source) is repeated only on tiles already allocated, so only opaque paints
+// allocate the whole surface.
+class TiledContext : public TrackedContext
+{
+public:
+    explicit TiledContext(TiledSurface& target);
+    ~TiledContext();
+
+    TiledSurface& tiledTarget() { return m_tiled; }
+
+    void fillPath();
+    void strokePath();
+    void paintClip();
+    void fillText(const char* text, double x, double y);
+
+private:
+    enum Op
+    {
+        kFill,
+        kStroke,
+        kPaint,
+        kText
+    };
+
+    // Repeat op on every tile within area (in device space).
+    void drawTiles(Op op, const Area& area, const char* text = 0,
+                   double x = 0.0, double y = 0.0);
+    // The context for drawing on a tile, allocating both if need be.
+    TrackedContext& tileContext(int tx, int ty);
+    // Whether drawing with the current source and operator leaves the
+    // target unchanged (so there's no need to allocate tiles for it).
+    bool drawsNothing();
+    // Whether it leaves transparent pixels (like those of unallocated
+    // tiles) transparent, so only allocated tiles need drawing on.
+    bool keepsTransparent();
+
+    TiledSurface&                        m_tiled;
+    std::map<int64_t, TrackedContext*>   m_contexts;
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include "tracked_surface.h"
+#include "residency.h"
+#include "cairo/cairo.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// Note: Area's constructor swaps reversed coordinates, so emptiness has to be
+// checked before constructing one.
+bool clip_area(const Area& a, const Area& limit, Area* result)
+{
+    int x1 = std::max(a.getX1(), limit.getX1());
+    int y1 = std::max(a.getY1(), limit.getY1());
+    int x2 = std::min(a.getX2(), limit.getX2());
+    int y2 = std::min(a.getY2(), limit.getY2());
+
+    if (x1 >= x2 || y1 >= y2)
+    {
+        return false;
+    }
+
+    *result = Area(x1, y1, x2, y2);
+    return true;
+}
+
+Area union_area(const Area& a, const Area& b)
+{
+    return Area(std::min(a.getX1(), b.getX1()), std::min(a.getY1(), b.getY1()),
+                std::max(a.getX2(), b.getX2()), std::max(a.getY2(), b.getY2()));
+}
+
+int area_size(const Area& a)
+{
+    return a.getWidth() * a.getHeight();
+}
+
+bool contains_area(const Area& outer, const Area& inner)
+{
+    return inner.getX1() >= outer.getX1() && inner.getY1() >= outer.getY1() &&
+           inner.getX2() <= outer.getX2() && inner.getY2() <= outer.getY2();
+}
+
+// Merging is worthwhile if the merged rect is no bigger than the two rects
+// uploaded separately would be (which is always true if they overlap a lot).
+bool worth_merging(const Area& a, const Area& b)
+{
+    return area_size(union_area(a, b)) <= area_size(a) + area_size(b);
+}
+
+// Paths can be far outside the surface, so keep device coordinates in the
+// range of an int before converting.
+int to_pixel(double coord)
+{
+    return static_cast<int>(std::max(-1.0e7, std::min(1.0e7, coord)));
+}
+
+} // namespace
+
+
+DamageRegion::DamageRegion(const Area& bounds) :
+    m_limit(bounds),
+    m_generation(0)
+{
+}
+
+void DamageRegion::add(const Area& area)
+{
+    Area a;
+    if (!clip_area(area, m_limit, &a))
+    {
+        return;
+    }
+
+    ++m_generation;
+
+    for (size_t i = 0; i < m_rects.size(); ++i)
+    {
+        if (contains_area(m_rects[i], a))
+        {
+            return;
+        }
+    }
+
+    // Merging can make the new rect overlap rects it didn't before, so keep
+    // going until nothing more merges.
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (size_t i = 0; i < m_rects.size(); ++i)
+        {
+            if (worth_merging(m_rects[i], a))
+            {
+                a = union_area(m_rects[i], a);
+                m_rects.erase(m_rects.begin() + i);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    m_rects.push_back(a);
+
+    if (m_rects.size() > kMaxRects)
+    {
+        Area all = bounds();
+        m_rects.assign(1, all);
+    }
+}
+
+Area DamageRegion::bounds() const
+{
+    if (m_rects.empty())
+    {
+        return Area(0, 0, 0, 0);
+    }
+
+    Area result = m_rects[0];
+    for (size_t i = 1; i < m_rects.size(); ++i)
+    {
+        result = union_area(result, m_rects[i]);
+    }
+    return result;
+}
+
+
+TrackedSurface::TrackedSurface(int width, int height, bool hasAlpha) :
+    cairo::SurfaceImage(width, height, hasAlpha),
+    m_damage(Area(0, 0, width, height))
+{
+    m_damage.addAll();
+    memory_ledger().add(kMemorySurfaces, countedBytes());
+}
+
+TrackedSurface::TrackedSurface(const Surface& surface) :
+    cairo::SurfaceImage(surface),
+    m_damage(Area(0, 0, surface.getWidth(), surface.getHeight()))
+{
+    m_damage.addAll();
+    memory_ledger().add(kMemorySurfaces, countedBytes());
+}
+
+TrackedSurface::~TrackedSurface()
+{
+    memory_ledger().add(kMemorySurfaces, -countedBytes());
+}
+
+int64_t TrackedSurface::countedBytes() const
+{
+    // cairo's image surfaces are always 4 bytes per pixel.
+    return static_cast<int64_t>(getWidth()) * getHeight() * 4;
+}
+
+void TrackedSurface::pixelsChanged(const Area& area)
+{
+    // cairo may cache the surface's contents, so it has to be told.
+    markDirty();
+    m_damage.add(area);
+}
+
+void TrackedSurface::allPixelsChanged()
+{
+    markDirty();
+    m_damage.addAll();
+}
+
+Surface& TrackedSurface::lock()
+{
+    flush();
+    return getSurface();
+}
+
+void TrackedSurface::unlock(const Area& changed)
+{
+    if (changed.getWidth() > 0 && changed.getHeight() > 0)
+    {
+        pixelsChanged(changed);
+    }
+}
+
+int TrackedSurface::uploadDamage(GlStateCache& state, gl::Texture& texture)
+{
+    if (texture.getWidth() != getWidth() || texture.getHeight() != getHeight())
+    {
+        return -1;
+    }
+
+    if (m_damage.empty())
+    {
+        return 0;
+    }
+
+    // Make sure anything cairo has drawn is in memory.
+    flush();
+
+    Surface& surface = getSurface();
+
+    GLint dataFormat;
+    GLenum type;
+    gl::Texture::SurfaceChannelOrderToDataFormatAndType(
+        surface.getChannelOrder(), &dataFormat, &type);
+
+    state.bindTexture(texture.getTarget(), texture.getId());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH,
+                  surface.getRowBytes() / surface.getPixelInc());
+
+    int pixels = 0;
+    const std::vector<Area>& rects = m_damage.rects();
+
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        const Area& r = rects[i];
+        glTexSubImage2D(texture.getTarget(), 0, r.getX1(), r.getY1(),
+                        r.getWidth(), r.getHeight(), dataFormat, type,
+                        surface.getData(r.getUL()));
+        pixels += area_size(r);
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    m_damage.clear();
+    return pixels;
+}
+
+
+TrackedContext::TrackedContext(TrackedSurface& target) :
+    cairo::Context(target),
+    m_target(target)
+{
+}
+
+TrackedContext::~TrackedContext()
+{
+}
+
+void TrackedContext::fillPath()
+{
+    damageFill();
+    fillPreserve();
+}
+
+void TrackedContext::strokePath()
+{
+    damageStroke();
+    strokePreserve();
+}
+
+void TrackedContext::paintClip()
+{
+    damageClip();
+    paint();
+}
+
+void TrackedContext::fillText(const char* text, double x, double y)
+{
+    save();
+    translate(x, y);
+
+    // showText is much faster than filling the text's path.
+    cairo::TextExtents extents = textExtents(text);
+    damageUserRect(extents.xBearing(), extents.yBearing(),
+                   extents.xBearing() + extents.width(),
+                   extents.yBearing() + extents.height());
+    showText(text);
+
+    restore();
+}
+
+void TrackedContext::damageStroke()
+{
+    double x1, y1, x2, y2;
+    cairo_stroke_extents(getCairo(), &x1, &y1, &x2, &y2);
+    damageUserRect(x1, y1, x2, y2);
+}
+
+void TrackedContext::damageFill()
+{
+    double x1, y1, x2, y2;
+    cairo_fill_extents(getCairo(), &x1, &y1, &x2, &y2);
+    damageUserRect(x1, y1, x2, y2);
+}
+
+void TrackedContext::damageClip()
+{
+    double x1, y1, x2, y2;
+    cairo_clip_extents(getCairo(), &x1, &y1, &x2, &y2);
+    damageUserRect(x1, y1, x2, y2);
+}
+
+void TrackedContext::damageUserRect(double x1, double y1, double x2, double y2)
+{
+    Area area;
+    if (userToDeviceArea(x1, y1, x2, y2, &area))
+    {
+        // cairo draws straight into the surface's memory, so it doesn't need
+        // markDirty.
+        m_target.damage().add(area);
+    }
+}
+
+bool TrackedContext::userToDeviceArea(double x1, double y1,
+                                      double x2, double y2, Area* result)
+{
+    if (x1 >= x2 || y1 >= y2)
+    {
+        return false;
+    }
+
+    // The matrix may rotate, so transform all four corners.
+    double xs[4] = { x1, x2, x1, x2 };
+    double ys[4] = { y1, y1, y2, y2 };
+
+    cairo_t* cr = getCairo();
+    for (int i = 0; i < 4; ++i)
+    {
+        cairo_user_to_device(cr, &xs[i], &ys[i]);
+    }
+
+    // Pad by a pixel for antialiasing.
+    int dx1 = to_pixel(std::floor(*std::min_element(xs, xs + 4))) - 1;
+    int dy1 = to_pixel(std::floor(*std::min_element(ys, ys + 4))) - 1;
+    int dx2 = to_pixel(std::ceil(*std::max_element(xs, xs + 4))) + 1;
+    int dy2 = to_pixel(std::ceil(*std::max_element(ys, ys + 4))) + 1;
+
+    *result = Area(dx1, dy1, dx2, dy2);
+    return true;
+}
@@ -0,0 +1,135 @@
+#ifndef orlok_tracked_surface_h
+#define orlok_tracked_surface_h
+
+/*
+Surfaces (aka bitmaps) that remember which of their pixels have changed
+("damage") since they were last uploaded to a texture, so that only those
+parts need to be sent to GL again.
+
+Every backend function that changes a surface's pixels adds to its damage:
+direct pixel operations add the area they touch, and drawing through a
+TrackedContext adds the device space extents of what was drawn.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include "cinder/cairo/Cairo.h"
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/Area.h"
+#include "gl_state.h"
+#include <stdint.h>
+#include <vector>
+
+using namespace ci;
+
+
+// A set of rects within bounds. Overlapping rects (and rects which would
+// waste little area by being merged) are merged, and if there get to be too
+// many the region collapses to their bounding rect. So the region always
+// covers everything added, but may cover a bit more.
+class DamageRegion
+{
+public:
+    static const size_t kMaxRects = 16;
+
+    explicit DamageRegion(const Area& bounds);
+
+    // Add area, clipped to the region's bounds.
+    void add(const Area& area);
+    void addAll() { add(m_limit); }
+    void clear() { m_rects.clear(); }
+
+    bool empty() const { return m_rects.empty(); }
+    const std::vector<Area>& rects() const { return m_rects; }
+
+    // Goes up every time damage is added (and not when it's cleared), so
+    // shows whether the pixels may have changed since some earlier time.
+    unsigned generation() const { return m_generation; }
+
+    // Bounding rect of all damage (an empty Area if there is none).
+    Area bounds() const;
+
+private:
+    Area              m_limit;
+    std::vector<Area> m_rects;
+    unsigned          m_generation;
+};
+
+
+class TrackedSurface : public cairo::SurfaceImage
+{
+public:
+    // New surfaces start out entirely damaged, since no texture has their
+    // contents yet.
+    TrackedSurface(int width, int height, bool hasAlpha);
+    explicit TrackedSurface(const Surface& surface);
+    ~TrackedSurface();
+
+    DamageRegion& damage() { return m_damage; }
+    const DamageRegion& damage() const { return m_damage; }
+
+    // Call after changing pixels through getSurface() (rather than cairo).
+    void pixelsChanged(const Area& area);
+    void allPixelsChanged();
+
+    // Direct access to the pixels, eg, for Dylan code writing them through
+    // a raw pointer. lock() makes sure anything cairo has drawn is in memory.
+    // Call unlock() with the area changed (an empty Area if nothing was)
+    // before drawing with cairo again.
+    Surface& lock();
+    void unlock(const Area& changed);
+
+    // Copy the damaged parts of the surface into the same place in texture,
+    // which must be the same size as the surface, and clear the damage.
+    // Returns the number of pixels uploaded, or -1 if texture is the wrong
+    // size (in which case the damage is kept).
+    int uploadDamage(GlStateCache& state, gl::Texture& texture);
+
+private:
+    // Bytes counted in memory_ledger() (see residency.h).
+    int64_t countedBytes() const;
+
+    DamageRegion m_damage;
+};
+
+
+// A cairo context that records what it draws as damage on its target.
+class TrackedContext : public cairo::Context
+{
+public:
+    explicit TrackedContext(TrackedSurface& target);
+    virtual ~TrackedContext();
+
+    TrackedSurface& target() { return m_target; }
+
+    // Draw, adding what's drawn to the damage. Filling and stroking keep
+    // the current path. Virtual so that a TiledContext (see tiled_surface.h)
+    // can draw into its tiles instead.
+    virtual void fillPath();
+    virtual void strokePath();
+    // Paint everything within the clip.
+    virtual void paintClip();
+    // Fill text (in the current font) with its origin at x, y.
+    virtual void fillText(const char* text, double x, double y);
+
+    // Add the area covered by the current path when stroked or filled
+    // (call before stroking or filling).
+    void damageStroke();
+    void damageFill();
+    // Add the current clip area (ie, everything paint() affects).
+    void damageClip();
+    // Add a rect given in user space (ie, under the current matrix).
+    void damageUserRect(double x1, double y1, double x2, double y2);
+
+protected:
+    // The device space pixels (padded for antialiasing) covered by a rect
+    // in user space. Returns false if the rect is empty.
+    bool userToDeviceArea(double x1, double y1, double x2, double y2,
+                          Area* result);
+
+private:
+    TrackedSurface& m_target;
+};
+
+#endif
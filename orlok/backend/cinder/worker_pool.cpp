@@ -0,0 +1,160 @@
+#include "worker_pool.h"
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+
+namespace
+{
+
+// Shared by everyone working on one parallelFor. Helpers may only get to
+// run after the work is all done, so this lives as long as they need it.
+struct ParallelRange
+{
+    WorkerPool::RangeJob fn;
+    int count;
+    int chunkSize;
+
+    boost::mutex              mutex;
+    boost::condition_variable finished;
+    int next;       // start of the next chunk to hand out
+    int remaining;  // items not yet done
+
+    // Take and run chunks until there are none left.
+    void work()
+    {
+        for (;;)
+        {
+            int begin;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                if (next >= count)
+                {
+                    return;
+                }
+                begin = next;
+                next = std::min(count, next + chunkSize);
+            }
+            const int end = std::min(count, begin + chunkSize);
+
+            fn(begin, end);
+
+            boost::lock_guard<boost::mutex> lock(mutex);
+            remaining -= end - begin;
+            if (remaining == 0)
+            {
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+void help(boost::shared_ptr<ParallelRange> range)
+{
+    range->work();
+}
+
+} // namespace
+
+
+WorkerPool::WorkerPool(int numThreads) :
+    m_quit(false)
+{
+    if (numThreads < 0)
+    {
+        numThreads = std::max(0, static_cast<int>(
+                                     boost::thread::hardware_concurrency()) - 1);
+    }
+
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_threads.create_thread(boost::bind(&WorkerPool::run, this));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_quit = true;
+        m_changed.notify_all();
+    }
+    m_threads.join_all();
+}
+
+void WorkerPool::post(const Job& job)
+{
+    if (numThreads() == 0)
+    {
+        job();
+        return;
+    }
+
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_jobs.push_back(job);
+    m_changed.notify_one();
+}
+
+void WorkerPool::parallelFor(int count, int grain, const RangeJob& fn)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // A few chunks per thread, so that uneven chunks even out.
+    const int threads = numThreads() + 1;
+    const int chunkSize = std::max(std::max(grain, 1),
+                                   (count + threads * 4 - 1) / (threads * 4));
+    const int numChunks = (count + chunkSize - 1) / chunkSize;
+
+    if (numChunks == 1 || numThreads() == 0)
+    {
+        fn(0, count);
+        return;
+    }
+
+    boost::shared_ptr<ParallelRange> range(new ParallelRange);
+    range->fn = fn;
+    range->count = count;
+    range->chunkSize = chunkSize;
+    range->next = 0;
+    range->remaining = count;
+
+    const int helpers = std::min(numThreads(), numChunks - 1);
+    for (int i = 0; i < helpers; ++i)
+    {
+        post(boost::bind(&help, range));
+    }
+
+    range->work();
+
+    // Wait for chunks other threads are still working on.
+    boost::unique_lock<boost::mutex> lock(range->mutex);
+    while (range->remaining > 0)
+    {
+        range->finished.wait(lock);
+    }
+}
+
+void WorkerPool::run()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while (m_jobs.empty() && !m_quit)
+            {
+                m_changed.wait(lock);
+            }
+            if (m_jobs.empty())
+            {
+                return; // quitting, with nothing left to do
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        job();
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef orlok_worker_pool_h
+#define orlok_worker_pool_h
+
+/*
+A fixed set of threads for CPU work that can be split up or done in the
+background, like resampling images. Nothing here touches GL.
+
+parallelFor splits a range into chunks, which the workers and the calling
+thread take in turn, and returns once all of them are done. Since the
+caller takes chunks as well, it always makes progress even when every
+worker is busy (or there are none), so it's fine to call it from a job
+running on the pool itself.
+
+Not part of the Dylan-callable interface (see cinder_backend.h for that).
+*/
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+
+
+class WorkerPool
+{
+public:
+    typedef boost::function<void ()> Job;
+    // Called with a range [begin, end) of the work to do.
+    typedef boost::function<void (int begin, int end)> RangeJob;
+
+    // With numThreads < 0, uses one thread less than the machine has (the
+    // calling thread being the other one).
+    explicit WorkerPool(int numThreads = -1);
+    // Waits for queued jobs to finish.
+    ~WorkerPool();
+
+    int numThreads() const { return static_cast<int>(m_threads.size()); }
+
+    // Run job on a worker, as soon as one is free. With no workers, runs
+    // it right away instead.
+    void post(const Job& job);
+
+    // Run fn over [0, count) in chunks of at least grain, in parallel, and
+    // wait for all of it.
+    void parallelFor(int count, int grain, const RangeJob& fn);
+
+private:
+    void run();
+
+    boost::thread_group       m_threads;
+    boost::mutex              m_mutex;
+    boost::condition_variable m_changed;
+    std::deque<Job>           m_jobs;
+    bool                      m_quit;
+};
+
+#endif